@@ -2,10 +2,24 @@
 #ifndef FMS_CHAR_VIEW_INCLUDED
 #define FMS_CHAR_VIEW_INCLUDED
 #include "fms_view.h"
+#include "fms_phase_scope.h"
 #include <cctype>
 
 namespace fms {
 
+	// constexpr std::isspace for the "C" locale
+	template<class T>
+	constexpr bool is_space(T c)
+	{
+		return c == ' ' or c == '\t' or c == '\n' or c == '\v' or c == '\f' or c == '\r';
+	}
+	// constexpr std::isdigit
+	template<class T>
+	constexpr bool is_digit(T c)
+	{
+		return c >= '0' and c <= '9';
+	}
+
 	template<class T> // require std::is_same_v<char,remove_const<T>::value>> || wchar_t
 	struct char_view : public view<T> {
 		// bring in all constructors
@@ -92,18 +106,20 @@ namespace fms {
 		}
 
 		// remove white space from beginning
-		char_view& wstrim()
+		constexpr char_view& wstrim()
 		{
-			while (len and std::isspace(view<T>::front())) {
+			FMS_PHASE(trim);
+			while (len and is_space(view<T>::front())) {
 				view<T>::drop(1);
 			}
 
 			return *this;
 		}
 		// remove white space from end
-		char_view& trimws()
+		constexpr char_view& trimws()
 		{
-			while (len and std::isspace(view<T>::back())) {
+			FMS_PHASE(trim);
+			while (len and is_space(view<T>::back())) {
 				view<T>::drop(-1);
 			}
 
@@ -141,6 +157,9 @@ namespace fms {
 				v.trimws();
 				assert(v.equal("abc"));
 			}
+			{
+				static_assert(char_view<const char>(" \tabc\n").wstrim().trimws().equal("abc"));
+			}
 
 			return 0;
 		}
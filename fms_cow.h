@@ -0,0 +1,197 @@
+// fms_cow.h - copy on write container
+#ifndef FMS_COW_INCLUDED
+#define FMS_COW_INCLUDED
+#include <atomic>
+#include <initializer_list>
+#include <memory>
+#include <utility>
+
+namespace fms {
+
+	/// <summary>
+	/// Reference counted container copied only when modified while shared
+	/// </summary>
+	/// <remarks>
+	/// Copies share the container so copying is O(1).
+	/// Non-const member functions call edit() which clones the container
+	/// if it is shared. Reference counts are atomic so shared read-only
+	/// containers can be copied and read by any number of threads, as long as
+	/// reading the elements does not modify them, e.g. json::lazy_value numbers.
+	/// use_count() is a relaxed load, so when edit() or shared() finds the
+	/// container unshared an acquire fence orders the reads of threads that
+	/// released their copies before any write that follows.
+	/// Mutable references returned by edit() are invalidated by copying the cow.
+	/// </remarks>
+	template<class C>
+	class cow {
+		std::shared_ptr<C> p; // null is the empty container
+	public:
+		using value_type = typename C::value_type;
+		using size_type = typename C::size_type;
+		using const_iterator = typename C::const_iterator;
+		using iterator = const_iterator;
+
+		cow() noexcept
+		{ }
+		cow(const C& c)
+			: p(std::make_shared<C>(c))
+		{ }
+		cow(C&& c)
+			: p(std::make_shared<C>(std::move(c)))
+		{ }
+		cow(std::initializer_list<value_type> il)
+			: p(std::make_shared<C>(il))
+		{ }
+		cow(const cow&) = default;
+		cow(cow&&) noexcept = default;
+		cow& operator=(const cow&) = default;
+		cow& operator=(cow&&) noexcept = default;
+		~cow()
+		{ }
+
+		// container, possibly shared
+		const C& operator*() const
+		{
+			static const C empty;
+
+			return p ? *p : empty;
+		}
+		const C* operator->() const
+		{
+			return &operator*();
+		}
+		// true if the container is shared with another cow
+		bool shared() const noexcept
+		{
+			if (p and p.use_count() > 1) {
+				return true;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire); // see released copies
+
+			return false;
+		}
+		// same container
+		bool same(const cow& c) const noexcept
+		{
+			return p == c.p;
+		}
+
+		// unique container to modify
+		C& edit()
+		{
+			if (!p) {
+				p = std::make_shared<C>();
+			}
+			else if (p.use_count() > 1) {
+				p = std::make_shared<C>(*p);
+			}
+			else {
+				std::atomic_thread_fence(std::memory_order_acquire); // see released copies
+			}
+
+			return *p;
+		}
+
+		bool operator==(const cow& c) const
+		{
+			return same(c) or **this == *c;
+		}
+
+		size_type size() const
+		{
+			return p ? p->size() : 0;
+		}
+		bool empty() const
+		{
+			return !p or p->empty();
+		}
+		const_iterator begin() const
+		{
+			return (**this).begin();
+		}
+		const_iterator end() const
+		{
+			return (**this).end();
+		}
+
+		template<class K>
+		auto find(const K& k) const
+		{
+			return (**this).find(k);
+		}
+		template<class K>
+		decltype(auto) at(const K& k) const
+		{
+			return (**this).at(k);
+		}
+		template<class K>
+		decltype(auto) operator[](const K& k)
+		{
+			return edit()[k];
+		}
+		template<class K>
+		decltype(auto) operator[](const K& k) const
+		{
+			return (**this)[k];
+		}
+
+		template<class... Args>
+		decltype(auto) insert(Args&&... args)
+		{
+			return edit().insert(std::forward<Args>(args)...);
+		}
+		template<class... Args>
+		decltype(auto) emplace(Args&&... args)
+		{
+			return edit().emplace(std::forward<Args>(args)...);
+		}
+		template<class... Args>
+		decltype(auto) emplace_back(Args&&... args)
+		{
+			return edit().emplace_back(std::forward<Args>(args)...);
+		}
+		template<class V>
+		void push_back(V&& v)
+		{
+			edit().push_back(std::forward<V>(v));
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				cow<C> c;
+				assert(c.empty());
+				assert(c.begin() == c.end());
+				auto c2{ c };
+				assert(c2 == c);
+				assert(!c.shared());
+			}
+			{
+				cow<C> c{ 1, 2, 3 };
+				assert(c.size() == 3);
+				auto c2{ c };
+				assert(c.shared() and c2.shared());
+				assert(c.same(c2));
+				assert(std::as_const(c2)[1] == 2);
+				c2.push_back(4); // clone
+				assert(!c.same(c2));
+				assert(!c.shared() and !c2.shared());
+				assert(c.size() == 3 and c2.size() == 4);
+				const C* p = &*c2;
+				c2[0] = 0; // unique, no clone
+				assert(p == &*c2);
+				assert(c[0] == 1 and c2[0] == 0);
+				assert(!(c == c2));
+				c = c2;
+				assert(c == c2);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_COW_INCLUDED
@@ -0,0 +1,150 @@
+// fms_cpu.h - detect CPU features once and pick kernels at run time
+#ifndef FMS_CPU_INCLUDED
+#define FMS_CPU_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) or defined(_M_X64)
+#define FMS_CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+// MSVC allows any intrinsic in any function
+#define FMS_TARGET(isa)
+#else
+#include <immintrin.h>
+// compile one function for a wider instruction set than the rest
+#define FMS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+namespace fms::cpu {
+
+	// instruction set levels, each includes the ones before
+	enum isa : int {
+		scalar, // portable C++
+		sse2,   // every x86-64
+		avx2,
+		avx512, // AVX-512 F and BW
+		levels,
+	};
+
+	inline const char* name(isa i)
+	{
+		static const char* names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+		return i >= scalar and i < levels ? names[i] : "";
+	}
+	// level with name s, or levels if none
+	inline isa parse(const char* s)
+	{
+		for (int i = scalar; i < levels; ++i) {
+			if (s and 0 == std::strcmp(s, name(static_cast<isa>(i)))) {
+				return static_cast<isa>(i);
+			}
+		}
+
+		return levels;
+	}
+
+	// highest level this CPU and operating system support
+	inline isa detect()
+	{
+#if defined(FMS_CPU_X86) and defined(_MSC_VER)
+		int r[4];
+		__cpuid(r, 0);
+		const int n = r[0];
+		__cpuid(r, 1);
+		// the OS saves the AVX registers
+		if (!(r[2] & (1 << 27)) or !(r[2] & (1 << 28)) or (_xgetbv(0) & 0x6) != 0x6 or n < 7) {
+			return sse2;
+		}
+		__cpuidex(r, 7, 0);
+		if (!(r[1] & (1 << 5))) {
+			return sse2;
+		}
+		if ((r[1] & (1 << 16)) and (r[1] & (1 << 30)) and (_xgetbv(0) & 0xE6) == 0xE6) {
+			return avx512;
+		}
+
+		return avx2;
+#elif defined(FMS_CPU_X86)
+		// also checks the OS saves the registers
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512bw")) {
+			return avx512;
+		}
+		if (__builtin_cpu_supports("avx2")) {
+			return avx2;
+		}
+
+		return sse2;
+#else
+		return scalar;
+#endif
+	}
+
+	// level kernels use, starts at detect() or FMS_CPU from the environment if lower
+	inline std::atomic<int>& current()
+	{
+		static std::atomic<int> l = [] {
+			isa i = detect();
+			isa e = parse(std::getenv("FMS_CPU"));
+
+			return e < i ? e : i;
+		}();
+
+		return l;
+	}
+	inline isa level()
+	{
+		return static_cast<isa>(current().load(std::memory_order_relaxed));
+	}
+	// use level i, or the highest supported below it, e.g. to benchmark each level
+	inline isa use(isa i)
+	{
+		isa d = detect();
+		if (i < scalar) {
+			i = scalar;
+		}
+		current().store(i < d ? i : d, std::memory_order_relaxed);
+
+		return level();
+	}
+
+	// call kernel[level()] with the arguments, Kernel is a function pointer type
+	template<class Kernel, class... Args>
+	inline auto call(const Kernel (&kernel)[levels], Args... args)
+	{
+		return kernel[level()](args...);
+	}
+
+#ifdef _DEBUG
+	inline int test()
+	{
+		for (int i = scalar; i < levels; ++i) {
+			assert(parse(name(static_cast<isa>(i))) == i);
+		}
+		assert(parse("mmx") == levels);
+		assert(parse(nullptr) == levels);
+
+		isa l = level();
+		assert(l <= detect());
+		assert(use(scalar) == scalar);
+		assert(use(avx512) == detect());
+#ifdef FMS_CPU_X86
+		assert(detect() >= sse2);
+#endif
+		use(l);
+
+		return 0;
+	}
+#endif // _DEBUG
+
+} // namespace fms::cpu
+
+#endif // FMS_CPU_INCLUDED
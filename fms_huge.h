@@ -0,0 +1,295 @@
+// fms_huge.h - memory backed by huge pages to reduce TLB misses
+#ifndef FMS_HUGE_INCLUDED
+#define FMS_HUGE_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#include <vector>
+#endif
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <utility>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#include "fms_probe.h"
+#include "fms_view.h"
+
+namespace fms {
+
+	// size of a huge page on x86-64 and most aarch64 kernels
+	inline constexpr std::size_t huge_page = std::size_t(1) << 21;
+
+	// n rounded up to a multiple of huge_page
+	constexpr std::size_t huge_size(std::size_t n)
+	{
+		return (n + huge_page - 1) & ~(huge_page - 1);
+	}
+
+	// ask for transparent huge pages for the huge_page aligned part of [p, p + n)
+	// true if the kernel accepted, which it does not for some file systems
+	inline bool huge_advise(const void* p, std::size_t n)
+	{
+#if defined(__linux__) and defined(MADV_HUGEPAGE)
+		std::size_t b = (reinterpret_cast<std::size_t>(p) + huge_page - 1) & ~(huge_page - 1);
+		std::size_t e = (reinterpret_cast<std::size_t>(p) + n) & ~(huge_page - 1);
+
+		return b < e and 0 == ::madvise(reinterpret_cast<void*>(b), e - b, MADV_HUGEPAGE);
+#else
+		(void)p;
+		(void)n;
+
+		return false;
+#endif
+	}
+
+	/// <summary>
+	/// Allocate huge_size(n) bytes aligned to huge_page
+	/// </summary>
+	/// <remarks>
+	/// On Linux this uses pages from the hugetlb pool if any are reserved,
+	/// otherwise it maps aligned memory and asks for transparent huge pages
+	/// with MADV_HUGEPAGE. Elsewhere it uses aligned operator new.
+	/// Release the memory with huge_free using the same n.
+	/// Returns nullptr if no memory is available.
+	/// </remarks>
+	inline void* huge_alloc(std::size_t n)
+	{
+		const std::size_t m = huge_size(n ? n : 1);
+#ifdef __linux__
+#ifdef MAP_HUGETLB
+		void* p = ::mmap(nullptr, m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			FMS_PROBE(huge_alloc, m, 1);
+
+			return p;
+		}
+#endif
+		// over allocate then unmap the ends to get an aligned mapping
+		char* q = static_cast<char*>(::mmap(nullptr, m + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		if (q == MAP_FAILED) {
+			return nullptr;
+		}
+		char* b = reinterpret_cast<char*>((reinterpret_cast<std::size_t>(q) + huge_page - 1) & ~(huge_page - 1));
+		if (b != q) {
+			::munmap(q, b - q);
+		}
+		if (b + m != q + m + huge_page) {
+			::munmap(b + m, q + huge_page - b);
+		}
+		huge_advise(b, m);
+		FMS_PROBE(huge_alloc, m, 0);
+
+		return b;
+#else
+		return ::operator new(m, std::align_val_t(huge_page), std::nothrow);
+#endif
+	}
+	inline void huge_free(void* p, std::size_t n)
+	{
+		if (p) {
+#ifdef __linux__
+			::munmap(p, huge_size(n ? n : 1));
+#else
+			::operator delete(p, std::align_val_t(huge_page));
+#endif
+		}
+	}
+
+	/// <summary>
+	/// Allocator for standard containers using huge pages for large blocks
+	/// </summary>
+	/// <remarks>
+	/// Blocks smaller than a huge page come from std::allocator so small
+	/// containers do not each take 2MB.
+	/// </remarks>
+	template<class T>
+	struct huge_allocator {
+		using value_type = T;
+
+		huge_allocator() = default;
+		template<class U>
+		huge_allocator(const huge_allocator<U>&)
+		{ }
+
+		T* allocate(std::size_t n)
+		{
+			if (n * sizeof(T) < huge_page) {
+				return std::allocator<T>().allocate(n);
+			}
+			void* p = huge_alloc(n * sizeof(T));
+			if (!p) {
+				throw std::bad_alloc();
+			}
+
+			return static_cast<T*>(p);
+		}
+		void deallocate(T* p, std::size_t n)
+		{
+			if (n * sizeof(T) < huge_page) {
+				std::allocator<T>().deallocate(p, n);
+			}
+			else {
+				huge_free(p, n * sizeof(T));
+			}
+		}
+
+		template<class U>
+		bool operator==(const huge_allocator<U>&) const
+		{
+			return true;
+		}
+	};
+
+	/// <summary>
+	/// Growable output buffer in huge pages
+	/// </summary>
+	/// <remarks>
+	/// Has append(const char*, n) so writers can use it as their Buffer.
+	/// Starts small and switches to huge pages once it holds more than
+	/// half of one, doubling when it fills.
+	/// </remarks>
+	class huge_buffer {
+		char* buf = nullptr;
+		std::size_t len = 0, cap = 0;
+
+		void free()
+		{
+			if (cap >= huge_page) {
+				huge_free(buf, cap);
+			}
+			else {
+				delete[] buf;
+			}
+		}
+
+	public:
+		huge_buffer() = default;
+		explicit huge_buffer(std::size_t n)
+		{
+			reserve(n);
+		}
+		huge_buffer(const huge_buffer&) = delete;
+		huge_buffer& operator=(const huge_buffer&) = delete;
+		huge_buffer(huge_buffer&& b) noexcept
+			: buf(std::exchange(b.buf, nullptr)), len(std::exchange(b.len, 0)), cap(std::exchange(b.cap, 0))
+		{ }
+		huge_buffer& operator=(huge_buffer&& b) noexcept
+		{
+			if (this != &b) {
+				free();
+				buf = std::exchange(b.buf, nullptr);
+				len = std::exchange(b.len, 0);
+				cap = std::exchange(b.cap, 0);
+			}
+
+			return *this;
+		}
+		~huge_buffer()
+		{
+			free();
+		}
+
+		// never null, like std::string
+		const char* data() const
+		{
+			return buf ? buf : "";
+		}
+		std::size_t size() const
+		{
+			return len;
+		}
+		std::size_t capacity() const
+		{
+			return cap;
+		}
+		view<const char> chars() const
+		{
+			return view<const char>(data(), static_cast<long>(len));
+		}
+		void clear()
+		{
+			len = 0;
+		}
+
+		// room for at least n bytes
+		void reserve(std::size_t n)
+		{
+			if (n <= cap) {
+				return;
+			}
+			if (n < huge_page / 2) {
+				n = n < 4096 ? 4096 : n;
+			}
+			else {
+				n = huge_size(n);
+			}
+			char* p = n >= huge_page ? static_cast<char*>(huge_alloc(n)) : new char[n];
+			if (!p) {
+				throw std::bad_alloc();
+			}
+			FMS_PROBE(buffer_grow, cap, n);
+			if (len) {
+				std::memcpy(p, buf, len);
+			}
+			free();
+			buf = p;
+			cap = n;
+		}
+		void append(const char* s, std::size_t n)
+		{
+			if (len + n > cap) {
+				reserve(len + n > 2 * cap ? len + n : 2 * cap);
+			}
+			std::memcpy(buf + len, s, n);
+			len += n;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				static_assert(huge_size(0) == 0);
+				static_assert(huge_size(1) == huge_page);
+				static_assert(huge_size(huge_page) == huge_page);
+				char* p = static_cast<char*>(huge_alloc(3 * huge_page + 1));
+				assert(p);
+				assert(reinterpret_cast<std::size_t>(p) % huge_page == 0);
+				p[0] = 1;
+				p[4 * huge_page - 1] = 2; // rounded up
+				huge_free(p, 3 * huge_page + 1);
+			}
+			{
+				std::vector<double, huge_allocator<double>> v(huge_page / sizeof(double) + 1, 1.5);
+				assert(reinterpret_cast<std::size_t>(v.data()) % huge_page == 0);
+				assert(v.back() == 1.5);
+				std::vector<int, huge_allocator<int>> w{ 1, 2, 3 };
+				assert(w[2] == 3);
+			}
+			{
+				huge_buffer b;
+				assert(b.size() == 0);
+				b.append("abc", 3);
+				assert(b.size() == 3 and b.capacity() == 4096);
+				std::vector<char> x(huge_page, 'x');
+				b.append(x.data(), x.size());
+				assert(b.size() == 3 + huge_page);
+				assert(b.capacity() == 2 * huge_page);
+				assert(reinterpret_cast<std::size_t>(b.data()) % huge_page == 0);
+				assert(0 == std::memcmp(b.data(), "abcxx", 5));
+				huge_buffer c(std::move(b));
+				assert(b.size() == 0 and c.size() == 3 + huge_page);
+				c.clear();
+				c.append("d", 1);
+				assert(c.chars().len == 1 and c.data()[0] == 'd');
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_HUGE_INCLUDED
@@ -2,7 +2,10 @@
 #ifndef FMS_JSON_INCLUDED
 #define FMS_JSON_INCLUDED
 
+#include "fms_cow.h"
 #include "fms_parse_json.h"
+#include "fms_json_number.h"
+#include "fms_probe.h"
 
 namespace fms::json {
 
@@ -20,10 +23,12 @@ namespace fms::json {
 	};
 #undef FMS_JSON_ENUM
 
-	struct value;
-	using member = std::pair<std::string, value>;
-	using object = std::map<std::string, value>;
-	using array = std::vector<value>;
+	template<class Number> struct basic_value;
+	// objects and arrays are shared until modified so copies are O(1)
+	template<class Number>
+	using basic_object = cow<std::map<std::string, basic_value<Number>>>;
+	template<class Number>
+	using basic_array = cow<std::vector<basic_value<Number>>>;
 	using string = std::string;
 	using number = double;
 	using boolean = bool;
@@ -31,17 +36,22 @@ namespace fms::json {
 		bool operator==(const null&) const { return true; }
 	};
 
-	// JSON value
-	struct value : public std::variant<null, object, array, string, number, boolean> {
-		using var = std::variant<null, object, array, string, number, boolean>;
+	// JSON value with numbers of type Number
+	template<class Number>
+	struct basic_value : public std::variant<null, basic_object<Number>, basic_array<Number>, string, Number, boolean> {
+		using object_type = basic_object<Number>;
+		using array_type = basic_array<Number>;
+		using string_type = string;
+		using number_type = Number;
+		using var = std::variant<null, object_type, array_type, string, Number, boolean>;
 		using var::var;
-		constexpr value() noexcept
+		constexpr basic_value() noexcept
 			: var(null{})
 		{ }
-		constexpr value(const char* s)
+		constexpr basic_value(const char* s)
 			: var{ string(s) }
 		{ }
-		constexpr value(const char_view<const char>& v)
+		constexpr basic_value(const char_view<const char>& v)
 			: var{ string(v.buf, v.buf + v.len) }
 		{ }
 		explicit operator std::string& ()
@@ -52,25 +62,25 @@ namespace fms::json {
 		{
 			return std::get<string>(*this);
 		}
-		explicit constexpr value(const number& n)
+		explicit constexpr basic_value(const Number& n)
 			: var{ n }
 		{ }
-		explicit constexpr value(const int& n)
-			: var{ 1.*n }
+		explicit constexpr basic_value(const int& n)
+			: var{ Number(1.*n) }
 		{ }
 		bool operator==(const number& n) const
 		{
-			return type::JSON_NUMBER == type() and std::get<number>(*this) == n;
+			return type::JSON_NUMBER == type() and std::get<Number>(*this) == n;
 		}
-		explicit operator number& ()
+		explicit operator Number& ()
 		{
-			return std::get<number>(*this);
+			return std::get<Number>(*this);
 		}
-		explicit operator const number& () const
+		explicit operator const Number& () const
 		{
-			return std::get<number>(*this);
+			return std::get<Number>(*this);
 		}
-		constexpr value(const boolean& b)
+		constexpr basic_value(const boolean& b)
 			: var{ b }
 		{ }
 		explicit operator boolean& ()
@@ -81,23 +91,29 @@ namespace fms::json {
 		{
 			return std::get<boolean>(*this);
 		}
-		value(const value&) = default;
-		value(value&&) = default;
-		value& operator=(const value&) = default;
-		value& operator=(value&&) = default;
-		~value() = default;
+		basic_value(const basic_value&) = default;
+		basic_value(basic_value&&) = default;
+		// by value so the right side is shared before the left side is evaluated
+		// making v["a"] = v a snapshot of v instead of a cycle
+		basic_value& operator=(basic_value v) noexcept
+		{
+			var::operator=(std::move(static_cast<var&>(v)));
+
+			return *this;
+		}
+		~basic_value() = default;
 
 		enum type type() const
 		{
 			return fms::json::type(this->index());
 		}
 
-		bool operator==(const value& v) const
+		bool operator==(const basic_value& v) const
 		{
 			if (type() != v.type()) {
 				return false;
 			}
-#define FMS_JSON_CASE(x) case type::##x : \
+#define FMS_JSON_CASE(x) case type::x : \
 	return std::get<static_cast<std::size_t>(type::x)>(*this) == std::get<static_cast<std::size_t>(type::x)>(v);
 			switch (type()) {
 				FMS_JSON_TYPE(FMS_JSON_CASE)
@@ -107,34 +123,57 @@ namespace fms::json {
 		}
 
 		// object access
-		value& operator[](const string& key)
+		basic_value& operator[](const string& key)
 		{
-			return std::get<object>(*this)[key];
+			return std::get<object_type>(*this)[key];
 		}
-		value& operator[](const char* key)
+		basic_value& operator[](const char* key)
 		{
-			return std::get<object>(*this)[key];
+			return std::get<object_type>(*this)[key];
 		}
-		const value& operator[](const string& key) const
+		const basic_value& operator[](const string& key) const
 		{
-			return std::get<object>(*this).at(key);
+			return std::get<object_type>(*this).at(key);
 		}
-		const value& operator[](const char* key) const
+		const basic_value& operator[](const char* key) const
 		{
-			return std::get<object>(*this).at(key);
+			return std::get<object_type>(*this).at(key);
 		}
 
 		// array access
-		value& operator[](std::size_t i)
+		basic_value& operator[](std::size_t i)
 		{
-			return std::get<array>(*this)[i];
+			return std::get<array_type>(*this)[i];
 		}
-		const value& operator[](std::size_t i) const
+		const basic_value& operator[](std::size_t i) const
 		{
-			return std::get<array>(*this)[i];
+			return std::get<array_type>(*this)[i];
 		}
 	};
 
+	using value = basic_value<number>;
+	using member = std::pair<std::string, value>;
+	using object = value::object_type;
+	using array = value::array_type;
+
+	// numbers are converted when first read, not thread safe until then
+	using lazy_value = basic_value<lazy_number<const char>>;
+
+	// parse one JSON value and advance v
+	// Trace is trace::local to record events for each value
+	template<class Value = value, class Trace = trace::none, class T>
+	inline Value parse(char_view<T>& v)
+	{
+		FMS_PROBE(document_start, v.buf, v.len);
+		Trace::emit(trace::document, v.buf);
+		[[maybe_unused]] const T* b = v.buf;
+		Value x = parse_value<T, Value, Trace>(v);
+		Trace::emit(trace::document_end, v.buf);
+		FMS_PROBE(document_end, b, v.buf - b);
+
+		return x;
+	}
+
 #ifdef _DEBUG
 	inline int value_test()
 	{
@@ -218,6 +257,76 @@ namespace fms::json {
 			v["c"]["d"] = v;
 			assert(v["c"]["d"]["a"] == "bar");
 			assert(v["e"][2] == "baz");
+			const value& cv = v;
+			assert(cv["c"]["d"]["c"]["d"] == "foo");
+		}
+		{
+			// copies share objects and arrays until modified
+			value v(object({ { "a", value(array({ value(1), value(2) })) } }));
+			value v2{ v };
+			assert(std::get<object>(v).same(std::get<object>(v2)));
+			const value& cv2 = v2;
+			assert(cv2["a"][1] == 2.);
+			assert(std::get<object>(v).same(std::get<object>(v2)));
+			v2["a"][1] = 3.;
+			assert(!std::get<object>(v).same(std::get<object>(v2)));
+			const value& cv = v;
+			assert(cv["a"][1] == 2.);
+			assert(v2["a"][1] == 3.);
+			assert(!(v == v2));
+		}
+
+		return 0;
+	}
+
+	inline int parse_test()
+	{
+		static constexpr char json[] = R"({"a": [1, 2.50, {}], "b": {"c": "str", "d": true}, "e": null, "f": [], "g": -0.125e1})";
+		{
+			char_view v(json);
+			auto x = parse<value>(v);
+			assert(!v.wstrim());
+			assert(type::JSON_OBJECT == x.type());
+			const value& cx = x;
+			assert(cx["a"][1] == 2.5);
+			assert(type::JSON_OBJECT == cx["a"][2].type());
+			assert(cx["b"]["c"] == "str");
+			assert(cx["b"]["d"] == value(true));
+			assert(type::JSON_NULL == cx["e"].type());
+			assert(std::get<array>(cx["f"]).empty());
+			assert(cx["g"] == -1.25);
+		}
+		{
+			char_view v(json);
+			auto x = parse<lazy_value>(v);
+			assert(!v);
+			const lazy_value& cx = x;
+			const auto& a1 = std::get<lazy_number<const char>>(cx["a"][1]);
+			assert(a1.untouched());
+			assert(a1.view().equal("2.50"));
+			assert(cx["a"][1] == 2.5);
+			assert(!a1.untouched());
+			std::int64_t i;
+			assert(std::get<lazy_number<const char>>(cx["a"][std::size_t(0)]).as_int64(i) and i == 1);
+			assert(cx["g"] == -1.25);
+			assert(cx["b"]["c"] == "str");
+		}
+		{
+			auto& r = trace::ring::local();
+			r.clear();
+			char_view v(json);
+			trace::local::start(v.buf);
+			auto x = parse<value, trace::local>(v);
+			assert(x == parse<value>(v = char_view(json)));
+			assert(r.size() == 18);
+			assert(r[0].type() == trace::document and r[0].offset() == 0 and r[0].depth() == 0);
+			assert(r[1].type() == trace::object and r[1].depth() == 1);
+			assert(r[3].type() == trace::number and r[3].depth() == 3 and json[r[3].offset()] == ',');
+			assert(r[5].type() == trace::object and r[5].depth() == 3);
+			assert(r[6].type() == trace::object_end and r[6].depth() == 3);
+			assert(r[17].type() == trace::document_end and r[17].depth() == 0);
+			assert(r[17].offset() == sizeof(json) - 1);
+			r.clear();
 		}
 
 		return 0;
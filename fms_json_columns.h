@@ -0,0 +1,573 @@
+// fms_json_columns.h - extract fields of NDJSON records into typed columns
+#ifndef FMS_JSON_COLUMNS_INCLUDED
+#define FMS_JSON_COLUMNS_INCLUDED
+
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "fms_parse_json.h"
+#include "fms_json.h"
+#include "fms_progress.h"
+
+namespace fms::json {
+
+	// packed bits
+	class bitmap {
+		std::vector<std::uint64_t> w;
+		std::size_t n = 0;
+	public:
+		std::size_t size() const
+		{
+			return n;
+		}
+		bool operator[](std::size_t i) const
+		{
+			return (w[i >> 6] >> (i & 63)) & 1;
+		}
+		void push_back(bool b)
+		{
+			if ((n & 63) == 0) {
+				w.push_back(0);
+			}
+			if (b) {
+				w.back() |= std::uint64_t(1) << (n & 63);
+			}
+			++n;
+		}
+		void pop_back()
+		{
+			--n;
+			w.back() &= ~(std::uint64_t(1) << (n & 63));
+			if ((n & 63) == 0) {
+				w.pop_back();
+			}
+		}
+		void append(const bitmap& b)
+		{
+			for (std::size_t i = 0; i < b.size(); ++i) {
+				push_back(b[i]);
+			}
+		}
+		// number of bits set
+		std::size_t count() const
+		{
+			std::size_t c = 0;
+			for (auto x : w) {
+				c += std::popcount(x);
+			}
+
+			return c;
+		}
+	};
+
+	// distinct strings with stable codes
+	class dictionary {
+		std::deque<std::string> s; // elements do not move so views into them stay valid
+		std::unordered_map<std::string_view, int> index;
+	public:
+		dictionary()
+		{ }
+		dictionary(const dictionary& d)
+			: s(d.s)
+		{
+			for (int i = 0; i < size(); ++i) {
+				index.emplace(std::string_view(s[i]), i);
+			}
+		}
+		dictionary& operator=(const dictionary& d)
+		{
+			if (this != &d) {
+				dictionary d_(d);
+				std::swap(s, d_.s);
+				std::swap(index, d_.index);
+			}
+
+			return *this;
+		}
+		dictionary(dictionary&&) = default;
+		dictionary& operator=(dictionary&&) = default;
+		~dictionary()
+		{ }
+
+		int size() const
+		{
+			return static_cast<int>(s.size());
+		}
+		const std::string& operator[](int i) const
+		{
+			return s[i];
+		}
+		// code of str, adding it if not present
+		int code(std::string_view str)
+		{
+			auto i = index.find(str);
+			if (i != index.end()) {
+				return i->second;
+			}
+			s.emplace_back(str);
+			index.emplace(std::string_view(s.back()), size() - 1);
+
+			return size() - 1;
+		}
+	};
+
+	/// <summary>
+	/// Values of one field over all records
+	/// </summary>
+	/// <remarks>
+	/// Values that are missing, null, or not of the column type are not valid.
+	/// Strings are dictionary encoded and escapes are not decoded.
+	/// </remarks>
+	struct column {
+		std::string path; // dot separated member names
+		enum type type;
+		bitmap valid;
+		std::vector<double> number; // JSON_NUMBER
+		bitmap boolean; // JSON_BOOLEAN
+		std::vector<int> code; // JSON_STRING index into dict, -1 if not valid
+		dictionary dict;
+
+		column(const std::string& path, enum type type)
+			: path(path), type(type)
+		{ }
+
+		std::size_t size() const
+		{
+			return valid.size();
+		}
+		const std::string& string(std::size_t i) const
+		{
+			return dict[code[i]];
+		}
+
+		void push_null()
+		{
+			valid.push_back(false);
+			switch (type) {
+			case type::JSON_NUMBER:
+				number.push_back(std::numeric_limits<double>::quiet_NaN());
+				break;
+			case type::JSON_BOOLEAN:
+				boolean.push_back(false);
+				break;
+			case type::JSON_STRING:
+				code.push_back(-1);
+				break;
+			default:
+				break;
+			}
+		}
+		void pop_back()
+		{
+			valid.pop_back();
+			switch (type) {
+			case type::JSON_NUMBER:
+				number.pop_back();
+				break;
+			case type::JSON_BOOLEAN:
+				boolean.pop_back();
+				break;
+			case type::JSON_STRING:
+				code.pop_back();
+				break;
+			default:
+				break;
+			}
+		}
+		// append scalar value text v, not valid if of the wrong type
+		template<class T>
+		void push(char_view<T> v)
+		{
+			if (type == type::JSON_NUMBER and v and *v != '"' and *v != 'n' and *v != 't' and *v != 'f') {
+				double x = parse_number<T, double>(v);
+				if (x == x) {
+					valid.push_back(true);
+					number.push_back(x);
+
+					return;
+				}
+			}
+			else if (type == type::JSON_BOOLEAN and (*v == 't' or *v == 'f')) {
+				bool b = is_true(v);
+				if (b or is_false(v)) {
+					valid.push_back(true);
+					boolean.push_back(b);
+
+					return;
+				}
+			}
+			else if (type == type::JSON_STRING and v.eat('"')) {
+				auto s = parse_string<T, char_view<T>>(v);
+				if (v.eat('"')) {
+					valid.push_back(true);
+					code.push_back(dict.code(std::string_view(s.buf, s.len)));
+
+					return;
+				}
+			}
+			push_null();
+		}
+
+		// append the values of c
+		void append(const column& c)
+		{
+			valid.append(c.valid);
+			number.insert(number.end(), c.number.begin(), c.number.end());
+			boolean.append(c.boolean);
+			for (auto i : c.code) {
+				code.push_back(i < 0 ? i : dict.code(c.dict[i]));
+			}
+		}
+	};
+
+	/// <summary>
+	/// Extract fields of newline delimited JSON into columns
+	/// </summary>
+	/// <remarks>
+	/// Requested paths are compiled into a trie of member names.
+	/// Members not on a requested path are skipped without being parsed
+	/// and no json::value is built. Each record adds one row to every column.
+	/// </remarks>
+	class columns {
+		struct trie {
+			std::string key;
+			int col = -1; // column index if a leaf
+			std::vector<int> next; // child nodes
+		};
+		std::vector<trie> nodes; // nodes[0] is the root
+		std::vector<column> cols;
+		std::size_t errors_ = 0;
+
+		int child(int t, std::string_view key) const
+		{
+			for (int i : nodes[t].next) {
+				if (nodes[i].key == key) {
+					return i;
+				}
+			}
+
+			return -1;
+		}
+
+		// object members on the trie below t, v at opening brace
+		template<class T>
+		bool object(char_view<T>& v, int t)
+		{
+			if (!v.eat('{')) {
+				return skip_value(v);
+			}
+			if (v.wstrim().eat('}')) {
+				return true;
+			}
+			do {
+				if (!v.wstrim().eat('"')) {
+					return false;
+				}
+				auto k = parse_string<T, char_view<T>>(v);
+				if (!v.eat('"') or !v.wstrim().eat(':')) {
+					return false;
+				}
+				v.wstrim();
+				int c = child(t, std::string_view(k.buf, k.len));
+				if (c < 0) {
+					if (!skip_value(v)) {
+						return false;
+					}
+				}
+				else if (nodes[c].col >= 0) {
+					column& col = cols[nodes[c].col];
+					char_view<T> v_(v);
+					// a leaf that is also a prefix fills paths below it too
+					const bool below = !nodes[c].next.empty() and v and *v == '{';
+					if (!(below ? object(v, c) : skip_value(v))) {
+						return false;
+					}
+					if (col.size() == rows) { // first occurrence wins
+						col.push(char_view<T>(v_.buf, static_cast<long>(v.buf - v_.buf)));
+					}
+				}
+				else if (!object(v, c)) {
+					return false;
+				}
+			} while (v.wstrim().eat(','));
+
+			return v.eat('}');
+		}
+
+		// rows of the lines of v counted in b
+		template<class T>
+		void lines(char_view<T> v, progress::batch& b)
+		{
+			const T* p = v.buf;
+			while (v) {
+				const T* e = std::find(v.buf, v.buf + v.len, '\n');
+				char_view<T> line(v.buf, static_cast<long>(e - v.buf));
+				v.drop(line.len + 1);
+				if (line.wstrim()) {
+					b.document();
+					if (record(line)) {
+						b.record(v.buf - p, cols.size(), v.buf);
+					}
+					else {
+						b.error(v.buf - p, v.buf);
+					}
+					p = v.buf;
+				}
+			}
+			b.skip(v.buf - p);
+		}
+
+	public:
+		std::size_t rows = 0;
+		progress* counters = nullptr; // live counts for other threads
+
+		columns()
+			: nodes(1)
+		{ }
+		columns(std::initializer_list<std::pair<const char*, enum type>> fields)
+			: nodes(1)
+		{
+			for (const auto& [path, type] : fields) {
+				add(path, type);
+			}
+		}
+		columns(const columns&) = default;
+		columns& operator=(const columns&) = default;
+		~columns()
+		{ }
+
+		// add column for dot separated path and return its index
+		// an existing path returns its index, or -1 if the type differs
+		int add(const std::string& path, enum type type)
+		{
+			int t = 0;
+			for (std::size_t b = 0, e = 0; b <= path.size(); b = e + 1) {
+				e = std::min(path.find('.', b), path.size());
+				std::string key = path.substr(b, e - b);
+				int c = child(t, key);
+				if (c < 0) {
+					c = static_cast<int>(nodes.size());
+					nodes.push_back(trie{ key, -1, {} });
+					nodes[t].next.push_back(c);
+				}
+				t = c;
+			}
+			if (nodes[t].col >= 0) {
+				return cols[nodes[t].col].type == type ? nodes[t].col : -1;
+			}
+			nodes[t].col = static_cast<int>(cols.size());
+			cols.emplace_back(path, type);
+			for (std::size_t i = 0; i < rows; ++i) {
+				cols.back().push_null();
+			}
+
+			return nodes[t].col;
+		}
+
+		int size() const
+		{
+			return static_cast<int>(cols.size());
+		}
+		const column& operator[](int i) const
+		{
+			return cols[i];
+		}
+		// number of records that were not valid JSON objects
+		std::size_t errors() const
+		{
+			return errors_;
+		}
+		// same paths and types with no rows
+		columns schema() const
+		{
+			columns c;
+			for (const auto& col : cols) {
+				c.add(col.path, col.type);
+			}
+
+			return c;
+		}
+
+		// add one row from a JSON object, not valid fields are null
+		template<class T>
+		bool record(char_view<T> v)
+		{
+			bool ok = object(v.wstrim(), 0) and !v.wstrim();
+			if (!ok) {
+				++errors_;
+			}
+			for (auto& col : cols) {
+				if (!ok and col.size() > rows) {
+					col.pop_back(); // partial row
+				}
+				if (col.size() == rows) {
+					col.push_null();
+				}
+			}
+			++rows;
+
+			return ok;
+		}
+
+		// add one row for each non-empty line of v
+		template<class T>
+		columns& extract(char_view<T> v)
+		{
+			progress::batch b(counters, v.buf);
+			lines(v, b);
+
+			return *this;
+		}
+
+		// append rows of c having the same columns
+		columns& append(const columns& c)
+		{
+			for (int i = 0; i < size(); ++i) {
+				cols[i].append(c.cols[i]);
+			}
+			rows += c.rows;
+			errors_ += c.errors_;
+
+			return *this;
+		}
+
+		// extract lines of v using n threads, each working on a block of lines
+		template<class T>
+		columns& extract(char_view<T> v, unsigned n)
+		{
+			if (n <= 1) {
+				return extract(v);
+			}
+
+			std::vector<columns> c(n, schema());
+			std::vector<const T*> ends(n);
+			std::vector<std::thread> ts;
+			const T* b = v.buf;
+			const T* end = v.buf + v.len;
+			for (unsigned i = 0; i < n; ++i) {
+				const T* e = i + 1 == n ? end : std::find(std::max(b, v.buf + v.len * (i + 1) / n), end, '\n');
+				if (e != end) {
+					++e;
+				}
+				char_view<T> block(b, static_cast<long>(e - b));
+				ts.emplace_back([this, &c, i, block]() {
+					progress::batch pb(counters);
+					c[i].lines(block, pb);
+				});
+				ends[i] = b = e;
+			}
+			for (unsigned i = 0; i < n; ++i) {
+				ts[i].join();
+				append(c[i]);
+				if (counters) {
+					counters->offset(ends[i] - v.buf);
+				}
+			}
+
+			return *this;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			static constexpr char ndjson[] = R"({"id": 1, "px": 10.5, "ok": true, "sym": "IBM", "x": {"y": [1, {"z": 2}]}, "q": {"a": "b"}}
+{"id": 2, "ok": false, "sym": "MSFT", "px": null, "q": {"a": "c", "b": 1}}
+
+{"sym": "IBM", "id": "3", "px": 11, "ok": 1}
+not json
+{"id": 5, "q": 7}
+)";
+			{
+				columns c({ {"id", type::JSON_NUMBER}, {"px", type::JSON_NUMBER}, {"ok", type::JSON_BOOLEAN},
+					{"sym", type::JSON_STRING}, {"q.a", type::JSON_STRING} });
+				c.extract(char_view<const char>(ndjson));
+				assert(c.rows == 5);
+				assert(c.errors() == 1);
+				const auto& id = c[0];
+				assert(id.size() == 5);
+				assert(id.valid[0] and id.number[0] == 1);
+				assert(id.valid[1] and id.number[1] == 2);
+				assert(!id.valid[2]); // string
+				assert(!id.valid[3]);
+				assert(id.valid[4] and id.number[4] == 5);
+				const auto& px = c[1];
+				assert(px.number[0] == 10.5 and !px.valid[1] and px.number[2] == 11);
+				const auto& ok = c[2];
+				assert(ok.valid[0] and ok.boolean[0] and ok.valid[1] and !ok.boolean[1] and !ok.valid[2]);
+				const auto& sym = c[3];
+				assert(sym.dict.size() == 2);
+				assert(sym.string(0) == "IBM" and sym.string(1) == "MSFT" and sym.string(2) == "IBM");
+				assert(sym.code[0] == sym.code[2]);
+				assert(sym.valid.count() == 3);
+				const auto& qa = c[4];
+				assert(qa.string(0) == "b" and qa.string(1) == "c" and !qa.valid[2] and !qa.valid[4]);
+
+				for (unsigned n : {2u, 3u, 8u}) {
+					columns d = c.schema();
+					d.extract(char_view<const char>(ndjson), n);
+					assert(d.rows == c.rows);
+					assert(d.errors() == c.errors());
+					for (int i = 0; i < c.size(); ++i) {
+						for (std::size_t j = 0; j < c.rows; ++j) {
+							assert(d[i].valid[j] == c[i].valid[j]);
+							if (c[i].valid[j] and c[i].type == type::JSON_STRING) {
+								assert(d[i].string(j) == c[i].string(j));
+							}
+							if (c[i].valid[j] and c[i].type == type::JSON_NUMBER) {
+								assert(d[i].number[j] == c[i].number[j]);
+							}
+						}
+					}
+				}
+			}
+			{
+				columns c({ {"a", type::JSON_STRING} });
+				c.extract(char_view<const char>("{\"a\": \"x\"}\n{\"a\": \"y\"}"));
+				columns d(c);
+				c = columns{};
+				assert(d[0].dict.size() == 2 and d[0].string(1) == "y");
+				dictionary e(d[0].dict);
+				assert(e.code("x") == 0 and e.code("z") == 2);
+			}
+			{
+				columns c({ {"a", type::JSON_NUMBER} });
+				assert(!c.record(char_view<const char>("{\"a\": 1, \"b\": }")));
+				assert(c.rows == 1 and c[0].size() == 1 and !c[0].valid[0]);
+			}
+			{
+				for (unsigned n : { 1u, 2u, 8u }) {
+					columns c({ {"id", type::JSON_NUMBER}, {"sym", type::JSON_STRING} });
+					progress p;
+					c.counters = &p;
+					char_view<const char> v(ndjson);
+					c.extract(v, n);
+					auto k = p.read();
+					assert(k.documents == 5 and k.records == 4 and k.fields == 8 and k.errors == 1);
+					assert(k.bytes == static_cast<std::size_t>(v.len) and k.offset == k.bytes);
+				}
+			}
+			{
+				// leaf and prefix, repeated path
+				columns c({ {"q", type::JSON_NUMBER}, {"q.a", type::JSON_STRING}, {"q", type::JSON_NUMBER} });
+				assert(c.size() == 2);
+				assert(c.add("q.a", type::JSON_STRING) == 1 and c.add("q.a", type::JSON_NUMBER) == -1);
+				c.extract(char_view<const char>(ndjson));
+				assert(c.rows == 5 and c[0].size() == 5 and c[1].size() == 5);
+				assert(!c[0].valid[0] and !c[0].valid[1] and c[0].valid[4] and c[0].number[4] == 7);
+				assert(c[1].string(0) == "b" and c[1].string(1) == "c" and !c[1].valid[2] and !c[1].valid[4]);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_COLUMNS_INCLUDED
@@ -0,0 +1,621 @@
+// fms_json_csv.h - convert between NDJSON and delimited text
+#ifndef FMS_JSON_CSV_INCLUDED
+#define FMS_JSON_CSV_INCLUDED
+
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "fms_huge.h"
+#include "fms_latency.h"
+#include "fms_probe.h"
+#include "fms_progress.h"
+#include "fms_parse_write.h"
+#include "fms_json_number.h"
+#include "fms_json_writer.h"
+
+namespace fms::json {
+
+	// split v into at most n blocks of whole lines
+	// newlines between quote characters q do not end a line
+	inline std::vector<char_view<const char>> blocks(char_view<const char> v, unsigned n, char q = 0)
+	{
+		std::vector<char_view<const char>> bs;
+		const char* b = v.buf;
+		const char* p = v.buf;
+		const char* end = v.buf + v.len;
+		bool quoted = false;
+
+		for (unsigned i = 1; b != end and i <= n; ++i) {
+			const char* target = i == n ? end : v.buf + v.len / n * i;
+			for (; p < target; ++p) {
+				if (q and *p == q) {
+					quoted = !quoted;
+				}
+			}
+			while (p < end and (*p != '\n' or quoted)) {
+				if (q and *p == q) {
+					quoted = !quoted;
+				}
+				++p;
+			}
+			if (p < end) {
+				++p;
+			}
+			bs.emplace_back(b, static_cast<long>(p - b));
+			b = p;
+		}
+
+		return bs;
+	}
+
+	/// <summary>
+	/// Convert NDJSON records to delimited text with one column per path
+	/// </summary>
+	/// <remarks>
+	/// Paths are dot separated member names compiled into a trie as in json::columns.
+	/// Members not on a path are skipped without being parsed and no json::value is built.
+	/// Strings are unescaped, numbers and booleans are copied as is, null and
+	/// missing members are empty fields, and objects or arrays are written as JSON text.
+	/// Lines that are not JSON objects are counted in errors and not written.
+	/// </remarks>
+	class ndjson_to_csv {
+		struct trie {
+			std::string key;
+			int col = -1; // column index if a leaf
+			std::vector<int> next; // child nodes
+		};
+		std::vector<trie> nodes; // nodes[0] is the root
+		std::vector<std::string> paths;
+		std::vector<char_view<const char>> cells; // value text of each column in this record
+		std::string s; // unescaped string
+
+		int child(int t, std::string_view key) const
+		{
+			for (int i : nodes[t].next) {
+				if (nodes[i].key == key) {
+					return i;
+				}
+			}
+
+			return -1;
+		}
+
+		// members on the trie below t
+		bool object(char_view<const char>& v, int t)
+		{
+			if (!v.eat('{')) {
+				return skip_value(v);
+			}
+			if (v.wstrim().eat('}')) {
+				return true;
+			}
+			do {
+				if (!v.wstrim().eat('"')) {
+					return false;
+				}
+				auto k = parse_string<const char, char_view<const char>>(v);
+				if (!v.eat('"') or !v.wstrim().eat(':')) {
+					return false;
+				}
+				v.wstrim();
+				int c = child(t, std::string_view(k.buf, k.len));
+				if (c < 0) {
+					if (!skip_value(v)) {
+						return false;
+					}
+				}
+				else if (nodes[c].col >= 0) {
+					char_view<const char> v_(v);
+					// a leaf that is also a prefix fills paths below it too
+					const bool below = !nodes[c].next.empty() and v and *v == '{';
+					if (!(below ? object(v, c) : skip_value(v))) {
+						return false;
+					}
+					auto& cell = cells[nodes[c].col];
+					if (!cell.buf) { // first occurrence wins
+						cell = char_view<const char>(v_.buf, static_cast<long>(v.buf - v_.buf));
+					}
+				}
+				else if (!object(v, c)) {
+					return false;
+				}
+			} while (v.wstrim().eat(','));
+
+			return v.eat('}');
+		}
+
+		// records of the lines of v counted in b
+		template<class Buffer>
+		void lines(char_view<const char> v, parse::delimited_writer<Buffer>& w, progress::batch& b)
+		{
+			const char* p = v.buf;
+			while (v) {
+				const char* e = std::find(v.buf, v.buf + v.len, '\n');
+				char_view<const char> line(v.buf, static_cast<long>(e - v.buf));
+				v.drop(line.len + 1);
+				if (line.wstrim()) {
+					FMS_PROBE(record, line.buf, line.len);
+					b.document();
+					if (record(line, w)) {
+						b.record(v.buf - p, cells.size(), v.buf);
+					}
+					else {
+						b.error(v.buf - p, v.buf);
+					}
+					p = v.buf;
+				}
+			}
+			b.skip(v.buf - p);
+		}
+
+	public:
+		std::size_t records = 0; // records written
+		std::size_t errors = 0; // lines that were not JSON objects
+		progress* counters = nullptr; // live counts for other threads
+
+		ndjson_to_csv()
+			: nodes(1)
+		{ }
+		ndjson_to_csv(std::initializer_list<const char*> paths)
+			: nodes(1)
+		{
+			for (const char* path : paths) {
+				add(path);
+			}
+		}
+
+		// add column for dot separated path and return its index
+		// an existing path returns its index
+		int add(const std::string& path)
+		{
+			int t = 0;
+			for (std::size_t b = 0, e = 0; b <= path.size(); b = e + 1) {
+				e = std::min(path.find('.', b), path.size());
+				std::string key = path.substr(b, e - b);
+				int c = child(t, key);
+				if (c < 0) {
+					c = static_cast<int>(nodes.size());
+					nodes.push_back(trie{ key, -1, {} });
+					nodes[t].next.push_back(c);
+				}
+				t = c;
+			}
+			if (nodes[t].col >= 0) {
+				return nodes[t].col;
+			}
+			nodes[t].col = static_cast<int>(paths.size());
+			paths.push_back(path);
+			cells.emplace_back();
+
+			return nodes[t].col;
+		}
+
+		// paths as column names
+		template<class Buffer>
+		void header(parse::delimited_writer<Buffer>& w) const
+		{
+			for (const auto& path : paths) {
+				w.field(char_view<const char>(path.data(), static_cast<long>(path.size())));
+			}
+			w.end_record();
+		}
+
+		// write one record for a JSON object
+		template<class Buffer>
+		bool record(char_view<const char> line, parse::delimited_writer<Buffer>& w)
+		{
+			FMS_LATENCY_SCOPE("ndjson_to_csv.record");
+			std::fill(cells.begin(), cells.end(), char_view<const char>{});
+			if (!object(line.wstrim(), 0) or line.wstrim()) {
+				++errors;
+
+				return false;
+			}
+			for (auto cell : cells) {
+				if (!cell.buf or (cell.len == 4 and is_null(cell))) {
+					w.field();
+				}
+				else if (*cell == '"') {
+					s.clear();
+					unescape(char_view<const char>(cell.buf + 1, cell.len - 2), s);
+					w.field(char_view<const char>(s.data(), static_cast<long>(s.size())));
+				}
+				else {
+					w.field(cell);
+				}
+			}
+			w.end_record();
+			++records;
+
+			return true;
+		}
+
+		// write a record for each non-empty line of v, not including the header
+		template<class Buffer>
+		std::size_t operator()(char_view<const char> v, parse::delimited_writer<Buffer>& w)
+		{
+			std::size_t n = records;
+			progress::batch b(counters, v.buf);
+			lines(v, w, b);
+
+			return records - n;
+		}
+
+		// convert blocks of lines of v on n threads and write them in order
+		template<class Buffer>
+		std::size_t operator()(char_view<const char> v, parse::delimited_writer<Buffer>& w, unsigned n)
+		{
+			if (n <= 1) {
+				return operator()(v, w);
+			}
+
+			auto bs = blocks(v, n);
+			std::vector<ndjson_to_csv> cs(bs.size(), *this);
+			std::vector<huge_buffer> out(bs.size());
+			std::vector<std::thread> ts;
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts.emplace_back([&, i]() {
+					cs[i].records = cs[i].errors = 0;
+					parse::delimited_writer<huge_buffer> wi(out[i], w);
+					progress::batch b(counters);
+					FMS_PROBE(block, bs[i].buf - v.buf, bs[i].len, bs[i].buf);
+					cs[i].lines(bs[i], wi, b);
+				});
+			}
+			std::size_t m = 0;
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts[i].join();
+				w.raw(out[i].data(), out[i].size());
+				if (counters) {
+					counters->offset(bs[i].buf + bs[i].len - v.buf);
+				}
+				m += cs[i].records;
+				records += cs[i].records;
+				errors += cs[i].errors;
+			}
+
+			return m;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			static constexpr char ndjson[] = R"({"id": 1, "px": 10.5, "sym": "IBM", "q": {"a": "x,y"}, "x": [1, 2]}
+{"sym": "say \"hi\"\n", "id": 2, "px": null, "q": {"b": 1}}
+
+not json
+{"id": 3.25e2, "x": {"y": true}, "sym": "é"}
+)";
+			const char* csv = "id,sym,px,q.a,x\n"
+				"1,IBM,10.5,\"x,y\",\"[1, 2]\"\n"
+				"2,\"say \"\"hi\"\"\n\",,,\n"
+				"3.25e2,\xc3\xa9,,,\"{\"\"y\"\": true}\"\n";
+			{
+				ndjson_to_csv c({ "id", "sym", "px", "q.a", "x" });
+				std::string buf;
+				{
+					parse::delimited_writer w(buf);
+					c.header(w);
+					assert(c(char_view<const char>(ndjson), w) == 3);
+				}
+				assert(c.records == 3 and c.errors == 1);
+				assert(buf == csv);
+			}
+			{
+				for (unsigned n : { 1u, 2u, 3u, 8u }) {
+					ndjson_to_csv c({ "id", "sym", "px", "q.a", "x" });
+					progress p;
+					c.counters = &p;
+					std::string buf;
+					{
+						parse::delimited_writer w(buf);
+						c.header(w);
+						assert(c(char_view<const char>(ndjson), w, n) == 3);
+					}
+					assert(c.records == 3 and c.errors == 1);
+					assert(buf == csv);
+					auto k = p.read();
+					assert(k.records == 3 and k.errors == 1 and k.documents == 4 and k.fields == 15);
+					assert(k.bytes == sizeof(ndjson) - 1 and k.offset == k.bytes);
+				}
+			}
+			{
+				auto bs = blocks(char_view<const char>("a,\"b\nc\"\nd\ne\n"), 2, '"');
+				assert(bs.size() == 2);
+				assert(bs[0].equal("a,\"b\nc\"\n"));
+				assert(bs[1].equal("d\ne\n"));
+			}
+			{
+				// leaf and prefix, repeated path
+				ndjson_to_csv c({ "q", "q.a", "a", "a" });
+				assert(c.add("q.a") == 1);
+				std::string buf;
+				{
+					parse::delimited_writer w(buf);
+					c.header(w);
+					assert(c(char_view<const char>("{\"q\": {\"a\": \"x\"}, \"a\": 1}\n"), w) == 1);
+				}
+				assert(buf == "q,q.a,a\n\"{\"\"a\"\": \"\"x\"\"}\",x,1\n");
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	/// <summary>
+	/// Convert delimited text with a header to JSON objects
+	/// </summary>
+	/// <remarks>
+	/// Records are split with parse::split using the delimiter, quotes and escape
+	/// character of the text. Quoted fields are strings. If infer is true then
+	/// unquoted JSON numbers, true and false are written as is, empty fields are
+	/// null, and anything else is a string. Missing fields are null and extra
+	/// fields are ignored. Output uses json::writer so no json::value is built.
+	/// </remarks>
+	class csv_to_json {
+		char c, l, r, e;
+		std::vector<std::string> names;
+		std::string s; // field without quotes and escapes
+
+		// field text without quotes and escapes, in s if it was quoted
+		bool unquote(char_view<const char>& f)
+		{
+			if (!l or f.len < 2 or f.buf[0] != l or f.buf[f.len - 1] != r) {
+				return false;
+			}
+			s.clear();
+			for (const char* p = f.buf + 1; p < f.buf + f.len - 1; ++p) {
+				if (p + 1 < f.buf + f.len - 1 and ((e and *p == e) or (!e and *p == r and p[1] == r))) {
+					++p;
+				}
+				s.push_back(*p);
+			}
+			f = char_view<const char>(s.data(), static_cast<long>(s.size()));
+
+			return true;
+		}
+
+		// next record of v or error view if quotes are not balanced
+		char_view<const char> next(char_view<const char>& v) const
+		{
+			return parse::split<const char>(v, '\n', l, r, e);
+		}
+
+		// records of v as NDJSON counted in b
+		template<class Buffer>
+		void lines(char_view<const char> v, Buffer& out, progress::batch& b)
+		{
+			writer<Buffer> w(out);
+			const char* p = v.buf;
+			while (v) {
+				auto rec = next(v);
+				if (rec.is_error()) {
+					error = "json::csv_to_json: unbalanced quotes";
+					b.error(v.len, v.buf + v.len);
+					break;
+				}
+				if (rec.trimws()) {
+					FMS_PROBE(record, rec.buf, rec.len);
+					w.reset();
+					record(rec, w);
+					out.append("\n", 1);
+					b.document();
+					b.record(v.buf - p, names.size(), v.buf);
+					p = v.buf;
+				}
+			}
+			b.skip(v.buf - p);
+		}
+
+	public:
+		bool infer = true;
+		std::size_t records = 0;
+		const char* error = nullptr;
+		progress* counters = nullptr; // live counts for other threads
+
+		csv_to_json(char c = ',', char l = '"', char r = '"', char e = 0)
+			: c(c), l(l), r(r), e(e)
+		{ }
+
+		// read column names from the first record and advance v
+		bool header(char_view<const char>& v)
+		{
+			names.clear();
+			auto h = next(v);
+			if (h.is_error()) {
+				error = "json::csv_to_json: unbalanced quotes in header";
+
+				return false;
+			}
+			for (auto f : parse::splitable<const char>(h, c, l, r, e)) {
+				unquote(f);
+				names.emplace_back(f.buf, f.len);
+			}
+
+			return !names.empty();
+		}
+		const std::vector<std::string>& columns() const
+		{
+			return names;
+		}
+
+		// write one record as a JSON object
+		template<class Buffer>
+		void record(char_view<const char> rec, writer<Buffer>& w)
+		{
+			FMS_LATENCY_SCOPE("csv_to_json.record");
+			w.begin_object();
+			std::size_t i = 0;
+			for (auto f : parse::splitable<const char>(rec, c, l, r, e)) {
+				if (i == names.size()) {
+					break;
+				}
+				w.key(char_view<const char>(names[i].data(), static_cast<long>(names[i].size())));
+				++i;
+				char_view<const char> x(f);
+				if (unquote(x) or !infer) {
+					w.value(x);
+				}
+				else if (!x) {
+					w.value(nullptr);
+				}
+				else if (x.equal("true") or x.equal("false")) {
+					w.raw(x);
+				}
+				else {
+					char_view<const char> x_(x);
+					auto n = lazy_number<const char>::parse(x_);
+					if (n.view().len and !x_) {
+						w.raw(x);
+					}
+					else {
+						w.value(x);
+					}
+				}
+			}
+			for (; i < names.size(); ++i) {
+				w.key(char_view<const char>(names[i].data(), static_cast<long>(names[i].size()))).value(nullptr);
+			}
+			w.end_object();
+			++records;
+		}
+
+		// write records of v after the header as one object per line
+		template<class Buffer>
+		std::size_t ndjson(char_view<const char> v, Buffer& out)
+		{
+			std::size_t n = records;
+			progress::batch b(counters, v.buf);
+			lines(v, out, b);
+
+			return records - n;
+		}
+
+		// convert blocks of records on n threads and write them in order
+		// quotes must be the same character for blocks to be found
+		template<class Buffer>
+		std::size_t ndjson(char_view<const char> v, Buffer& out, unsigned n)
+		{
+			if (n <= 1 or l != r) {
+				return ndjson(v, out);
+			}
+
+			auto bs = blocks(v, n, l);
+			std::vector<csv_to_json> cs(bs.size(), *this);
+			std::vector<huge_buffer> os(bs.size());
+			std::vector<std::thread> ts;
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts.emplace_back([&, i]() {
+					cs[i].records = 0;
+					progress::batch b(counters);
+					FMS_PROBE(block, bs[i].buf - v.buf, bs[i].len, bs[i].buf);
+					cs[i].lines(bs[i], os[i], b);
+				});
+			}
+			std::size_t m = 0;
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts[i].join();
+				out.append(os[i].data(), os[i].size());
+				if (counters) {
+					counters->offset(bs[i].buf + bs[i].len - v.buf);
+				}
+				m += cs[i].records;
+				if (cs[i].error and !error) {
+					error = cs[i].error;
+				}
+			}
+			records += m;
+
+			return m;
+		}
+
+		// write records of v after the header as a JSON array
+		template<class Buffer>
+		std::size_t array(char_view<const char> v, Buffer& out)
+		{
+			std::size_t n = records;
+			writer<Buffer> w(out);
+			w.begin_array();
+			while (v) {
+				auto rec = next(v);
+				if (rec.is_error()) {
+					error = "json::csv_to_json: unbalanced quotes";
+					break;
+				}
+				if (rec.trimws()) {
+					record(rec, w);
+				}
+			}
+			w.end_array();
+
+			return records - n;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			static constexpr char csv[] = "id,sym,px,note,ok\r\n"
+				"1,IBM,10.5,\"a, \"\"b\"\"\",true\r\n"
+				"2,\"007\",,\"line\nbreak\",false\r\n"
+				"\r\n"
+				"3,X,1e3\r\n";
+			const char* ndjson = R"({"id":1,"sym":"IBM","px":10.5,"note":"a, \"b\"","ok":true})" "\n"
+				R"({"id":2,"sym":"007","px":null,"note":"line\nbreak","ok":false})" "\n"
+				R"({"id":3,"sym":"X","px":1e3,"note":null,"ok":null})" "\n";
+			{
+				csv_to_json c;
+				char_view<const char> v(csv);
+				assert(c.header(v));
+				assert(c.columns().size() == 5 and c.columns()[4] == "ok");
+				std::string out;
+				assert(c.ndjson(v, out) == 3);
+				assert(!c.error);
+				assert(out == ndjson);
+			}
+			{
+				for (unsigned n : { 1u, 2u, 4u, 16u }) {
+					csv_to_json c;
+					progress p;
+					c.counters = &p;
+					char_view<const char> v(csv);
+					assert(c.header(v));
+					std::string out;
+					assert(c.ndjson(v, out, n) == 3);
+					assert(out == ndjson);
+					auto k = p.read();
+					assert(k.records == 3 and k.documents == 3 and k.fields == 15 and k.errors == 0);
+					assert(k.bytes == static_cast<std::size_t>(v.len) and k.offset == k.bytes);
+				}
+			}
+			{
+				csv_to_json c('\t', 0, 0);
+				c.infer = false;
+				char_view<const char> v("a\tb\n1\tx\n");
+				assert(c.header(v));
+				std::string out;
+				assert(c.array(v, out) == 1);
+				assert(out == R"([{"a":"1","b":"x"}])");
+			}
+			{
+				csv_to_json c;
+				char_view<const char> v("a\n\"1\n");
+				assert(c.header(v));
+				progress p;
+				c.counters = &p;
+				std::string out;
+				c.ndjson(v, out);
+				assert(c.error);
+				assert(p.read().errors == 1 and p.read().bytes == 3);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_CSV_INCLUDED
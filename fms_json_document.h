@@ -0,0 +1,386 @@
+// fms_json_document.h - JSON text and value kept in sync under edits
+#ifndef FMS_JSON_DOCUMENT_INCLUDED
+#define FMS_JSON_DOCUMENT_INCLUDED
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "fms_json.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// JSON text and its parsed value supporting incremental re-parsing
+	/// </summary>
+	/// <remarks>
+	/// The location of every value in the text is kept in a tree of spans
+	/// with offsets relative to the parent, so an edit only shifts later
+	/// siblings of the values enclosing it. An edit re-parses the deepest value
+	/// containing it that still parses and replaces it in the DOM. Objects and
+	/// arrays are copy on write so the rest of the DOM is reused as is.
+	/// Value must not refer to the text, e.g. json::value but not json::lazy_value.
+	/// </remarks>
+	template<class Value = value>
+	class document {
+		struct span {
+			long off = 0; // from start of parent, or text for the root
+			long len = 0;
+			long key = -1; // from start of parent to member name, -1 if not a member
+			std::vector<span> children;
+		};
+
+		std::string text_;
+		Value value_;
+		span root;
+		bool ok = false;
+
+		bool fail(const char* msg)
+		{
+			error = msg;
+
+			return false;
+		}
+
+		// parse one value at v into x and s with offsets relative to base
+		bool parse(char_view<const char>& v, const char* base, Value& x, span& s)
+		{
+			v.wstrim();
+			const char* b = v.buf;
+			s.off = static_cast<long>(b - base);
+			s.children.clear();
+
+			if (!v) {
+				return fail("json::document: unexpected end of input");
+			}
+			if (v.eat('{')) {
+				typename Value::object_type o;
+				if (!v.wstrim().eat('}')) {
+					do {
+						span c;
+						c.key = static_cast<long>(v.wstrim().buf - b);
+						if (!v.eat('"')) {
+							return fail("json::document: expected '\"'");
+						}
+						auto k = parse_string<const char, std::string>(v);
+						if (!v.eat('"') or !v.wstrim().eat(':')) {
+							return fail("json::document: expected ':'");
+						}
+						Value y;
+						if (!parse(v, b, y, c)) {
+							return false;
+						}
+						o.emplace(std::move(k), std::move(y));
+						s.children.push_back(std::move(c));
+					} while (v.wstrim().eat(','));
+					if (!v.eat('}')) {
+						return fail("json::document: expected '}'");
+					}
+				}
+				x = Value(std::move(o));
+			}
+			else if (v.eat('[')) {
+				typename Value::array_type a;
+				if (!v.wstrim().eat(']')) {
+					do {
+						span c;
+						Value y;
+						if (!parse(v, b, y, c)) {
+							return false;
+						}
+						a.push_back(std::move(y));
+						s.children.push_back(std::move(c));
+					} while (v.wstrim().eat(','));
+					if (!v.eat(']')) {
+						return fail("json::document: expected ']'");
+					}
+				}
+				x = Value(std::move(a));
+			}
+			else if (v.eat('"')) {
+				auto str = parse_string<const char, std::string>(v);
+				if (!v.eat('"')) {
+					return fail("json::document: unterminated string");
+				}
+				x = Value(std::move(str));
+			}
+			else if (is_null(v)) {
+				x = Value{};
+			}
+			else if (is_true(v)) {
+				x = Value(true);
+			}
+			else if (is_false(v)) {
+				x = Value(false);
+			}
+			else {
+				double d = parse_number<const char, double>(v);
+				if (d != d) {
+					return fail("json::document: invalid value");
+				}
+				x = Value(typename Value::number_type(d));
+			}
+			s.len = static_cast<long>(v.buf - b);
+
+			return true;
+		}
+
+	public:
+		const char* error = nullptr;
+		std::size_t reparsed = 0; // bytes parsed by the last edit
+
+		document()
+		{ }
+		document(std::string text)
+			: text_(std::move(text))
+		{
+			char_view<const char> v(text_.data(), static_cast<long>(text_.size()));
+			ok = parse(v, text_.data(), value_, root) and (!v.wstrim() or fail("json::document: trailing characters"));
+			if (!ok) {
+				value_ = Value{};
+				root = span{};
+			}
+			reparsed = text_.size();
+		}
+
+		// true if the text was parsed
+		explicit operator bool() const
+		{
+			return ok;
+		}
+		const std::string& text() const
+		{
+			return text_;
+		}
+		const Value& value() const
+		{
+			return value_;
+		}
+
+		// replace text[b, e) with r and re-parse the smallest enclosing value
+		// on failure the document is unchanged and error is set
+		bool edit(std::size_t b, std::size_t e, std::string_view r)
+		{
+			if (!*this or b > e or e > text_.size()) {
+				return fail("json::document: invalid edit");
+			}
+			const long lb = static_cast<long>(b), le = static_cast<long>(e);
+			const long delta = static_cast<long>(r.size()) - (le - lb);
+
+			// chain of spans containing the edit with their absolute offsets
+			std::vector<span*> chain{ &root };
+			std::vector<long> at{ root.off };
+			const Value* x = &value_;
+			while (true) {
+				span& s = *chain.back();
+				auto xt = x->type();
+				// duplicate keys can not be navigated by name
+				if (xt == type::JSON_OBJECT and std::get<typename Value::object_type>(*x).size() != s.children.size()) {
+					break;
+				}
+				auto c = std::upper_bound(s.children.begin(), s.children.end(), lb - at.back(),
+					[](long o, const span& c) { return o < c.off; });
+				if (c == s.children.begin()) {
+					break;
+				}
+				--c;
+				const long cb = at.back() + c->off;
+				if (lb < cb or le > cb + c->len) {
+					break;
+				}
+				if (xt == type::JSON_OBJECT) {
+					x = &std::get<typename Value::object_type>(*x).at(key(*c, at.back()));
+				}
+				else {
+					x = &std::get<typename Value::array_type>(*x)[c - s.children.begin()];
+				}
+				chain.push_back(&*c);
+				at.push_back(cb);
+			}
+
+			// deepest value whose new text is exactly one value
+			for (std::size_t n = chain.size(); n--; ) {
+				const span& s = *chain[n];
+				// new text of the value, or all of it for the root
+				std::string t;
+				if (n) {
+					t.reserve(s.len + delta);
+					t.append(text_, at[n], b - at[n]).append(r).append(text_, e, at[n] + s.len - le);
+				}
+				else {
+					t.reserve(text_.size() + delta);
+					t.append(text_, 0, b).append(r).append(text_, e);
+				}
+				char_view<const char> v(t.data(), static_cast<long>(t.size()));
+				Value y;
+				span z;
+				error = nullptr;
+				if (!parse(v, t.data(), y, z) or v.wstrim() or (n and z.off != 0)) {
+					if (n == 0) {
+						return error ? false : fail("json::document: edit is not a value");
+					}
+					continue;
+				}
+				if (n) {
+					z.off = s.off;
+				}
+				error = nullptr;
+				reparsed = t.size();
+
+				// replace the value, copy on write detaches only this path
+				Value* w = &value_;
+				for (std::size_t i = 1; i <= n; ++i) {
+					const span& p = *chain[i - 1];
+					const span& c = *chain[i];
+					if (w->type() == type::JSON_OBJECT) {
+						w = &std::get<typename Value::object_type>(*w).edit().find(key(c, at[i - 1]))->second;
+					}
+					else {
+						w = &std::get<typename Value::array_type>(*w).edit()[&c - p.children.data()];
+					}
+				}
+				*w = std::move(y);
+
+				// replace the span and shift what follows
+				z.key = chain[n]->key;
+				*chain[n] = std::move(z);
+				for (std::size_t i = n; i--; ) {
+					span& p = *chain[i];
+					p.len += delta;
+					for (auto c = p.children.begin() + (chain[i + 1] - p.children.data()) + 1; c != p.children.end(); ++c) {
+						c->off += delta;
+						if (c->key >= 0) {
+							c->key += delta;
+						}
+					}
+				}
+				if (n) {
+					text_.replace(b, e - b, r);
+				}
+				else {
+					text_ = std::move(t);
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+		// replace the text with t, re-parsing only what differs
+		bool update(std::string_view t)
+		{
+			std::string_view s(text_);
+			std::size_t p = std::mismatch(s.begin(), s.end(), t.begin(), t.end()).first - s.begin();
+			std::size_t q = 0;
+			while (q < s.size() - p and q < t.size() - p and s[s.size() - 1 - q] == t[t.size() - 1 - q]) {
+				++q;
+			}
+
+			return edit(p, s.size() - q, t.substr(p, t.size() - q - p));
+		}
+
+	private:
+		// member name of child c of object at absolute offset at
+		std::string key(const span& c, long at) const
+		{
+			char_view<const char> v(text_.data() + at + c.key + 1, static_cast<long>(text_.size()) - (at + c.key + 1));
+
+			return parse_string<const char, std::string>(v);
+		}
+
+#ifdef _DEBUG
+	public:
+		static int test()
+		{
+			const std::string json = R"({
+	"name": "config",
+	"venues": [
+		{ "mic": "XNYS", "lot": 100 },
+		{ "mic": "XNAS", "lot": 100 },
+		{ "mic": "XLON", "lot": 1 }
+	],
+	"limits": { "max": 10, "min": -1 }
+})";
+			auto check = [](const document& d) {
+				char_view<const char> v(d.text().data(), static_cast<long>(d.text().size()));
+				assert(d.value() == fms::json::parse<Value>(v));
+			};
+			{
+				document d(json);
+				assert(d);
+				check(d);
+				const Value old = d.value();
+
+				// scalar
+				auto i = d.text().find("1 }");
+				assert(d.edit(i, i + 1, "25"));
+				assert(d.reparsed == 2);
+				assert(d.value()["venues"][2]["lot"] == 25.);
+				check(d);
+				// siblings are still shared with the old value
+				assert(std::get<typename Value::object_type>(d.value()["venues"][std::size_t(0)]).same(std::get<typename Value::object_type>(old["venues"][std::size_t(0)])));
+				assert(std::get<typename Value::object_type>(d.value()["limits"]).same(std::get<typename Value::object_type>(old["limits"])));
+				assert(old["venues"][2]["lot"] == 1.);
+
+				// new member re-parses the enclosing object
+				i = d.text().find(", \"min\"");
+				assert(d.edit(i, i, ", \"mid\": 5"));
+				assert(d.reparsed == d.text().find('}', i) + 1 - d.text().find("{ \"max\""));
+				assert(d.value()["limits"]["mid"] == 5.);
+				check(d);
+
+				// edit after the earlier ones uses shifted offsets
+				i = d.text().find("XNAS");
+				assert(d.edit(i, i + 4, "BATS"));
+				assert(d.reparsed == 6);
+				assert(d.value()["venues"][1]["mic"] == "BATS");
+				check(d);
+
+				// member name
+				i = d.text().find("\"name\"");
+				assert(d.edit(i + 1, i + 5, "title"));
+				assert(d.value()["title"] == "config");
+				check(d);
+
+				// type change
+				i = d.text().find("-1");
+				assert(d.edit(i, i + 2, "[1, 2]"));
+				assert(d.value()["limits"]["min"][1] == 2.);
+				check(d);
+
+				// malformed edit leaves the document unchanged
+				std::string t = d.text();
+				i = t.find("BATS");
+				assert(!d.edit(i - 1, i, ""));
+				assert(d.error);
+				assert(d.text() == t);
+				check(d);
+				assert(d.edit(i, i + 4, "XNAS"));
+				assert(!d.error);
+			}
+			{
+				document d(json);
+				std::string t = json;
+				t.replace(t.find("XLON"), 4, "XPAR");
+				assert(d.update(t));
+				assert(d.text() == t);
+				assert(d.reparsed == 6);
+				check(d);
+				assert(d.update(json));
+				assert(d.text() == json);
+				check(d);
+			}
+			{
+				document d("[1, 2");
+				assert(!d);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_DOCUMENT_INCLUDED
@@ -0,0 +1,720 @@
+// fms_json_format.h - minify or indent JSON text without building values
+#ifndef FMS_JSON_FORMAT_INCLUDED
+#define FMS_JSON_FORMAT_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "fms_char_view.h"
+#include "fms_cpu.h"
+
+namespace fms::json {
+
+	// bytes that stop copying when indenting
+	enum class stop {
+		string, // '"' or '\\' inside a string
+		token,  // '"', a byte <= ' ', or a structural character outside a string
+	};
+
+	template<stop S>
+	constexpr bool is_stop(char c)
+	{
+		if constexpr (S == stop::string) {
+			return c == '"' or c == '\\';
+		}
+		else {
+			return c == '"' or static_cast<unsigned char>(c) <= ' ' or c == ',' or c == ':' or (c | 0x20) == '{' or (c | 0x20) == '}';
+		}
+	}
+
+	// first byte in [b, e) that is a stop, or e, 8 bytes at a time
+	template<stop S>
+	inline const char* find_stop_scalar(const char* b, const char* e)
+	{
+		constexpr std::uint64_t ones = 0x0101010101010101, highs = 0x8080808080808080;
+		auto zero = [](std::uint64_t x) { return (x - ones) & ~x & highs; };
+
+		for (; e - b >= 8; b += 8) {
+			std::uint64_t w, z;
+			std::memcpy(&w, b, 8);
+			z = zero(w ^ ('"' * ones));
+			if constexpr (S == stop::string) {
+				z |= zero(w ^ ('\\' * ones));
+			}
+			else {
+				std::uint64_t y = w | (0x20 * ones);
+				z |= (w - 0x21 * ones) & ~w & highs;
+				z |= zero(y ^ ('{' * ones)) | zero(y ^ ('}' * ones)) | zero(w ^ (',' * ones)) | zero(w ^ (':' * ones));
+			}
+			if (z) {
+				break;
+			}
+		}
+		// find the byte in the last 8
+		while (b != e and !is_stop<S>(*b)) {
+			++b;
+		}
+
+		return b;
+	}
+
+	// bit i set if byte i of 64 is in the class, space is any byte <= ' '
+	struct block_classes {
+		std::uint64_t quote = 0, backslash = 0, space = 0, open = 0, close = 0;
+	};
+
+	// classify n blocks of 64 bytes starting at b into k[0], ..., k[n - 1]
+	inline void classify_scalar(const char* b, std::size_t n, block_classes* k)
+	{
+		for (; n--; b += 64, ++k) {
+			*k = block_classes{};
+			for (int i = 0; i < 64; ++i) {
+				const std::uint64_t bit = std::uint64_t(1) << i;
+				const char c = b[i];
+				k->quote |= c == '"' ? bit : 0;
+				k->backslash |= c == '\\' ? bit : 0;
+				k->space |= static_cast<unsigned char>(c) <= ' ' ? bit : 0;
+				k->open |= (c | 0x20) == '{' ? bit : 0;
+				k->close |= (c | 0x20) == '}' ? bit : 0;
+			}
+		}
+	}
+
+#ifdef FMS_CPU_X86
+	// '[' and ']' are '{' and '}' without 0x20
+	template<stop S>
+	inline const char* find_stop_sse2(const char* b, const char* e)
+	{
+		for (; e - b >= 16; b += 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+			__m128i m = _mm_cmpeq_epi8(x, _mm_set1_epi8('"'));
+			if constexpr (S == stop::string) {
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+			}
+			else {
+				const __m128i space = _mm_set1_epi8(' ');
+				__m128i y = _mm_or_si128(x, space);
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(x, space), space));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(y, _mm_set1_epi8('{')));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(y, _mm_set1_epi8('}')));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(',')));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8(':')));
+			}
+			if (int bits = _mm_movemask_epi8(m)) {
+				return b + std::countr_zero(static_cast<unsigned>(bits));
+			}
+		}
+
+		return find_stop_scalar<S>(b, e);
+	}
+	template<stop S>
+	FMS_TARGET("avx2") inline const char* find_stop_avx2(const char* b, const char* e)
+	{
+		for (; e - b >= 32; b += 32) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+			__m256i m = _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"'));
+			if constexpr (S == stop::string) {
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+			}
+			else {
+				const __m256i space = _mm256_set1_epi8(' ');
+				__m256i y = _mm256_or_si256(x, space);
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_max_epu8(x, space), space));
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(y, _mm256_set1_epi8('{')));
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(y, _mm256_set1_epi8('}')));
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(',')));
+				m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8(':')));
+			}
+			if (unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(m))) {
+				return b + std::countr_zero(bits);
+			}
+		}
+
+		return find_stop_sse2<S>(b, e);
+	}
+
+	inline void classify_sse2(const char* b, std::size_t n, block_classes* k)
+	{
+		for (; n--; b += 64, ++k) {
+			*k = block_classes{};
+			for (int i = 0; i < 64; i += 16) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+				__m128i y = _mm_or_si128(x, _mm_set1_epi8(' '));
+				__m128i s = _mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(' ')), _mm_set1_epi8(' '));
+				auto bits = [i](__m128i m) {
+					return static_cast<std::uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(m))) << i;
+				};
+				k->quote |= bits(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+				k->backslash |= bits(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+				k->space |= bits(s);
+				k->open |= bits(_mm_cmpeq_epi8(y, _mm_set1_epi8('{')));
+				k->close |= bits(_mm_cmpeq_epi8(y, _mm_set1_epi8('}')));
+			}
+		}
+	}
+	// high bits of bytes in m shifted up i, a lambda would not get the target
+	FMS_TARGET("avx2") inline std::uint64_t bits_avx2(__m256i m, int i)
+	{
+		return static_cast<std::uint64_t>(static_cast<unsigned>(_mm256_movemask_epi8(m))) << i;
+	}
+	FMS_TARGET("avx2") inline void classify_avx2(const char* b, std::size_t n, block_classes* k)
+	{
+		for (; n--; b += 64, ++k) {
+			*k = block_classes{};
+			for (int i = 0; i < 64; i += 32) {
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+				__m256i y = _mm256_or_si256(x, _mm256_set1_epi8(' '));
+				__m256i s = _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8(' ')), _mm256_set1_epi8(' '));
+				k->quote |= bits_avx2(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')), i);
+				k->backslash |= bits_avx2(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')), i);
+				k->space |= bits_avx2(s, i);
+				k->open |= bits_avx2(_mm256_cmpeq_epi8(y, _mm256_set1_epi8('{')), i);
+				k->close |= bits_avx2(_mm256_cmpeq_epi8(y, _mm256_set1_epi8('}')), i);
+			}
+		}
+	}
+	FMS_TARGET("avx512f,avx512bw") inline void classify_avx512(const char* b, std::size_t n, block_classes* k)
+	{
+		for (; n--; b += 64, ++k) {
+			__m512i x = _mm512_loadu_si512(b);
+			__m512i y = _mm512_or_si512(x, _mm512_set1_epi8(' '));
+			k->quote = _mm512_cmpeq_epi8_mask(x, _mm512_set1_epi8('"'));
+			k->backslash = _mm512_cmpeq_epi8_mask(x, _mm512_set1_epi8('\\'));
+			k->space = _mm512_cmple_epu8_mask(x, _mm512_set1_epi8(' '));
+			k->open = _mm512_cmpeq_epi8_mask(y, _mm512_set1_epi8('{'));
+			k->close = _mm512_cmpeq_epi8_mask(y, _mm512_set1_epi8('}'));
+		}
+	}
+#endif // FMS_CPU_X86
+
+	// kernels for cpu::level()
+	template<stop S>
+	inline const char* find_stop(const char* b, const char* e)
+	{
+#ifdef FMS_CPU_X86
+		static constexpr const char* (*kernel[])(const char*, const char*) = {
+			find_stop_scalar<S>, find_stop_sse2<S>, find_stop_avx2<S>, find_stop_avx2<S>
+		};
+
+		return cpu::call(kernel, b, e);
+#else
+		return find_stop_scalar<S>(b, e);
+#endif
+	}
+	inline void classify(const char* b, std::size_t n, block_classes* k)
+	{
+#ifdef FMS_CPU_X86
+		static constexpr void (*kernel[])(const char*, std::size_t, block_classes*) = {
+			classify_scalar, classify_sse2, classify_avx2, classify_avx512
+		};
+
+		cpu::call(kernel, b, n, k);
+#else
+		classify_scalar(b, n, k);
+#endif
+	}
+
+	// bit i is the parity of bits 0 to i
+	constexpr std::uint64_t prefix_xor(std::uint64_t x)
+	{
+		x ^= x << 1;
+		x ^= x << 2;
+		x ^= x << 4;
+		x ^= x << 8;
+		x ^= x << 16;
+		x ^= x << 32;
+
+		return x;
+	}
+	// bits i and above
+	constexpr std::uint64_t bits_from(unsigned i)
+	{
+		return i < 64 ? ~std::uint64_t(0) << i : 0;
+	}
+
+	/// <summary>
+	/// Minify or indent JSON text without parsing it into values
+	/// </summary>
+	/// <remarks>
+	/// With indent 0 whitespace outside strings is removed, otherwise members
+	/// and elements go on their own lines indented indent spaces per level
+	/// and empty objects and arrays are written as {} and [].
+	/// Minifying keeps whitespace between top level values so lines of NDJSON
+	/// stay lines. It classifies 64 bytes at a time into bit masks, finds the
+	/// bytes in strings from the unescaped quotes, and copies the runs of bytes
+	/// to keep. Scanning uses the kernels for cpu::level(). Indenting scans a vector at a time for the next quote or
+	/// backslash inside strings or whitespace or structural character outside
+	/// and separates top level values with a line break.
+	/// Input can be given in pieces split anywhere, e.g. as read from a file.
+	/// The text is not validated.
+	/// Buffer needs append(const char*, n), e.g. std::string or parse::fd_buffer.
+	/// Output is staged in a 64KB chunk and appended when it fills, on flush(),
+	/// or when the formatter is destroyed.
+	/// </remarks>
+	template<class Buffer = std::string>
+	class formatter {
+		Buffer& out;
+		std::vector<char> chunk;
+		std::size_t n = 0; // bytes staged in chunk
+		int indent;
+		long depth = 0;
+		bool in_string = false;
+		bool escape = false; // next byte follows a backslash
+		bool open = false; // after { or [ with nothing in it yet
+		bool written = false; // a top level value has been started
+		bool gap = false; // the last top level value has ended
+
+		void put(const char* s, std::size_t m)
+		{
+			if (n + m > chunk.size()) {
+				flush();
+				if (m > chunk.size()) {
+					out.append(s, m);
+
+					return;
+				}
+			}
+			std::memcpy(chunk.data() + n, s, m);
+			n += m;
+		}
+		void put(char c)
+		{
+			if (n == chunk.size()) {
+				flush();
+			}
+			chunk[n++] = c;
+		}
+		void newline()
+		{
+			put('\n');
+			for (long i = depth * indent; i > 0; ) {
+				static constexpr char spaces[] = "                                ";
+				long m = i < 32 ? i : 32;
+				put(spaces, m);
+				i -= m;
+			}
+		}
+		// before the first byte of a value or member
+		void before()
+		{
+			if (depth == 0) {
+				if (written and gap) {
+					put('\n');
+				}
+				written = true;
+				gap = false;
+			}
+			if (open) {
+				open = false;
+				newline();
+			}
+		}
+
+		// copy string bytes up to and including the closing quote
+		const char* string(const char* b, const char* e)
+		{
+			while (b != e) {
+				if (escape) {
+					escape = false;
+					put(*b++);
+					continue;
+				}
+				const char* p = find_stop<stop::string>(b, e);
+				put(b, p - b);
+				if (p == e) {
+					return e;
+				}
+				put(*p);
+				if (*p == '"') {
+					in_string = false;
+					gap = depth == 0;
+
+					return p + 1;
+				}
+				escape = true;
+				b = p + 1;
+			}
+
+			return b;
+		}
+		// drop whitespace inside objects and arrays from the 64 bytes at b
+		// run is the start of bytes kept as is that have not been put
+		void minify(const char* b, const block_classes& k, const char*& run)
+		{
+			constexpr std::uint64_t even = 0x5555555555555555;
+
+			// escaped bytes follow an odd number of backslashes
+			std::uint64_t escaped = 0;
+			if (k.backslash or escape) {
+				std::uint64_t backslash = k.backslash & ~static_cast<std::uint64_t>(escape);
+				std::uint64_t follows = (backslash << 1) | static_cast<std::uint64_t>(escape);
+				std::uint64_t odd_starts = backslash & ~even & ~follows;
+				std::uint64_t even_ends = odd_starts + backslash;
+				escape = even_ends < backslash; // carry out of the block
+				escaped = (even ^ (even_ends << 1)) & follows;
+			}
+
+			// from an opening quote up to the closing quote
+			std::uint64_t quoted = prefix_xor(k.quote & ~escaped) ^ (in_string ? ~std::uint64_t(0) : 0);
+			in_string = quoted >> 63;
+			std::uint64_t outside = ~quoted & ~escaped;
+
+			// whitespace inside objects and arrays
+			std::uint64_t space = k.space & outside;
+			std::uint64_t opens = k.open & outside, closes = k.close & outside;
+			long m = std::popcount(closes);
+			if (!space or depth > m) {
+				// depth stays positive or does not matter
+				space &= depth > 0 ? ~std::uint64_t(0) : 0;
+				depth += std::popcount(opens) - m;
+			}
+			else {
+				std::uint64_t nested = 0;
+				unsigned last = 0;
+				for (std::uint64_t brackets = opens | closes; brackets; brackets &= brackets - 1) {
+					unsigned i = std::countr_zero(brackets);
+					if (depth > 0) {
+						nested |= bits_from(last) & ~bits_from(i);
+					}
+					depth += opens >> i & 1 ? 1 : -1;
+					last = i + 1;
+				}
+				if (depth > 0) {
+					nested |= bits_from(last);
+				}
+				space &= nested;
+			}
+
+			std::uint64_t keep = ~space;
+			if (keep == ~std::uint64_t(0)) {
+				return;
+			}
+			put(run, b - run);
+			run = b + 64;
+			if (chunk.size() - n < 80) {
+				flush();
+			}
+			// copy runs of kept bytes 16 at a time, overwriting is fine
+			char block[80];
+			std::memcpy(block, b, 64);
+			while (keep) {
+				unsigned i = std::countr_zero(keep);
+				unsigned m = std::countr_zero(~(keep >> i));
+				for (unsigned j = 0; j < m; j += 16) {
+					std::memcpy(chunk.data() + n + j, block + i + j, 16);
+				}
+				n += m;
+				keep &= bits_from(i + m);
+			}
+		}
+		void minify(const char* b, const char* e)
+		{
+			const char* run = b;
+			block_classes k[16];
+
+			for (std::size_t m; (m = (e - b) / 64); ) {
+				if (m > 16) {
+					m = 16;
+				}
+				classify(b, m, k);
+				for (std::size_t i = 0; i < m; ++i, b += 64) {
+					minify(b, k[i], run);
+				}
+			}
+			put(run, b - run);
+			// the rest a byte at a time
+			for (; b != e; ++b) {
+				const char c = *b;
+				if (escape) {
+					escape = false;
+				}
+				else if (c == '\\') {
+					escape = true;
+				}
+				else if (c == '"') {
+					in_string = !in_string;
+				}
+				else if (!in_string) {
+					if ((c | 0x20) == '{') {
+						++depth;
+					}
+					else if ((c | 0x20) == '}') {
+						--depth;
+					}
+					else if (depth > 0 and static_cast<unsigned char>(c) <= ' ') {
+						continue;
+					}
+				}
+				put(c);
+			}
+		}
+		void pretty(const char* b, const char* e)
+		{
+			while (b != e) {
+				if (in_string) {
+					b = string(b, e);
+					continue;
+				}
+				const char* p = find_stop<stop::token>(b, e);
+				if (p != b) {
+					before();
+					put(b, p - b);
+					b = p;
+					if (b == e) {
+						break;
+					}
+				}
+				char c = *b++;
+				switch (c) {
+				case '"':
+					before();
+					put(c);
+					in_string = true;
+					break;
+				case '{': case '[':
+					before();
+					put(c);
+					++depth;
+					open = true;
+					break;
+				case '}': case ']':
+					--depth;
+					if (open) {
+						open = false;
+					}
+					else {
+						newline();
+					}
+					put(c);
+					gap = depth == 0;
+					break;
+				case ',':
+					put(c);
+					newline();
+					break;
+				case ':':
+					put(": ", 2);
+					break;
+				default:
+					if (is_space(c)) {
+						gap = gap or depth == 0;
+					}
+					else {
+						before();
+						put(c);
+					}
+				}
+			}
+		}
+
+	public:
+		formatter(Buffer& out, int indent = 0)
+			: out(out), chunk(1 << 16), indent(indent)
+		{ }
+		formatter(const formatter&) = delete;
+		formatter& operator=(const formatter&) = delete;
+		~formatter()
+		{
+			flush();
+		}
+
+		// append staged output to the buffer
+		void flush()
+		{
+			if (n) {
+				out.append(chunk.data(), n);
+				n = 0;
+			}
+		}
+		// start over, e.g. for a new document
+		void reset()
+		{
+			flush();
+			depth = 0;
+			in_string = escape = open = written = gap = false;
+		}
+		// open objects and arrays after the input so far, negative if too many were closed
+		long level() const
+		{
+			return depth;
+		}
+
+		// format the next piece of text
+		formatter& operator()(char_view<const char> v)
+		{
+			if (indent) {
+				pretty(v.buf, v.buf + v.len);
+			}
+			else {
+				minify(v.buf, v.buf + v.len);
+			}
+
+			return *this;
+		}
+
+#ifdef _DEBUG
+		// every kernel level this CPU supports
+		static int test()
+		{
+			cpu::isa l = cpu::level();
+			for (int i = cpu::scalar; i < cpu::levels; ++i) {
+				if (cpu::use(static_cast<cpu::isa>(i)) == i) {
+					test_level();
+				}
+			}
+			cpu::use(l);
+
+			return 0;
+		}
+		static int test_level()
+		{
+			{
+				const char s[] = "0123456789abcdef0123\"456789";
+				assert(find_stop<stop::string>(s, s + sizeof(s) - 1) == s + 20);
+				assert(find_stop<stop::token>(s, s + sizeof(s) - 1) == s + 20);
+				const char t[] = "0123456789abcdef012]";
+				assert(find_stop<stop::token>(t, t + sizeof(t) - 1) == t + 19);
+				assert(find_stop<stop::string>(t, t + sizeof(t) - 1) == t + sizeof(t) - 1);
+				const char u[] = "\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\t";
+				assert(find_stop<stop::token>(u, u + sizeof(u) - 1) == u + 16);
+			}
+			{
+				static_assert(prefix_xor(0b1001000) == 0b0111000);
+				const char b[] = "\"a\\\"b\" [ \\\\ ] {\t} \"\\\\\" 0123456789abcdef0123456789abcdef012345678";
+				block_classes k;
+				classify(b, 1, &k);
+				auto bits = [](std::initializer_list<int> is) {
+					std::uint64_t m = 0;
+					for (int i : is) {
+						m |= std::uint64_t(1) << i;
+					}
+					return m;
+				};
+				assert(k.quote == bits({ 0, 3, 5, 18, 21 }));
+				assert(k.backslash == bits({ 2, 9, 10, 19, 20 }));
+				assert(k.open == bits({ 7, 14 }));
+				assert(k.close == bits({ 12, 16 }));
+				assert(k.space == bits({ 6, 8, 11, 13, 15, 17, 22 }));
+
+				// all bytes agree with the scalar kernel
+				char c[256];
+				for (int i = 0; i < 256; ++i) {
+					c[i] = static_cast<char>(i);
+				}
+				block_classes x[4], y[4];
+				classify(c, 4, x);
+				classify_scalar(c, 4, y);
+				for (int i = 0; i < 4; ++i) {
+					assert(x[i].quote == y[i].quote and x[i].backslash == y[i].backslash and x[i].space == y[i].space);
+					assert(x[i].open == y[i].open and x[i].close == y[i].close);
+				}
+			}
+			const char text[] = R"({ "a" : [ 1 , 2.5e3, true ,null ] ,
+				"b\" {x}" : { } , "c" : [
+				] , "d":{"e" : "f\\" }
+			})";
+			const char minified[] = R"({"a":[1,2.5e3,true,null],"b\" {x}":{},"c":[],"d":{"e":"f\\"}})";
+			{
+				std::string s;
+				formatter f(s);
+				f(char_view<const char>(text));
+				assert(f.level() == 0);
+				f.flush();
+				assert(s == minified);
+			}
+			{
+				std::string s;
+				formatter f(s, 2);
+				f(char_view<const char>(text));
+				f.flush();
+				assert(s == "{\n"
+					"  \"a\": [\n"
+					"    1,\n"
+					"    2.5e3,\n"
+					"    true,\n"
+					"    null\n"
+					"  ],\n"
+					"  \"b\\\" {x}\": {},\n"
+					"  \"c\": [],\n"
+					"  \"d\": {\n"
+					"    \"e\": \"f\\\\\"\n"
+					"  }\n"
+					"}");
+
+				// indenting is undone by minifying
+				std::string t;
+				formatter g(t);
+				g(char_view<const char>(s.data(), static_cast<long>(s.size())));
+				g.flush();
+				assert(t == minified);
+			}
+			{
+				// any split gives the same output
+				for (int indent : { 0, 1 }) {
+					std::string whole;
+					formatter w(whole, indent);
+					w(char_view<const char>(text));
+					w.flush();
+					for (long i = 0; i < static_cast<long>(sizeof(text)) - 1; ++i) {
+						std::string s;
+						formatter f(s, indent);
+						f(char_view<const char>(text, i));
+						f(char_view<const char>(text + i, static_cast<long>(sizeof(text)) - 1 - i));
+						f.flush();
+						assert(s == whole);
+					}
+				}
+			}
+			{
+				// blocks agree with bytes for any mix of quotes, escapes, and brackets
+				unsigned x = 1;
+				for (int i = 0; i < 200; ++i) {
+					std::string t;
+					for (int j = 0; j < 300; ++j) {
+						x = x * 1103515245 + 12345;
+						t += " \n\"\\{}[]a,"[(x >> 16) % 10];
+					}
+					std::string s, u;
+					formatter f(s), g(u);
+					f(char_view<const char>(t.data(), static_cast<long>(t.size()))).flush();
+					for (char c : t) {
+						g(char_view<const char>(&c, 1));
+					}
+					g.flush();
+					assert(s == u);
+					assert(f.level() == g.level());
+				}
+			}
+			{
+				// whitespace between top level values is kept
+				std::string s;
+				formatter f(s);
+				f(char_view<const char>("{\"a\": 1}\n{\"a\": [2, 3]}\n1 2\n"));
+				f.flush();
+				assert(s == "{\"a\":1}\n{\"a\":[2,3]}\n1 2\n");
+
+				// but a line break between values when indenting
+				s.clear();
+				formatter g(s, 1);
+				g(char_view<const char>("{\"a\": 1}\n{}\n 3 \"x\"[ ]\n"));
+				g.flush();
+				assert(s == "{\n \"a\": 1\n}\n{}\n3\n\"x\"\n[]");
+				s.clear();
+				g.reset();
+				g(char_view<const char>("12")).flush();
+				g(char_view<const char>("34\n5")).flush();
+				assert(s == "1234\n5");
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_FORMAT_INCLUDED
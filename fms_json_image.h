@@ -0,0 +1,372 @@
+// fms_json_image.h - position independent JSON document
+#ifndef FMS_JSON_IMAGE_INCLUDED
+#define FMS_JSON_IMAGE_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "fms_json.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// Read only JSON document in one block of memory using offsets instead of pointers
+	/// </summary>
+	/// <remarks>
+	/// The block is a header, the nodes in document order as in json::tape,
+	/// then the strings of the value. It can be written to a file or shared memory
+	/// and queried in place at any address by other processes.
+	/// The block is checked when the image is constructed since it may come
+	/// from another process. It must be 8 byte aligned and outlive the image.
+	/// Offsets are 32 bit so strings are limited to 4GB.
+	/// </remarks>
+	class image {
+	public:
+		struct header {
+			char magic[8];
+			std::uint32_t version;
+			std::uint32_t nodes; // number of nodes
+			std::uint64_t strings; // bytes of strings after the nodes
+		};
+		struct node {
+			std::uint8_t type;
+			std::uint8_t b;
+			std::uint16_t reserved;
+			std::uint32_t size; // number of children of objects and arrays
+			std::uint32_t next; // index one past this subtree
+			std::uint32_t key, key_len; // member name if parent is an object
+			std::uint32_t str, str_len; // string value
+			double num;
+		};
+		static_assert(sizeof(header) == 24 and sizeof(node) == 40);
+		static constexpr char magic[8] = "fmsjson";
+		static constexpr std::uint32_t version = 1;
+
+		// reference to a node in the image, invalid if i < 0
+		class ref {
+			const image* m;
+			long i;
+		public:
+			ref(const image* m, long i)
+				: m(m), i(i)
+			{ }
+
+			explicit operator bool() const
+			{
+				return i >= 0;
+			}
+			long index() const
+			{
+				return i;
+			}
+			const node& operator*() const
+			{
+				return m->nodes[i];
+			}
+			enum type type() const
+			{
+				return i < 0 ? type::JSON_NULL : static_cast<enum type>(m->nodes[i].type);
+			}
+			long size() const
+			{
+				return i < 0 ? 0 : m->nodes[i].size;
+			}
+			char_view<const char> key() const
+			{
+				return i < 0 ? char_view<const char>{} : m->string(m->nodes[i].key, m->nodes[i].key_len);
+			}
+			char_view<const char> str() const
+			{
+				return type() == type::JSON_STRING ? m->string(m->nodes[i].str, m->nodes[i].str_len) : char_view<const char>{};
+			}
+			double num() const
+			{
+				return type() == type::JSON_NUMBER ? m->nodes[i].num : std::numeric_limits<double>::quiet_NaN();
+			}
+
+			// first child or invalid if no children
+			ref child() const
+			{
+				return ref(m, size() ? i + 1 : -1);
+			}
+			// next sibling, caller must track the parent size
+			ref sibling() const
+			{
+				return ref(m, m->nodes[i].next);
+			}
+
+			// object member with key or invalid
+			ref operator[](const char* key) const
+			{
+				if (type() == type::JSON_OBJECT) {
+					ref r = child();
+					for (long k = 0; k < size(); ++k, r = r.sibling()) {
+						if (r.key().equal(key)) {
+							return r;
+						}
+					}
+				}
+
+				return ref(m, -1);
+			}
+			// array element or invalid
+			ref operator[](int k) const
+			{
+				if (type() == type::JSON_ARRAY and 0 <= k and k < size()) {
+					ref r = child();
+					while (k--) {
+						r = r.sibling();
+					}
+
+					return r;
+				}
+
+				return ref(m, -1);
+			}
+
+			bool operator==(double x) const
+			{
+				return type() == type::JSON_NUMBER and m->nodes[i].num == x;
+			}
+			bool operator==(bool b) const
+			{
+				return type() == type::JSON_BOOLEAN and m->nodes[i].b == b;
+			}
+			bool operator==(const char* s) const
+			{
+				return type() == type::JSON_STRING and str().equal(s);
+			}
+		};
+
+	private:
+		const node* nodes = nullptr;
+		long n = 0;
+		const char* strings = nullptr;
+		std::uint64_t nstrings = 0;
+
+		bool fail(const char* msg)
+		{
+			error = msg;
+			nodes = nullptr;
+			n = 0;
+
+			return false;
+		}
+
+		char_view<const char> string(std::uint32_t off, std::uint32_t len) const
+		{
+			return char_view<const char>(strings + off, static_cast<long>(len));
+		}
+
+		// each node is a leaf or its children exactly tile its subtree
+		bool check() const
+		{
+			for (long i = 0; i < n; ++i) {
+				const node& x = nodes[i];
+				if (x.type > static_cast<std::uint8_t>(type::JSON_BOOLEAN) or x.next <= i or x.next > n) {
+					return false;
+				}
+				if (x.key + std::uint64_t(x.key_len) > nstrings or x.str + std::uint64_t(x.str_len) > nstrings) {
+					return false;
+				}
+				if (x.type != static_cast<std::uint8_t>(type::JSON_OBJECT) and x.type != static_cast<std::uint8_t>(type::JSON_ARRAY)) {
+					if (x.size != 0 or x.next != i + 1) {
+						return false;
+					}
+					continue;
+				}
+				long c = i + 1;
+				for (std::uint32_t k = 0; k < x.size; ++k) {
+					if (c >= x.next) {
+						return false;
+					}
+					c = nodes[c].next; // checked later to be greater than c
+				}
+				if (c != x.next) {
+					return false;
+				}
+			}
+
+			return nodes[0].next == n;
+		}
+
+	public:
+		const char* error = nullptr;
+
+		image()
+		{ }
+		// image in [p, p + len), check operator bool for errors
+		image(const void* p, std::size_t len)
+		{
+			const char* b = static_cast<const char*>(p);
+			if (reinterpret_cast<std::uintptr_t>(b) % alignof(node) != 0) {
+				fail("json::image: misaligned");
+				return;
+			}
+			if (len < sizeof(header)) {
+				fail("json::image: truncated");
+				return;
+			}
+			const header* h = reinterpret_cast<const header*>(b);
+			if (std::memcmp(h->magic, magic, sizeof(magic)) != 0 or h->version != version) {
+				fail("json::image: bad header");
+				return;
+			}
+			if (h->nodes == 0 or (len - sizeof(header)) / sizeof(node) < h->nodes
+				or len - sizeof(header) - h->nodes * sizeof(node) != h->strings) {
+				fail("json::image: truncated");
+				return;
+			}
+			nodes = reinterpret_cast<const node*>(b + sizeof(header));
+			n = h->nodes;
+			strings = b + sizeof(header) + n * sizeof(node);
+			nstrings = h->strings;
+			if (!check()) {
+				fail("json::image: corrupt");
+			}
+		}
+
+		explicit operator bool() const
+		{
+			return n != 0;
+		}
+		// number of nodes
+		long size() const
+		{
+			return n;
+		}
+
+		ref root() const
+		{
+			return ref(this, n ? 0 : -1);
+		}
+		ref operator[](const char* key) const
+		{
+			return root()[key];
+		}
+		ref operator[](int k) const
+		{
+			return root()[k];
+		}
+
+		// bytes of the image of v, empty if it does not fit in 32 bit offsets
+		template<class Value>
+		static std::string build(const Value& v)
+		{
+			std::vector<node> ns;
+			std::string ss;
+			auto put = [&ss](const std::string& s) {
+				std::uint32_t off = static_cast<std::uint32_t>(ss.size());
+				ss.append(s);
+				return off;
+			};
+			auto add = [&](auto& self, const Value& x, const std::string* key) -> void {
+				std::size_t i = ns.size();
+				ns.push_back(node{});
+				ns[i].type = static_cast<std::uint8_t>(x.type());
+				if (key) {
+					ns[i].key_len = static_cast<std::uint32_t>(key->size());
+					ns[i].key = put(*key);
+				}
+				switch (x.type()) {
+				case type::JSON_OBJECT:
+					for (const auto& [k, y] : std::get<typename Value::object_type>(x)) {
+						self(self, y, &k);
+					}
+					ns[i].size = static_cast<std::uint32_t>(std::get<typename Value::object_type>(x).size());
+					break;
+				case type::JSON_ARRAY:
+					for (const auto& y : std::get<typename Value::array_type>(x)) {
+						self(self, y, nullptr);
+					}
+					ns[i].size = static_cast<std::uint32_t>(std::get<typename Value::array_type>(x).size());
+					break;
+				case type::JSON_STRING:
+					ns[i].str_len = static_cast<std::uint32_t>(std::get<json::string>(x).size());
+					ns[i].str = put(std::get<json::string>(x));
+					break;
+				case type::JSON_NUMBER:
+					ns[i].num = static_cast<double>(std::get<typename Value::number_type>(x));
+					break;
+				case type::JSON_BOOLEAN:
+					ns[i].b = std::get<boolean>(x);
+					break;
+				default:
+					break;
+				}
+				ns[i].next = static_cast<std::uint32_t>(ns.size());
+			};
+			add(add, v, nullptr);
+			if (ns.size() > UINT32_MAX or ss.size() > UINT32_MAX) {
+				return std::string{};
+			}
+
+			header h{};
+			std::memcpy(h.magic, magic, sizeof(magic));
+			h.version = version;
+			h.nodes = static_cast<std::uint32_t>(ns.size());
+			h.strings = ss.size();
+
+			std::string b;
+			b.reserve(sizeof(h) + ns.size() * sizeof(node) + ss.size());
+			b.append(reinterpret_cast<const char*>(&h), sizeof(h));
+			b.append(reinterpret_cast<const char*>(ns.data()), ns.size() * sizeof(node));
+			b.append(ss);
+
+			return b;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			char_view<const char> v(R"({
+				"a": 1.5,
+				"b": { "c": "foo", "d": [] },
+				"e": [1, true, "baz\n", null],
+				"f": false
+			})");
+			const auto b = image::build(parse<value>(v));
+			// copy to a different address
+			std::vector<double> buf((b.size() + sizeof(double) - 1) / sizeof(double));
+			std::memcpy(buf.data(), b.data(), b.size());
+			{
+				image m(buf.data(), b.size());
+				assert(m);
+				assert(m.size() == 11);
+				assert(m.root().type() == type::JSON_OBJECT);
+				assert(m.root().size() == 4);
+				assert(m["a"] == 1.5);
+				assert(m["b"]["c"] == "foo");
+				assert(m["b"]["d"].type() == type::JSON_ARRAY);
+				assert(m["b"]["d"].size() == 0);
+				assert(m["e"][0] == 1.);
+				assert(m["e"][1] == true);
+				assert(m["e"][2] == "baz\\n");
+				assert(m["e"][3].type() == type::JSON_NULL);
+				assert(!m["e"][4]);
+				assert(m["f"] == false);
+				assert(!m["g"]);
+				assert(m["b"].child().key().equal("c"));
+			}
+			{
+				assert(!image(buf.data(), b.size() - 1));
+				assert(!image(reinterpret_cast<const char*>(buf.data()) + 1, b.size() - 1));
+				auto c = buf;
+				reinterpret_cast<node*>(reinterpret_cast<char*>(c.data()) + sizeof(header))[2].next = 1000;
+				image m(c.data(), b.size());
+				assert(!m);
+				assert(m.error);
+				c = buf;
+				reinterpret_cast<node*>(reinterpret_cast<char*>(c.data()) + sizeof(header))[3].str_len = 1000;
+				assert(!image(c.data(), b.size()));
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_IMAGE_INCLUDED
@@ -0,0 +1,272 @@
+// fms_json_intern.h - share identical subtrees of JSON values
+#ifndef FMS_JSON_INTERN_INCLUDED
+#define FMS_JSON_INTERN_INCLUDED
+
+#ifdef _DEBUG
+#include <cmath>
+#endif
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include "fms_json.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// Hash cons objects and arrays
+	/// </summary>
+	/// <remarks>
+	/// Values are hashed bottom up and every object or array equal to one
+	/// seen before is replaced by a copy of it, which shares the node.
+	/// Equality of shared nodes is then a pointer compare.
+	/// The interner keeps its table so documents interned with the same
+	/// interner share subtrees with each other.
+	/// </remarks>
+	class interner {
+		std::unordered_multimap<std::size_t, value> table; // canonical nodes by hash
+		std::unordered_map<const void*, std::size_t> canonical; // hash of canonical nodes
+
+		static std::size_t combine(std::size_t h, std::size_t x)
+		{
+			return h ^ (x + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2));
+		}
+
+		// node address of object or array
+		static const void* node(const value& v)
+		{
+			if (v.type() == type::JSON_OBJECT) {
+				return &*std::get<object>(v);
+			}
+
+			return &*std::get<array>(v);
+		}
+
+		// equal with numbers compared bitwise, so -0.0 is not 0.0, and
+		// objects and arrays compared by node since children are canonical
+		static bool same(const value& a, const value& b)
+		{
+			if (a.type() != b.type()) {
+				return false;
+			}
+			switch (a.type()) {
+			case type::JSON_NUMBER:
+				return std::bit_cast<std::uint64_t>(std::get<number>(a)) == std::bit_cast<std::uint64_t>(std::get<number>(b));
+			case type::JSON_OBJECT:
+			case type::JSON_ARRAY:
+				return node(a) == node(b);
+			default:
+				return a == b;
+			}
+		}
+		// same children in the same order
+		static bool shallow(const value& a, const value& b)
+		{
+			if (a.type() == type::JSON_OBJECT) {
+				const auto& x = std::get<object>(a);
+				const auto& y = std::get<object>(b);
+				return x.size() == y.size() and std::equal(x.begin(), x.end(), y.begin(), [](const auto& i, const auto& j) {
+					return i.first == j.first and same(i.second, j.second);
+				});
+			}
+			const auto& x = std::get<array>(a);
+			const auto& y = std::get<array>(b);
+
+			return x.size() == y.size() and std::equal(x.begin(), x.end(), y.begin(), same);
+		}
+
+		std::size_t intern(value& v)
+		{
+			std::size_t h = static_cast<std::size_t>(v.type());
+
+			switch (v.type()) {
+			case type::JSON_STRING:
+				return combine(h, std::hash<string>{}(std::get<string>(v)));
+			case type::JSON_NUMBER:
+				return combine(h, std::hash<std::uint64_t>{}(std::bit_cast<std::uint64_t>(std::get<number>(v))));
+			case type::JSON_BOOLEAN:
+				return combine(h, std::get<boolean>(v));
+			case type::JSON_OBJECT:
+			case type::JSON_ARRAY:
+				break;
+			default:
+				return h;
+			}
+
+			if (auto i = canonical.find(node(v)); i != canonical.end()) {
+				return i->second;
+			}
+			if (v.type() == type::JSON_OBJECT) {
+				if (std::get<object>(v).empty()) {
+					return h;
+				}
+				for (auto& [key, x] : std::get<object>(v).edit()) {
+					h = combine(combine(h, std::hash<string>{}(key)), intern(x));
+				}
+			}
+			else {
+				if (std::get<array>(v).empty()) {
+					return h;
+				}
+				for (auto& x : std::get<array>(v).edit()) {
+					h = combine(h, intern(x));
+				}
+			}
+			++nodes;
+
+			auto [b, e] = table.equal_range(h);
+			for (; b != e; ++b) {
+				if (b->second.type() == v.type() and shallow(b->second, v)) { // children are canonical
+					v = b->second;
+					++shared;
+
+					return h;
+				}
+			}
+			table.emplace(h, v);
+			canonical.emplace(node(v), h);
+
+			return h;
+		}
+
+	public:
+		std::size_t nodes = 0; // objects and arrays visited
+		std::size_t shared = 0; // objects and arrays replaced by a canonical node
+
+		interner()
+		{ }
+		interner(const interner&) = delete;
+		interner& operator=(const interner&) = delete;
+		~interner()
+		{ }
+
+		// approximate heap bytes used by v, counting shared nodes once if seen is given
+		static std::size_t bytes(const value& v, std::unordered_set<const void*>* seen = nullptr)
+		{
+			auto str = [](const string& s) {
+				return s.capacity() > string().capacity() ? s.capacity() + 1 : 0;
+			};
+			std::size_t n = 0;
+
+			switch (v.type()) {
+			case type::JSON_STRING:
+				return str(std::get<string>(v));
+			case type::JSON_OBJECT:
+				if (seen and !seen->insert(node(v)).second) {
+					return 0;
+				}
+				for (const auto& [key, x] : std::get<object>(v)) {
+					// red-black tree node header plus member
+					n += 4 * sizeof(void*) + sizeof(std::pair<const string, value>) + str(key) + bytes(x, seen);
+				}
+				return n;
+			case type::JSON_ARRAY:
+				if (seen and !seen->insert(node(v)).second) {
+					return 0;
+				}
+				n = std::get<array>(v)->capacity() * sizeof(value);
+				for (const auto& x : std::get<array>(v)) {
+					n += bytes(x, seen);
+				}
+				return n;
+			default:
+				return 0;
+			}
+		}
+
+		struct report {
+			std::size_t nodes, shared;
+			std::size_t bytes_before, bytes_after;
+			std::size_t saved() const
+			{
+				return bytes_before - bytes_after;
+			}
+		};
+
+		// share identical subtrees of v with each other and with previously interned values
+		report operator()(value& v)
+		{
+			std::size_t n = nodes, s = shared;
+			std::size_t before = bytes(v);
+			intern(v);
+			std::unordered_set<const void*> seen;
+			std::size_t after = bytes(v, &seen);
+
+			return report{ nodes - n, shared - s, before, after };
+		}
+
+		// number of distinct objects and arrays
+		std::size_t size() const
+		{
+			return table.size();
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			auto venue = []() {
+				return value(object({
+					{ "mic", value("XNYS") },
+					{ "name", value("New York Stock Exchange, Inc.") },
+					{ "tz", value("America/New_York") },
+					{ "hours", value(array({ value(930), value(1600) })) }
+					}));
+			};
+			{
+				interner i;
+				array a;
+				for (int k = 0; k < 100; ++k) {
+					a.push_back(value(object({ { "id", value(k) }, { "venue", venue() }, { "ccy", value(object({ { "code", value("USD") } })) } })));
+				}
+				value v(a);
+				auto r = i(v);
+				assert(r.nodes == 1 + 100 * 4);
+				assert(r.shared == 99 * 3);
+				assert(r.bytes_after < r.bytes_before);
+				assert(r.saved() > 99 * interner::bytes(venue()));
+				const value& cv = v;
+				assert(std::get<object>(cv[3]["venue"]).same(std::get<object>(cv[99]["venue"])));
+				assert(std::get<array>(cv[3]["venue"]["hours"]).same(std::get<array>(cv[4]["venue"]["hours"])));
+				assert(!std::get<object>(cv[3]).same(std::get<object>(cv[4])));
+				assert(cv[42]["id"] == 42.);
+				assert(cv[42]["venue"]["tz"] == "America/New_York");
+
+				// second document shares with the first
+				value w(object({ { "primary", venue() } }));
+				r = i(w);
+				assert(r.nodes == 3 and r.shared == 2);
+				const value& cw = w;
+				assert(std::get<object>(cw["primary"]).same(std::get<object>(cv[7]["venue"])));
+
+				// interning again finds everything canonical
+				r = i(v);
+				assert(r.nodes == 0 and r.shared == 0);
+			}
+			{
+				interner i;
+				value v(array({ value(object({ { "a", value(1) } })), value(object({ { "a", value(2) } })) }));
+				auto r = i(v);
+				assert(r.shared == 0);
+				assert(i.size() == 3);
+			}
+			{
+				// sign of zero is kept
+				interner i;
+				value v(array({ value(), value(object({ { "x", value(0.) } })), value(object({ { "x", value(-0.) } })), value(object({ { "x", value(-0.) } })) }));
+				auto r = i(v);
+				assert(r.shared == 1);
+				const value& cv = v;
+				assert(!std::signbit(std::get<number>(cv[1]["x"])) and std::signbit(std::get<number>(cv[2]["x"])));
+				assert(std::get<object>(cv[2]).same(std::get<object>(cv[3])));
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_INTERN_INCLUDED
@@ -0,0 +1,293 @@
+// fms_json_number.h - JSON numbers converted on first use
+#ifndef FMS_JSON_NUMBER_INCLUDED
+#define FMS_JSON_NUMBER_INCLUDED
+
+#include <charconv>
+#include <cstdint>
+#include "fms_parse_json.h"
+
+namespace fms::json {
+
+	// exact value mantissa * 10^exponent
+	struct decimal {
+		std::int64_t mantissa = 0;
+		int exponent = 0;
+
+		bool operator==(const decimal&) const = default;
+	};
+
+	/// <summary>
+	/// Number kept as validated text and converted when first read
+	/// </summary>
+	/// <remarks>
+	/// Parsing only checks the syntax. Conversions to double and int64 are
+	/// cached, decimal is computed from the text on each call. The text is a
+	/// view into the parsed buffer so untouched numbers can be written back exactly.
+	/// Caching is not synchronized, so unlike json::value a lazy_value is not
+	/// safe to read from several threads until its numbers have been read once.
+	/// </remarks>
+	template<class T = const char>
+	class lazy_number {
+		enum : unsigned char { HAS_DOUBLE = 1, HAS_INT = 2, NOT_INT = 4 };
+		T* buf = nullptr;
+		int len = 0;
+		mutable unsigned char flags = 0;
+		mutable double d = 0;
+		mutable std::int64_t i = 0;
+
+		// digits of text as decimal, false if more than 18 significant digits
+		constexpr bool to_decimal(decimal& x) const
+		{
+			char_view<T> v(buf, len);
+			bool neg = v.eat('-');
+			int digits = 0;
+
+			x = decimal{};
+			auto digit = [&x, &digits](T c) {
+				if (x.mantissa == 0 and c == '0') {
+					return true; // leading zeros are not significant
+				}
+				if (++digits > 18) {
+					return false;
+				}
+				x.mantissa = 10 * x.mantissa + (c - '0');
+
+				return true;
+			};
+
+			while (v and is_digit(*v)) {
+				if (!digit(*v++)) {
+					return false;
+				}
+			}
+			if (v.eat('.')) {
+				while (v and is_digit(*v)) {
+					if (!digit(*v++)) {
+						return false;
+					}
+					--x.exponent;
+				}
+			}
+			if (v and (*v == 'e' or *v == 'E')) {
+				++v;
+				int sgn = v.eat('-') ? -1 : (v.eat('+'), 1);
+				int e = 0;
+				while (v and is_digit(*v)) {
+					if (e < 100000) {
+						e = 10 * e + (*v - '0');
+					}
+					++v;
+				}
+				x.exponent += sgn * e;
+			}
+			if (neg) {
+				x.mantissa = -x.mantissa;
+			}
+			// canonical form
+			while (x.mantissa and x.mantissa % 10 == 0) {
+				x.mantissa /= 10;
+				++x.exponent;
+			}
+			if (x.mantissa == 0) {
+				x.exponent = 0;
+			}
+
+			return true;
+		}
+
+	public:
+		constexpr lazy_number()
+		{ }
+		// number with no text
+		constexpr lazy_number(double x)
+			: flags(HAS_DOUBLE), d(x)
+		{ }
+
+		// scan a number and advance v, or return invalid number with v unchanged
+		static constexpr lazy_number parse(char_view<T>& v)
+		{
+			FMS_PHASE(number);
+			char_view<T> v_(v.wstrim());
+			auto digits = [&v_]() {
+				long n = v_.len;
+				while (v_ and is_digit(*v_)) {
+					++v_;
+				}
+				return n != v_.len;
+			};
+
+			v_.eat('-');
+			if (v_.eat('0')) {
+				;
+			}
+			else if (!v_ or *v_ == '0' or !digits()) {
+				return lazy_number(std::numeric_limits<double>::quiet_NaN());
+			}
+			if (v_.eat('.') and !digits()) {
+				return lazy_number(std::numeric_limits<double>::quiet_NaN());
+			}
+			if (v_ and (*v_ == 'e' or *v_ == 'E')) {
+				++v_;
+				if (!v_.eat('-')) {
+					v_.eat('+');
+				}
+				if (!digits()) {
+					return lazy_number(std::numeric_limits<double>::quiet_NaN());
+				}
+			}
+			if (!is_terminator(v_)) {
+				return lazy_number(std::numeric_limits<double>::quiet_NaN());
+			}
+
+			lazy_number x;
+			x.buf = v.buf;
+			x.len = static_cast<int>(v_.buf - v.buf);
+			v = v_;
+
+			return x;
+		}
+
+		// number text, empty if not parsed from text
+		constexpr char_view<T> view() const
+		{
+			return char_view<T>(buf, len);
+		}
+		// true if nothing has been converted
+		constexpr bool untouched() const
+		{
+			return flags == 0;
+		}
+
+		constexpr double as_double() const
+		{
+			if (!(flags & HAS_DOUBLE)) {
+				char_view<T> v(buf, len);
+				d = len ? parse_number<T, double>(v) : std::numeric_limits<double>::quiet_NaN();
+				flags |= HAS_DOUBLE;
+			}
+
+			return d;
+		}
+		constexpr operator double() const
+		{
+			return as_double();
+		}
+
+		// exact integer value or false
+		constexpr bool as_int64(std::int64_t& x) const
+		{
+			if (!(flags & (HAS_INT | NOT_INT))) {
+				decimal y;
+				bool ok = false;
+				if (len) {
+					ok = to_decimal(y) and y.exponent >= 0 and y.exponent <= 18;
+					for (int e = 0; ok and e < y.exponent; ++e) {
+						ok = y.mantissa < INT64_MAX / 10 and y.mantissa > INT64_MIN / 10;
+						y.mantissa *= 10;
+					}
+				}
+				else if (d == d and -0x1p63 <= d and d < 0x1p63 and static_cast<double>(static_cast<std::int64_t>(d)) == d) {
+					y.mantissa = static_cast<std::int64_t>(d);
+					ok = true;
+				}
+				flags |= ok ? HAS_INT : NOT_INT;
+				i = y.mantissa;
+			}
+			x = i;
+
+			return flags & HAS_INT;
+		}
+		// exact decimal value or false if more than 18 significant digits, not cached
+		bool as_decimal(decimal& x) const
+		{
+			if (len) {
+				return to_decimal(x);
+			}
+
+			char buf_[32];
+			auto [p, ec] = std::to_chars(buf_, buf_ + sizeof(buf_), d);
+			if (ec != std::errc{} or d != d) {
+				return false;
+			}
+			lazy_number<const char> y;
+			char_view<const char> v(buf_, static_cast<long>(p - buf_));
+			y = lazy_number<const char>::parse(v);
+
+			return y.to_decimal(x);
+		}
+
+		constexpr bool operator==(double x) const
+		{
+			return as_double() == x;
+		}
+		constexpr bool operator==(const lazy_number& x) const
+		{
+			return as_double() == x.as_double();
+		}
+
+		template<class U>
+		friend class lazy_number;
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				char_view<T> v("-12.50e1, 3");
+				auto x = lazy_number::parse(v);
+				assert(v.equal(", 3"));
+				assert(x.view().equal("-12.50e1"));
+				assert(x.untouched());
+				assert(x.as_double() == -125);
+				assert(!x.untouched());
+				std::int64_t i;
+				assert(x.as_int64(i) and i == -125);
+				decimal y;
+				assert(x.as_decimal(y) and y == decimal({ -125, 0 }));
+			}
+			{
+				char_view<T> v("0.0625");
+				auto x = lazy_number::parse(v);
+				std::int64_t i;
+				assert(!x.as_int64(i));
+				decimal y;
+				assert(x.as_decimal(y) and y == decimal({ 625, -4 }));
+				assert(x == 0.0625);
+			}
+			{
+				char_view<T> v("12345678901234567890");
+				auto x = lazy_number::parse(v);
+				assert(x.view().len == 20);
+				std::int64_t i;
+				assert(!x.as_int64(i));
+				assert(std::fabs(x.as_double() / 12345678901234567890. - 1) < 1e-15);
+			}
+			{
+				for (const char* s : { "01", "-", "1.", ".5", "1e", "1x", "--1" }) {
+					char_view<T> v(s, static_cast<long>(std::char_traits<char>::length(s)));
+					auto x = lazy_number::parse(v);
+					assert(x.view().len == 0);
+					assert(x.as_double() != x.as_double());
+					assert(v.buf == s);
+				}
+			}
+			{
+				lazy_number x(2.5);
+				std::int64_t i;
+				assert(!x.as_int64(i));
+				decimal y;
+				assert(x.as_decimal(y) and y == decimal({ 25, -1 }));
+				assert(lazy_number(3.).as_int64(i) and i == 3);
+			}
+			{
+				constexpr auto n = [] { char_view<T> v("1.5e3 "); return lazy_number::parse(v).view().len; }();
+				static_assert(n == 5);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_NUMBER_INCLUDED
@@ -0,0 +1,719 @@
+// fms_json_path.h - compiled JSONPath queries over a tape or text
+#ifndef FMS_JSON_PATH_INCLUDED
+#define FMS_JSON_PATH_INCLUDED
+
+#ifdef _DEBUG
+#include <charconv>
+#endif
+#include <deque>
+#include <initializer_list>
+#include <string>
+#include <vector>
+#include "fms_json_tape.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// Compiled JSONPath expression
+	/// </summary>
+	/// <remarks>
+	/// Supported subset: $ root, .key and ['key'] members, [n] indices,
+	/// .* and [*] wildcards, ..key and ..* descendants, and filters
+	/// [?(@.key op literal)] where op is one of == != &lt; &lt;= &gt; &gt;=.
+	/// Use [?(@.key)] to test for a member and @ for the element itself.
+	/// </remarks>
+	class path {
+	public:
+		enum class select { key, index, any, filter };
+		enum class cmp { exists, eq, ne, lt, le, gt, ge };
+
+		struct step {
+			select s = select::any;
+			bool deep = false; // any descendant, not only children
+			std::string key; // member name or filter member name
+			int index = 0;
+			// filter literal
+			cmp c = cmp::exists;
+			enum type lit = type::JSON_NULL;
+			double num = 0;
+			std::string str;
+			bool b = false;
+
+			template<class T>
+			bool equal(const char_view<T>& k) const
+			{
+				return k.len == static_cast<long>(key.size()) and std::equal(k.buf, k.buf + k.len, key.begin());
+			}
+
+			// compare a scalar against the filter literal
+			template<class T>
+			bool test(enum type t, double x, const char_view<T>& y, bool z) const
+			{
+				if (c == cmp::exists) {
+					return true;
+				}
+				if (c == cmp::eq or c == cmp::ne) {
+					bool eq = t == lit;
+					if (eq and t == type::JSON_NUMBER) {
+						eq = x == num;
+					}
+					else if (eq and t == type::JSON_STRING) {
+						eq = y.len == static_cast<long>(str.size()) and std::equal(y.buf, y.buf + y.len, str.begin());
+					}
+					else if (eq and t == type::JSON_BOOLEAN) {
+						eq = z == b;
+					}
+
+					return c == cmp::eq ? eq : !eq;
+				}
+
+				int sgn = 0;
+				if (t == type::JSON_NUMBER and lit == type::JSON_NUMBER) {
+					sgn = x < num ? -1 : x > num ? 1 : 0;
+					if (x != x) {
+						return false;
+					}
+				}
+				else if (t == type::JSON_STRING and lit == type::JSON_STRING) {
+					auto o = std::lexicographical_compare_three_way(y.buf, y.buf + y.len, str.begin(), str.end());
+					sgn = o < 0 ? -1 : o > 0 ? 1 : 0;
+				}
+				else {
+					return false;
+				}
+
+				switch (c) {
+				case cmp::lt: return sgn < 0;
+				case cmp::le: return sgn <= 0;
+				case cmp::gt: return sgn > 0;
+				case cmp::ge: return sgn >= 0;
+				default: return false;
+				}
+			}
+
+			// filter applied to the text of an array element or member value
+			template<class T>
+			bool match(char_view<T> v) const
+			{
+				v.wstrim();
+				if (!key.empty()) {
+					if (!v.eat('{') or v.wstrim().eat('}')) {
+						return false;
+					}
+					do {
+						if (!v.wstrim().eat('"')) {
+							return false;
+						}
+						auto k = parse_string<T, char_view<T>>(v);
+						if (!v.eat('"') or !v.wstrim().eat(':')) {
+							return false;
+						}
+						if (equal(k)) {
+							break;
+						}
+						if (!skip_value(v)) {
+							return false;
+						}
+					} while (v.wstrim().eat(','));
+					if (!v or *v == '}') {
+						return false;
+					}
+				}
+
+				v.wstrim();
+				if (!v) {
+					return false;
+				}
+				if (*v == '"') {
+					v.eat('"');
+					return test(type::JSON_STRING, 0, parse_string<T, char_view<T>>(v), false);
+				}
+				if (*v == '{' or *v == '[') {
+					return test(*v == '{' ? type::JSON_OBJECT : type::JSON_ARRAY, 0, char_view<T>{}, false);
+				}
+				if (is_null(v)) {
+					return test(type::JSON_NULL, 0, char_view<T>{}, false);
+				}
+				if (is_true(v)) {
+					return test(type::JSON_BOOLEAN, 0, char_view<T>{}, true);
+				}
+				if (is_false(v)) {
+					return test(type::JSON_BOOLEAN, 0, char_view<T>{}, false);
+				}
+
+				return test(type::JSON_NUMBER, parse_number<T, double>(v), char_view<T>{}, false);
+			}
+
+			// filter applied to a tape node
+			template<class Ref>
+			bool match(Ref r) const
+			{
+				if (!key.empty()) {
+					if (r.type() != type::JSON_OBJECT) {
+						return false;
+					}
+					Ref c = r.child();
+					int i = 0;
+					while (i < r.size() and !equal((*c).key)) {
+						c = c.sibling();
+						++i;
+					}
+					if (i == r.size()) {
+						return false;
+					}
+					r = c;
+				}
+
+				return test(r.type(), (*r).num, (*r).str, (*r).b);
+			}
+		};
+
+		std::vector<step> steps;
+		const char* error = nullptr;
+
+		path()
+		{ }
+		path(const char* s)
+		{
+			compile(char_view<const char>(s, static_cast<long>(std::char_traits<char>::length(s))));
+		}
+		path(char_view<const char> v)
+		{
+			compile(v);
+		}
+
+		explicit operator bool() const
+		{
+			return !error;
+		}
+
+		bool compile(char_view<const char> v)
+		{
+			steps.clear();
+			error = nullptr;
+
+			if (!v.wstrim().eat('$')) {
+				return fail("json::path: expected '$'");
+			}
+			while (v.trimws()) {
+				step s;
+				if (v.eat("..")) {
+					s.deep = true;
+					if (v.eat('*')) {
+						s.s = select::any;
+					}
+					else if (v.eat('[')) {
+						if (!bracket(v, s)) {
+							return false;
+						}
+					}
+					else if (!name(v, s)) {
+						return false;
+					}
+				}
+				else if (v.eat('.')) {
+					if (v.eat('*')) {
+						s.s = select::any;
+					}
+					else if (!name(v, s)) {
+						return false;
+					}
+				}
+				else if (v.eat('[')) {
+					if (!bracket(v, s)) {
+						return false;
+					}
+				}
+				else {
+					return fail("json::path: expected '.' or '['");
+				}
+				steps.push_back(s);
+			}
+
+			return true;
+		}
+
+	private:
+		bool fail(const char* msg)
+		{
+			error = msg;
+			steps.clear();
+
+			return false;
+		}
+
+		// dot notation member name
+		bool name(char_view<const char>& v, step& s)
+		{
+			const char* b = v.buf;
+			while (v and *v != '.' and *v != '[' and !is_space(*v)) {
+				++v;
+			}
+			if (v.buf == b) {
+				return fail("json::path: expected member name");
+			}
+			s.s = select::key;
+			s.key.assign(b, v.buf);
+
+			return true;
+		}
+
+		// quoted string, the quote has not been eaten
+		bool quoted(char_view<const char>& v, std::string& str)
+		{
+			char q = *v;
+			v.eat(q);
+			const char* b = v.buf;
+			while (v and *v != q) {
+				if (*v == '\\') {
+					++v;
+				}
+				++v;
+			}
+			str.assign(b, v.buf);
+
+			return v.eat(q) or fail("json::path: unterminated string");
+		}
+
+		// contents of [...], the '[' has been eaten
+		bool bracket(char_view<const char>& v, step& s)
+		{
+			v.wstrim();
+			if (v.eat('*')) {
+				s.s = select::any;
+			}
+			else if (v and (*v == '\'' or *v == '"')) {
+				s.s = select::key;
+				if (!quoted(v, s.key)) {
+					return false;
+				}
+			}
+			else if (v and is_digit(*v)) {
+				s.s = select::index;
+				s.index = 0;
+				while (v and is_digit(*v)) {
+					s.index = 10 * s.index + (*v - '0');
+					++v;
+				}
+			}
+			else if (v.eat("?(")) {
+				s.s = select::filter;
+				if (!filter(v, s)) {
+					return false;
+				}
+			}
+			else {
+				return fail("json::path: invalid subscript");
+			}
+
+			if (!v.wstrim().eat(']')) {
+				return fail("json::path: expected ']'");
+			}
+
+			return true;
+		}
+
+		// @.key op literal), the "?(" has been eaten
+		bool filter(char_view<const char>& v, step& s)
+		{
+			if (!v.wstrim().eat('@')) {
+				return fail("json::path: expected '@'");
+			}
+			if (v.eat('.')) {
+				const char* b = v.buf;
+				while (v and *v != ')' and *v != '=' and *v != '!' and *v != '<' and *v != '>' and !is_space(*v)) {
+					++v;
+				}
+				s.key.assign(b, v.buf);
+			}
+
+			v.wstrim();
+			if (v.eat(')')) {
+				s.c = cmp::exists;
+
+				return true;
+			}
+
+			if (v.eat("==")) s.c = cmp::eq;
+			else if (v.eat("!=")) s.c = cmp::ne;
+			else if (v.eat("<=")) s.c = cmp::le;
+			else if (v.eat(">=")) s.c = cmp::ge;
+			else if (v.eat('<')) s.c = cmp::lt;
+			else if (v.eat('>')) s.c = cmp::gt;
+			else {
+				return fail("json::path: expected comparison");
+			}
+
+			v.wstrim();
+			if (v and (*v == '\'' or *v == '"')) {
+				s.lit = type::JSON_STRING;
+				if (!quoted(v, s.str)) {
+					return false;
+				}
+			}
+			else {
+				// literal up to the closing parenthesis
+				char_view<const char> l(v);
+				while (v and *v != ')') {
+					++v;
+				}
+				l.take(static_cast<long>(v.buf - l.buf));
+				l.trimws();
+				if (is_null(l)) {
+					s.lit = type::JSON_NULL;
+				}
+				else if (is_true(l)) {
+					s.lit = type::JSON_BOOLEAN;
+					s.b = true;
+				}
+				else if (is_false(l)) {
+					s.lit = type::JSON_BOOLEAN;
+				}
+				else {
+					s.lit = type::JSON_NUMBER;
+					s.num = parse_number<const char, double>(l);
+					if (s.num != s.num or l) {
+						return fail("json::path: invalid literal");
+					}
+				}
+			}
+
+			return v.wstrim().eat(')') or fail("json::path: expected ')'");
+		}
+	};
+
+	/// <summary>
+	/// Set of paths evaluated together in one pass
+	/// </summary>
+	/// <remarks>
+	/// The paths are run as an automaton whose state is the set of
+	/// (path, step) pairs still alive at each nesting level.
+	/// Values no path can match are skipped without being parsed.
+	/// Matches are reported as f(path index, value) when the end of the value is reached.
+	/// </remarks>
+	class query {
+		struct state {
+			int q, s;
+			bool operator==(const state&) const = default;
+		};
+		using states = std::vector<state>;
+
+		std::vector<path> paths;
+		std::deque<states> frames; // active states by depth, references stay valid on growth
+
+		bool done(const state& x) const
+		{
+			return x.s == static_cast<int>(paths[x.q].steps.size());
+		}
+		// true if any state can match a child
+		bool alive(const states& S) const
+		{
+			for (const auto& x : S) {
+				if (!done(x)) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		// states of child with key (or index if not an object member) given parent states S
+		template<class T, class Pred>
+		bool next(const states& S, states& C, const char_view<T>& key, int index, Pred pred) const
+		{
+			auto push = [&C](state x) {
+				if (std::find(C.begin(), C.end(), x) == C.end()) {
+					C.push_back(x);
+				}
+			};
+
+			C.clear();
+			for (const auto& x : S) {
+				if (done(x)) {
+					continue;
+				}
+				const path::step& s = paths[x.q].steps[x.s];
+				if (s.deep) {
+					push(x);
+				}
+				bool m = false;
+				switch (s.s) {
+				case path::select::key:
+					m = index < 0 and s.equal(key);
+					break;
+				case path::select::index:
+					m = index == s.index;
+					break;
+				case path::select::any:
+					m = true;
+					break;
+				case path::select::filter:
+					m = pred(s);
+					break;
+				}
+				if (m) {
+					push(state{ x.q, x.s + 1 });
+				}
+			}
+
+			return !C.empty();
+		}
+
+		void start()
+		{
+			if (frames.empty()) {
+				frames.resize(1);
+			}
+			frames[0].clear();
+			for (int q = 0; q < size(); ++q) {
+				frames[0].push_back(state{ q, 0 });
+			}
+		}
+
+		template<class T, class F>
+		bool walk(char_view<T>& v, std::size_t depth, F& f)
+		{
+			const states& S = frames[depth];
+			char_view<T> v0(v.wstrim());
+
+			if (!v or (*v != '{' and *v != '[') or !alive(S)) {
+				if (!skip_value(v)) {
+					return false;
+				}
+			}
+			else {
+				if (frames.size() < depth + 2) {
+					frames.resize(depth + 2);
+				}
+				states& C = frames[depth + 1];
+				bool obj = v.eat('{');
+				T close = obj ? '}' : ']';
+				if (!obj) {
+					v.eat('[');
+				}
+
+				if (!v.wstrim().eat(close)) {
+					int i = 0;
+					do {
+						char_view<T> key;
+						if (obj) {
+							if (!v.wstrim().eat('"')) {
+								return false;
+							}
+							key = parse_string<T, char_view<T>>(v);
+							if (!v.eat('"') or !v.wstrim().eat(':')) {
+								return false;
+							}
+						}
+						v.wstrim();
+						auto pred = [&v](const path::step& s) {
+							char_view<T> e(v);
+							return skip_value(e) and s.match(char_view<T>(v.buf, static_cast<long>(e.buf - v.buf)));
+						};
+						if (next(S, C, key, obj ? -1 : i, pred)) {
+							if (!walk(v, depth + 1, f)) {
+								return false;
+							}
+						}
+						else if (!skip_value(v)) {
+							return false;
+						}
+						++i;
+					} while (v.wstrim().eat(','));
+					if (!v.eat(close)) {
+						return false;
+					}
+				}
+			}
+
+			for (const auto& x : S) {
+				if (done(x)) {
+					f(x.q, char_view<T>(v0.buf, static_cast<long>(v.buf - v0.buf)));
+				}
+			}
+
+			return true;
+		}
+
+		template<class Ref, class F>
+		void walk(Ref r, std::size_t depth, F& f)
+		{
+			const states& S = frames[depth];
+
+			if ((r.type() == type::JSON_OBJECT or r.type() == type::JSON_ARRAY) and alive(S)) {
+				if (frames.size() < depth + 2) {
+					frames.resize(depth + 2);
+				}
+				states& C = frames[depth + 1];
+				bool obj = r.type() == type::JSON_OBJECT;
+				Ref c = r.child();
+				for (int i = 0; i < r.size(); ++i, c = c.sibling()) {
+					auto pred = [&c](const path::step& s) { return s.match(c); };
+					if (next(S, C, (*c).key, obj ? -1 : i, pred)) {
+						walk(c, depth + 1, f);
+					}
+				}
+			}
+
+			for (const auto& x : S) {
+				if (done(x)) {
+					f(x.q, r);
+				}
+			}
+		}
+
+	public:
+		const char* error = nullptr;
+
+		query()
+		{ }
+		// stop at the first path that does not compile so q[i] is the i-th path
+		query(std::initializer_list<const char*> ps)
+		{
+			for (auto p : ps) {
+				if (add(p) < 0) {
+					break;
+				}
+			}
+		}
+
+		explicit operator bool() const
+		{
+			return !error;
+		}
+		int size() const
+		{
+			return static_cast<int>(paths.size());
+		}
+		const path& operator[](int i) const
+		{
+			return paths[i];
+		}
+
+		// compile and add p, return its index or -1 and set error
+		int add(const path& p)
+		{
+			if (!p) {
+				error = p.error;
+
+				return -1;
+			}
+			paths.push_back(p);
+
+			return size() - 1;
+		}
+
+		// match all paths against one value and advance v, false if malformed
+		template<class T, class F>
+		bool operator()(char_view<T>& v, F f)
+		{
+			char_view<T> v_(v);
+
+			start();
+			if (!walk(v_, 0, f)) {
+				return false;
+			}
+			v = v_;
+
+			return true;
+		}
+
+		// match all paths against a parsed tape
+		template<int N, class T, class F>
+		void operator()(const tape<N, T>& t, F f)
+		{
+			if (t) {
+				start();
+				walk(t.root(), 0, f);
+			}
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			static constexpr char json[] = R"({
+				"store": {
+					"book": [
+						{ "title": "a", "price": 8.95, "isbn": "1" },
+						{ "title": "b", "price": 12.99 },
+						{ "title": "c", "price": 8.99, "isbn": "2" },
+						{ "title": "d", "price": 22.99, "tags": ["x", "y"] }
+					],
+					"bicycle": { "color": "red", "price": 19.95 }
+				},
+				"id": 7
+			})";
+			{
+				assert(path("$.a.b[3]").steps.size() == 3);
+				assert(path("$['a'][*]..b").steps.size() == 3);
+				assert(path("$..*").steps[0].deep);
+				assert(path("$[?(@.x <= -1.5)]").steps[0].c == path::cmp::le);
+				assert(path("$[?(@.x == 'y')]").steps[0].lit == type::JSON_STRING);
+				assert(path("$[?(@.x)]").steps[0].c == path::cmp::exists);
+				assert(!path("a.b"));
+				assert(!path("$.a["));
+				assert(!path("$[?(@.x ~ 1)]"));
+				assert(!path("$[?(@.x == 1x)]"));
+			}
+			{
+				query q{ "$.id", "$.store.book[1].title", "$..price", "$.store.book[*].isbn",
+					"$.store.book[?(@.price < 10)].title", "$..tags[?(@ == 'y')]", "$.missing", "$" };
+				assert(q);
+				assert(q.size() == 8);
+
+				auto check = [](const std::vector<std::string>* r) {
+					assert(r[0] == std::vector<std::string>({ "7" }));
+					assert(r[1] == std::vector<std::string>({ "\"b\"" }));
+					assert(r[2] == std::vector<std::string>({ "8.95", "12.99", "8.99", "22.99", "19.95" }));
+					assert(r[3] == std::vector<std::string>({ "\"1\"", "\"2\"" }));
+					assert(r[4] == std::vector<std::string>({ "\"a\"", "\"c\"" }));
+					assert(r[5] == std::vector<std::string>({ "\"y\"" }));
+					assert(r[6].empty());
+					assert(r[7].size() == 1);
+				};
+
+				std::vector<std::string> r[8];
+				char_view<const char> v(json);
+				assert(q(v, [&r](int i, char_view<const char> x) { r[i].push_back(std::string(x.buf, x.len)); }));
+				assert(!v.wstrim());
+				assert(r[7][0] == std::string(json));
+				check(r);
+
+				constexpr tape<32> t(json);
+				static_assert(t);
+				std::vector<std::string> s[8];
+				q(t, [&s](int i, tape<32>::ref x) {
+					const auto& n = *x;
+					if (x.type() == type::JSON_STRING) {
+						s[i].push_back("\"" + std::string(n.str.buf, n.str.len) + "\"");
+					}
+					else if (x.type() == type::JSON_NUMBER) {
+						char buf[32];
+						s[i].push_back(std::string(buf, std::to_chars(buf, buf + sizeof(buf), n.num).ptr));
+					}
+					else {
+						s[i].push_back(json);
+					}
+				});
+				check(s);
+			}
+			{
+				query q{ "$.a" };
+				char_view<const char> v("{\"a\": [1, 2}");
+				assert(!q(v, [](int, char_view<const char>) {}));
+				assert(v.equal("{\"a\": [1, 2}"));
+			}
+			{
+				query q{ "$.a", "$[", "$.b" };
+				assert(!q and q.error);
+				assert(q.size() == 1);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_PATH_INCLUDED
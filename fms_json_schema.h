@@ -0,0 +1,641 @@
+// fms_json_schema.h - JSON Schema compiled to a validating scanner
+#ifndef FMS_JSON_SCHEMA_INCLUDED
+#define FMS_JSON_SCHEMA_INCLUDED
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <vector>
+#include "fms_json.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// JSON Schema subset compiled into rules checked while scanning text
+	/// </summary>
+	/// <remarks>
+	/// Supports type, enum, const, minimum, maximum, exclusiveMinimum,
+	/// exclusiveMaximum, minLength, maxLength, pattern, properties, required,
+	/// additionalProperties (boolean), items, minItems and maxItems.
+	/// Other keywords that affect validity are compile errors, annotations are ignored.
+	/// Validation scans the text once without building a value and stops at
+	/// the first violation. Member names are found by precomputed hash.
+	/// Strings are compared and matched as they appear in the text, escapes are not decoded.
+	/// A compiled schema is immutable and can be used from several threads.
+	/// </remarks>
+	class schema {
+		// type bits
+		static constexpr unsigned NUL = 1u << int(type::JSON_NULL);
+		static constexpr unsigned OBJECT = 1u << int(type::JSON_OBJECT);
+		static constexpr unsigned ARRAY = 1u << int(type::JSON_ARRAY);
+		static constexpr unsigned STRING = 1u << int(type::JSON_STRING);
+		static constexpr unsigned NUMBER = 1u << int(type::JSON_NUMBER);
+		static constexpr unsigned BOOLEAN = 1u << int(type::JSON_BOOLEAN);
+		static constexpr unsigned INTEGER = 1u << 6;
+		static constexpr unsigned ANY = NUL | OBJECT | ARRAY | STRING | NUMBER | BOOLEAN | INTEGER;
+
+		struct property {
+			std::uint64_t hash;
+			std::string key;
+			int rule; // -1 for any value
+			int bit; // -1 if not required
+		};
+		struct rule {
+			unsigned types = ANY;
+			// enum or const
+			bool enumerated = false;
+			unsigned enum_literals = 0; // NUL, BOOLEAN for true, INTEGER for false
+			std::vector<double> enum_numbers;
+			std::vector<std::string> enum_strings;
+			// numbers
+			double min = -std::numeric_limits<double>::infinity();
+			double max = std::numeric_limits<double>::infinity();
+			bool exclusive_min = false, exclusive_max = false;
+			// strings
+			long min_length = 0, max_length = LONG_MAX;
+			int pattern = -1;
+			// objects
+			std::vector<property> properties; // sorted by hash
+			std::uint64_t required = 0;
+			bool additional = true;
+			// arrays
+			int items = -1;
+			long min_items = 0, max_items = LONG_MAX;
+		};
+
+		std::vector<rule> rules;
+		std::vector<std::regex> patterns;
+
+		static std::uint64_t hash(const char* b, const char* e)
+		{
+			std::uint64_t h = 0xcbf29ce484222325;
+			while (b != e) {
+				h = (h ^ static_cast<unsigned char>(*b++)) * 0x100000001b3;
+			}
+
+			return h;
+		}
+
+		static bool same(const char_view<const char>& v, const std::string& s)
+		{
+			return v.len == static_cast<long>(s.size()) and std::equal(v.buf, v.buf + v.len, s.data());
+		}
+
+		int fail(const char* msg)
+		{
+			if (!error) {
+				error = msg;
+			}
+
+			return -1;
+		}
+
+		static bool number(const value& x, double& d)
+		{
+			if (x.type() != type::JSON_NUMBER) {
+				return false;
+			}
+			d = std::get<double>(x);
+
+			return true;
+		}
+		static bool count(const value& x, long& n)
+		{
+			double d;
+			if (!number(x, d) or d < 0 or d != std::floor(d)) {
+				return false;
+			}
+			n = d < static_cast<double>(LONG_MAX) ? static_cast<long>(d) : LONG_MAX;
+
+			return true;
+		}
+
+		bool enumerate(rule& r, const value& x)
+		{
+			r.enumerated = true;
+			switch (x.type()) {
+			case type::JSON_NULL:
+				r.enum_literals |= NUL;
+				return true;
+			case type::JSON_BOOLEAN:
+				r.enum_literals |= std::get<boolean>(x) ? BOOLEAN : INTEGER;
+				return true;
+			case type::JSON_NUMBER:
+				r.enum_numbers.push_back(std::get<double>(x));
+				return true;
+			case type::JSON_STRING:
+				r.enum_strings.push_back(std::get<json::string>(x));
+				return true;
+			default:
+				fail("json::schema: enum of objects or arrays not supported");
+				return false;
+			}
+		}
+
+		// rule index of schema s or -1 on error
+		int compile(const value& s)
+		{
+			int i = static_cast<int>(rules.size());
+			rules.emplace_back();
+
+			if (s.type() == type::JSON_BOOLEAN) {
+				rules[i].types = std::get<boolean>(s) ? ANY : 0;
+
+				return i;
+			}
+			if (s.type() != type::JSON_OBJECT) {
+				return fail("json::schema: schema must be an object or boolean");
+			}
+
+			for (const auto& [key, x] : std::get<object>(s)) {
+				rule& r = rules[i];
+				if (key == "type") {
+					auto bit = [](const value& t) -> unsigned {
+						if (t.type() != type::JSON_STRING) {
+							return 0;
+						}
+						const auto& n = std::get<json::string>(t);
+						return n == "null" ? NUL : n == "object" ? OBJECT : n == "array" ? ARRAY
+							: n == "string" ? STRING : n == "number" ? NUMBER | INTEGER
+							: n == "integer" ? INTEGER : n == "boolean" ? BOOLEAN : 0;
+					};
+					r.types = 0;
+					if (x.type() == type::JSON_ARRAY) {
+						for (const auto& t : std::get<array>(x)) {
+							if (!bit(t)) {
+								return fail("json::schema: unknown type");
+							}
+							r.types |= bit(t);
+						}
+					}
+					else if (!(r.types = bit(x))) {
+						return fail("json::schema: unknown type");
+					}
+				}
+				else if (key == "enum") {
+					if (x.type() != type::JSON_ARRAY) {
+						return fail("json::schema: enum must be an array");
+					}
+					for (const auto& e : std::get<array>(x)) {
+						if (!enumerate(r, e)) {
+							return -1;
+						}
+					}
+				}
+				else if (key == "const") {
+					if (!enumerate(r, x)) {
+						return -1;
+					}
+				}
+				else if (key == "minimum" or key == "exclusiveMinimum") {
+					double d;
+					if (!number(x, d)) {
+						return fail("json::schema: minimum must be a number");
+					}
+					if (d >= r.min) {
+						r.exclusive_min = key[0] == 'e' or (d == r.min and r.exclusive_min);
+						r.min = d;
+					}
+				}
+				else if (key == "maximum" or key == "exclusiveMaximum") {
+					double d;
+					if (!number(x, d)) {
+						return fail("json::schema: maximum must be a number");
+					}
+					if (d <= r.max) {
+						r.exclusive_max = key[0] == 'e' or (d == r.max and r.exclusive_max);
+						r.max = d;
+					}
+				}
+				else if (key == "minLength" or key == "maxLength") {
+					if (!count(x, key[1] == 'i' ? r.min_length : r.max_length)) {
+						return fail("json::schema: length must be a non-negative integer");
+					}
+				}
+				else if (key == "minItems" or key == "maxItems") {
+					if (!count(x, key[1] == 'i' ? r.min_items : r.max_items)) {
+						return fail("json::schema: items count must be a non-negative integer");
+					}
+				}
+				else if (key == "pattern") {
+					if (x.type() != type::JSON_STRING) {
+						return fail("json::schema: pattern must be a string");
+					}
+					try {
+						patterns.emplace_back(std::get<json::string>(x), std::regex::ECMAScript | std::regex::optimize);
+					}
+					catch (const std::regex_error&) {
+						return fail("json::schema: invalid pattern");
+					}
+					r.pattern = static_cast<int>(patterns.size()) - 1;
+				}
+				else if (key == "additionalProperties") {
+					if (x.type() != type::JSON_BOOLEAN) {
+						return fail("json::schema: additionalProperties schema not supported");
+					}
+					r.additional = std::get<boolean>(x);
+				}
+				else if (key == "items") {
+					int j = compile(x);
+					if (j < 0) {
+						return -1;
+					}
+					rules[i].items = j;
+				}
+				else if (key == "properties") {
+					if (x.type() != type::JSON_OBJECT) {
+						return fail("json::schema: properties must be an object");
+					}
+					for (const auto& [name, y] : std::get<object>(x)) {
+						int j = compile(y);
+						if (j < 0) {
+							return -1;
+						}
+						rules[i].properties.push_back(property{ hash(name.data(), name.data() + name.size()), name, j, -1 });
+					}
+				}
+				else if (key == "required") {
+					; // after properties
+				}
+				else if (key == "$ref" or key == "allOf" or key == "anyOf" or key == "oneOf" or key == "not"
+					or key == "if" or key == "patternProperties" or key == "dependencies" or key == "dependentRequired"
+					or key == "dependentSchemas" or key == "propertyNames" or key == "contains"
+					or key == "uniqueItems" or key == "multipleOf" or key == "minProperties" or key == "maxProperties") {
+					return fail("json::schema: unsupported keyword");
+				}
+			}
+
+			rule& r = rules[i];
+			if (auto q = std::get<object>(s).find("required"); q != std::get<object>(s).end()) {
+				if (q->second.type() != type::JSON_ARRAY) {
+					return fail("json::schema: required must be an array");
+				}
+				int bit = 0;
+				for (const auto& n : std::get<array>(q->second)) {
+					if (n.type() != type::JSON_STRING) {
+						return fail("json::schema: required must be an array of strings");
+					}
+					if (bit == 64) {
+						return fail("json::schema: more than 64 required properties");
+					}
+					const auto& name = std::get<json::string>(n);
+					auto p = std::find_if(r.properties.begin(), r.properties.end(), [&name](const property& p) { return p.key == name; });
+					if (p == r.properties.end()) {
+						r.properties.push_back(property{ hash(name.data(), name.data() + name.size()), name, -1, -1 });
+						p = r.properties.end() - 1;
+					}
+					if (p->bit < 0) {
+						p->bit = bit++;
+						r.required |= std::uint64_t(1) << p->bit;
+					}
+				}
+			}
+			std::sort(r.properties.begin(), r.properties.end(), [](const property& a, const property& b) { return a.hash < b.hash; });
+
+			return i;
+		}
+
+		// length in characters of string text
+		static long length(const char* b, const char* e)
+		{
+			long n = 0;
+			while (b != e) {
+				if (*b == '\\') {
+					b += b + 1 != e and b[1] == 'u' ? std::min<long>(6, e - b) : std::min<long>(2, e - b);
+				}
+				else {
+					++b;
+					while (b != e and (*b & 0xC0) == 0x80) {
+						++b; // UTF-8 continuation
+					}
+				}
+				++n;
+			}
+
+			return n;
+		}
+
+		// check value at v against rule r, or any value if r < 0
+		const char* check(int r, char_view<const char>& v, const char*& at) const
+		{
+			static const rule any;
+			const rule& p = r < 0 ? any : rules[r];
+
+			if (!v.wstrim()) {
+				at = v.buf;
+				return "json::schema: unexpected end of input";
+			}
+			at = v.buf;
+
+			if (*v == '{') {
+				if (!(p.types & OBJECT)) {
+					return "json::schema: unexpected object";
+				}
+				if (p.enumerated) {
+					return "json::schema: value not in enum";
+				}
+				++v;
+				std::uint64_t seen = 0;
+				if (!v.wstrim().eat('}')) {
+					do {
+						at = v.wstrim().buf;
+						if (!v.eat('"')) {
+							return "json::schema: expected '\"'";
+						}
+						auto k = parse_string<const char, char_view<const char>>(v);
+						if (!v.eat('"')) {
+							return "json::schema: unterminated string";
+						}
+						if (!v.wstrim().eat(':')) {
+							at = v.buf;
+							return "json::schema: expected ':'";
+						}
+						const property* q = nullptr;
+						if (!p.properties.empty()) {
+							std::uint64_t h = hash(k.buf, k.buf + k.len);
+							auto b = std::lower_bound(p.properties.begin(), p.properties.end(), h, [](const property& x, std::uint64_t h) { return x.hash < h; });
+							for (; b != p.properties.end() and b->hash == h; ++b) {
+								if (same(k, b->key)) {
+									q = &*b;
+									break;
+								}
+							}
+						}
+						if (q) {
+							if (q->bit >= 0) {
+								seen |= std::uint64_t(1) << q->bit;
+							}
+						}
+						else if (!p.additional) {
+							at = k.buf - 1;
+							return "json::schema: additional property";
+						}
+						if (auto e = check(q ? q->rule : -1, v, at)) {
+							return e;
+						}
+					} while (v.wstrim().eat(','));
+					if (!v.eat('}')) {
+						at = v.buf;
+						return "json::schema: expected '}'";
+					}
+				}
+				if ((seen & p.required) != p.required) {
+					return "json::schema: missing required property";
+				}
+			}
+			else if (*v == '[') {
+				if (!(p.types & ARRAY)) {
+					return "json::schema: unexpected array";
+				}
+				if (p.enumerated) {
+					return "json::schema: value not in enum";
+				}
+				const char* b = v.buf;
+				++v;
+				long n = 0;
+				if (!v.wstrim().eat(']')) {
+					do {
+						if (auto e = check(p.items, v, at)) {
+							return e;
+						}
+						if (++n > p.max_items) {
+							at = b;
+							return "json::schema: too many items";
+						}
+					} while (v.wstrim().eat(','));
+					if (!v.eat(']')) {
+						at = v.buf;
+						return "json::schema: expected ']'";
+					}
+				}
+				if (n < p.min_items) {
+					at = b;
+					return "json::schema: too few items";
+				}
+			}
+			else if (*v == '"') {
+				if (!(p.types & STRING)) {
+					return "json::schema: unexpected string";
+				}
+				++v;
+				auto s = parse_string<const char, char_view<const char>>(v);
+				if (!v.eat('"')) {
+					return "json::schema: unterminated string";
+				}
+				if (p.min_length > 0 or p.max_length < LONG_MAX) {
+					long n = length(s.buf, s.buf + s.len);
+					if (n < p.min_length) {
+						return "json::schema: string too short";
+					}
+					if (n > p.max_length) {
+						return "json::schema: string too long";
+					}
+				}
+				if (p.enumerated and std::none_of(p.enum_strings.begin(), p.enum_strings.end(),
+					[&s](const std::string& e) { return same(s, e); })) {
+					return "json::schema: value not in enum";
+				}
+				if (p.pattern >= 0 and !std::regex_search(s.buf, s.buf + s.len, patterns[p.pattern])) {
+					return "json::schema: string does not match pattern";
+				}
+			}
+			else if (is_null(v)) {
+				if (!(p.types & NUL)) {
+					return "json::schema: unexpected null";
+				}
+				if (p.enumerated and !(p.enum_literals & NUL)) {
+					return "json::schema: value not in enum";
+				}
+			}
+			else if (bool t = is_true(v); t or is_false(v)) {
+				if (!(p.types & BOOLEAN)) {
+					return "json::schema: unexpected boolean";
+				}
+				if (p.enumerated and !(p.enum_literals & (t ? BOOLEAN : INTEGER))) {
+					return "json::schema: value not in enum";
+				}
+			}
+			else {
+				double d = parse_number<const char, double>(v);
+				if (d != d) {
+					return "json::schema: invalid value";
+				}
+				if (!(p.types & NUMBER) and !((p.types & INTEGER) and d == std::floor(d))) {
+					return "json::schema: unexpected number";
+				}
+				if (d < p.min or (p.exclusive_min and d == p.min)) {
+					return "json::schema: number too small";
+				}
+				if (d > p.max or (p.exclusive_max and d == p.max)) {
+					return "json::schema: number too large";
+				}
+				if (p.enumerated and std::find(p.enum_numbers.begin(), p.enum_numbers.end(), d) == p.enum_numbers.end()) {
+					return "json::schema: value not in enum";
+				}
+			}
+
+			return nullptr;
+		}
+
+	public:
+		const char* error = nullptr; // compile error
+
+		// result of validation
+		struct result {
+			const char* error = nullptr; // first violation or syntax error
+			const char* at = nullptr; // where it was found
+
+			explicit operator bool() const
+			{
+				return error == nullptr;
+			}
+		};
+
+		schema(const value& s)
+		{
+			if (compile(s) < 0) {
+				rules.clear();
+			}
+		}
+		// the text is checked strictly first since parse does not report errors
+		schema(char_view<const char> s)
+		{
+			char_view<const char> t(s);
+			const char* at;
+			if (check(-1, t, at)) {
+				fail("json::schema: invalid JSON");
+			}
+			else if (t.wstrim()) {
+				fail("json::schema: trailing characters");
+			}
+			else if (compile(parse<value>(s)) < 0) {
+				rules.clear();
+			}
+		}
+
+		// true if the schema compiled
+		explicit operator bool() const
+		{
+			return !rules.empty();
+		}
+
+		// validate one JSON value and advance v, or leave v unchanged
+		result operator()(char_view<const char>& v) const
+		{
+			if (!*this) {
+				return result{ error ? error : "json::schema: invalid schema", v.buf };
+			}
+			char_view<const char> v_(v);
+			result r;
+			r.error = check(0, v_, r.at);
+			if (!r.error) {
+				v = v_;
+				r.at = nullptr;
+			}
+
+			return r;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			const char* order = R"({
+				"type": "object",
+				"required": ["id", "side", "qty"],
+				"properties": {
+					"id": { "type": "integer", "minimum": 1 },
+					"side": { "enum": ["buy", "sell"] },
+					"qty": { "type": "number", "exclusiveMinimum": 0, "maximum": 1e6 },
+					"sym": { "type": "string", "pattern": "^[A-Z]{1,5}$", "maxLength": 5 },
+					"tags": { "type": "array", "items": { "type": "string", "minLength": 1 }, "maxItems": 3 },
+					"venue": {
+						"type": ["object", "null"],
+						"properties": { "mic": { "type": "string", "minLength": 4, "maxLength": 4 } },
+						"additionalProperties": false
+					}
+				}
+			})";
+			schema s{ char_view<const char>(order, static_cast<long>(std::strlen(order))) };
+			assert(s);
+			auto ok = [&s](const char* json) {
+				char_view<const char> v(json, static_cast<long>(std::strlen(json)));
+				auto r = s(v);
+				return r and !v.wstrim();
+			};
+			auto why = [&s](const char* json) {
+				char_view<const char> v(json, static_cast<long>(std::strlen(json)));
+				auto r = s(v);
+				assert(!r and r.at and v.buf == json);
+				return std::string(r.error);
+			};
+			assert(ok(R"({"id": 1, "side": "buy", "qty": 100})"));
+			assert(ok(R"({"qty": 0.5, "side": "sell", "id": 7, "sym": "IBM", "tags": ["a", "b"], "venue": {"mic": "XNYS"}, "x": [1, {}]})"));
+			assert(ok(R"({"id": 2, "side": "buy", "qty": 1e6, "venue": null})"));
+			assert(why(R"({"id": 1, "side": "buy"})") == "json::schema: missing required property");
+			assert(why(R"({"id": 1.5, "side": "buy", "qty": 1})") == "json::schema: unexpected number");
+			assert(why(R"({"id": 0, "side": "buy", "qty": 1})") == "json::schema: number too small");
+			assert(why(R"({"id": 1, "side": "hold", "qty": 1})") == "json::schema: value not in enum");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 0})") == "json::schema: number too small");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 2e6})") == "json::schema: number too large");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "sym": "ibm"})") == "json::schema: string does not match pattern");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "tags": ["a", "b", "c", "d"]})") == "json::schema: too many items");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "tags": [""]})") == "json::schema: string too short");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "venue": {"mic": "XNYS", "lei": 1}})") == "json::schema: additional property");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "venue": []})") == "json::schema: unexpected array");
+			assert(why(R"({"id": 1, "side": "buy", "qty": 1, "x": [1, }})") == "json::schema: invalid value");
+			assert(why(R"({"id": 1 "side": "buy"})") == "json::schema: expected '}'");
+			{
+				// first violation is reported where it is
+				const char* json = R"({"id": 1, "side": "buy", "qty": -3})";
+				char_view<const char> v(json, static_cast<long>(std::strlen(json)));
+				auto r = s(v);
+				assert(!r);
+				assert(r.at == std::strstr(json, "-3"));
+			}
+			{
+				schema t{ char_view<const char>(R"({"type": "array", "items": {"const": true}, "minItems": 1})") };
+				assert(t);
+				char_view<const char> v("[true, true] rest");
+				assert(t(v));
+				assert(v.equal(" rest"));
+				char_view<const char> w("[true, false]");
+				assert(!t(w));
+				char_view<const char> x("[]");
+				assert(!t(x));
+			}
+			{
+				schema t{ char_view<const char>(R"({"anyOf": [{"type": "string"}]})") };
+				assert(!t);
+				assert(t.error);
+				char_view<const char> v("1");
+				assert(!t(v));
+				assert(!schema{ char_view<const char>(R"({"type": "text"})") });
+				assert(!schema{ char_view<const char>(R"({"pattern": "("})") });
+			}
+			{
+				// malformed schemas fail closed
+				for (const char* text : { "{", R"({"type": "integer")", R"({"type" "integer"})", R"({"type": "integer"} x)", "" }) {
+					schema t{ char_view<const char>(text, static_cast<long>(std::strlen(text))) };
+					assert(!t and t.error);
+					char_view<const char> v("[1,2]");
+					assert(!t(v));
+				}
+			}
+			{
+				assert(schema{ value(true) });
+				schema never{ value(false) };
+				char_view<const char> v("null");
+				assert(!never(v));
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_SCHEMA_INCLUDED
@@ -0,0 +1,325 @@
+// fms_json_tape.h - fixed capacity JSON DOM usable in constant expressions
+#ifndef FMS_JSON_TAPE_INCLUDED
+#define FMS_JSON_TAPE_INCLUDED
+
+#include "fms_json.h"
+
+namespace fms::json {
+
+	/// <summary>
+	/// Flattened JSON document of at most N nodes
+	/// </summary>
+	/// <remarks>
+	/// Nodes are stored in document order. Each node knows the index one past
+	/// its subtree so children can be skipped without being visited.
+	/// Keys and strings are views into the parsed text so it must outlive the tape.
+	/// Everything is constexpr so embedded JSON can be parsed by the compiler.
+	/// </remarks>
+	template<int N, class T = const char>
+	class tape {
+	public:
+		struct node {
+			enum type type = type::JSON_NULL;
+			char_view<T> key; // member name if parent is an object
+			char_view<T> str; // string value, escapes are not decoded
+			double num = 0;
+			bool b = false;
+			int size = 0; // number of children of objects and arrays
+			int next = 0; // index one past this subtree
+		};
+
+		// reference to a node in the tape, invalid if i < 0
+		class ref {
+			const tape* t;
+			int i;
+		public:
+			constexpr ref(const tape* t, int i)
+				: t(t), i(i)
+			{ }
+
+			constexpr explicit operator bool() const
+			{
+				return i >= 0;
+			}
+			constexpr int index() const
+			{
+				return i;
+			}
+			constexpr const node& operator*() const
+			{
+				return t->nodes[i];
+			}
+			constexpr enum type type() const
+			{
+				return i < 0 ? type::JSON_NULL : t->nodes[i].type;
+			}
+			constexpr int size() const
+			{
+				return i < 0 ? 0 : t->nodes[i].size;
+			}
+
+			// first child or invalid if no children
+			constexpr ref child() const
+			{
+				return ref(t, size() ? i + 1 : -1);
+			}
+			// next sibling, caller must track the parent size
+			constexpr ref sibling() const
+			{
+				return ref(t, t->nodes[i].next);
+			}
+
+			// object member with key or invalid
+			constexpr ref operator[](const std::remove_const_t<T>* key) const
+			{
+				if (type() == type::JSON_OBJECT) {
+					ref r = child();
+					for (int k = 0; k < size(); ++k, r = r.sibling()) {
+						if ((*r).key.equal(key)) {
+							return r;
+						}
+					}
+				}
+
+				return ref(t, -1);
+			}
+			// array element or invalid
+			constexpr ref operator[](int k) const
+			{
+				if (type() == type::JSON_ARRAY and 0 <= k and k < size()) {
+					ref r = child();
+					while (k--) {
+						r = r.sibling();
+					}
+
+					return r;
+				}
+
+				return ref(t, -1);
+			}
+
+			constexpr bool operator==(double x) const
+			{
+				return type() == type::JSON_NUMBER and t->nodes[i].num == x;
+			}
+			constexpr bool operator==(bool b) const
+			{
+				return type() == type::JSON_BOOLEAN and t->nodes[i].b == b;
+			}
+			constexpr bool operator==(const std::remove_const_t<T>* s) const
+			{
+				return type() == type::JSON_STRING and t->nodes[i].str.equal(s);
+			}
+		};
+
+		node nodes[N];
+		int n = 0; // number of nodes used
+		const char* error = nullptr;
+
+		constexpr tape()
+		{ }
+		// parse all of v, check operator bool for errors
+		constexpr tape(char_view<T> v)
+		{
+			if (parse(v) and v.wstrim()) {
+				n = 0;
+				fail("json::tape: trailing characters");
+			}
+		}
+
+		constexpr explicit operator bool() const
+		{
+			return n != 0 and !error;
+		}
+
+		// parse a JSON value and advance v, or set error with v unchanged
+		constexpr bool parse(char_view<T>& v)
+		{
+			char_view<T> v_(v);
+
+			n = 0;
+			error = nullptr;
+			if (parse_value(v_, char_view<T>{}) < 0) {
+				n = 0;
+
+				return false;
+			}
+			v = v_;
+
+			return true;
+		}
+
+		constexpr ref root() const
+		{
+			return ref(this, n ? 0 : -1);
+		}
+		constexpr ref operator[](const std::remove_const_t<T>* key) const
+		{
+			return root()[key];
+		}
+		constexpr ref operator[](int k) const
+		{
+			return root()[k];
+		}
+
+	private:
+		constexpr int fail(const char* msg)
+		{
+			error = msg;
+
+			return -1;
+		}
+
+		// append value and return its index or -1 on error
+		constexpr int parse_value(char_view<T>& v, char_view<T> key)
+		{
+			if (n == N) {
+				return fail("json::tape: capacity exceeded");
+			}
+			if (!v.wstrim()) {
+				return fail("json::tape: unexpected end of input");
+			}
+
+			int i = n++;
+			nodes[i] = node{};
+			nodes[i].key = key;
+
+			if (v.eat('{')) {
+				nodes[i].type = type::JSON_OBJECT;
+				if (!v.wstrim().eat('}')) {
+					do {
+						if (!v.wstrim().eat('"')) {
+							return fail("json::tape: expected '\"'");
+						}
+						auto k = parse_string<T, char_view<T>>(v);
+						if (!v.eat('"')) {
+							return fail("json::tape: unterminated string");
+						}
+						if (!v.wstrim().eat(':')) {
+							return fail("json::tape: expected ':'");
+						}
+						if (parse_value(v, k) < 0) {
+							return -1;
+						}
+						++nodes[i].size;
+					} while (v.wstrim().eat(','));
+					if (!v.eat('}')) {
+						return fail("json::tape: expected '}'");
+					}
+				}
+			}
+			else if (v.eat('[')) {
+				nodes[i].type = type::JSON_ARRAY;
+				if (!v.wstrim().eat(']')) {
+					do {
+						if (parse_value(v, char_view<T>{}) < 0) {
+							return -1;
+						}
+						++nodes[i].size;
+					} while (v.wstrim().eat(','));
+					if (!v.eat(']')) {
+						return fail("json::tape: expected ']'");
+					}
+				}
+			}
+			else if (v.eat('"')) {
+				nodes[i].type = type::JSON_STRING;
+				nodes[i].str = parse_string<T, char_view<T>>(v);
+				if (!v.eat('"')) {
+					return fail("json::tape: unterminated string");
+				}
+			}
+			else if (is_null(v)) {
+				; // default node
+			}
+			else if (is_true(v)) {
+				nodes[i].type = type::JSON_BOOLEAN;
+				nodes[i].b = true;
+			}
+			else if (is_false(v)) {
+				nodes[i].type = type::JSON_BOOLEAN;
+			}
+			else {
+				double x = parse_number<T, double>(v);
+				if (x != x) {
+					return fail("json::tape: invalid number");
+				}
+				nodes[i].type = type::JSON_NUMBER;
+				nodes[i].num = x;
+			}
+			nodes[i].next = n;
+
+			return i;
+		}
+
+#ifdef _DEBUG
+	public:
+		static int test()
+		{
+			{
+				constexpr tape<N> t(R"({
+					"a": 1.5,
+					"b": { "c": "foo", "d": [] },
+					"e": [1, true, "baz", null],
+					"f": false
+				})");
+				static_assert(t);
+				static_assert(t.n == 11);
+				static_assert(t.root().type() == type::JSON_OBJECT);
+				static_assert(t.root().size() == 4);
+				static_assert(t["a"] == 1.5);
+				static_assert(t["b"]["c"] == "foo");
+				static_assert(t["b"]["d"].type() == type::JSON_ARRAY);
+				static_assert(t["b"]["d"].size() == 0);
+				static_assert(t["e"][0] == 1.);
+				static_assert(t["e"][1] == true);
+				static_assert(t["e"][2] == "baz");
+				static_assert(t["e"][3].type() == type::JSON_NULL);
+				static_assert(t["e"][3]);
+				static_assert(!t["e"][4]);
+				static_assert(t["f"] == false);
+				static_assert(!t["g"]);
+				static_assert(!t["a"]["b"]);
+			}
+			{
+				constexpr tape<2> t2("[1, 2]");
+				static_assert(!t2);
+				constexpr tape<3> t3("[1, 2]");
+				static_assert(t3);
+				constexpr tape<N> colon("{\"a\" 1}");
+				static_assert(!colon);
+				constexpr tape<N> bracket("[1, 2");
+				static_assert(!bracket);
+				constexpr tape<N> number("[1x]");
+				static_assert(!number);
+				constexpr tape<N> trailing("[1] garbage");
+				static_assert(!trailing and trailing.error);
+				constexpr tape<N> space(" [1] \n");
+				static_assert(space);
+				constexpr tape<N> zero("[0e400]");
+				static_assert(zero and zero[0] == 0.);
+			}
+			{
+				char buf[] = "[\"a\", {\"b\": -2e1}] tail";
+				char_view<const char> v(buf);
+				tape<N> t;
+				assert(t.parse(v));
+				assert(v.equal(" tail"));
+				assert(t[1]["b"] == -20.);
+			}
+			{
+				char_view<const char> v("{\"a\": nul}");
+				tape<N> t;
+				assert(!t.parse(v));
+				assert(t.error);
+				assert(v.equal("{\"a\": nul}"));
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_TAPE_INCLUDED
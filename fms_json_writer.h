@@ -0,0 +1,475 @@
+// fms_json_writer.h - write JSON without building values
+#ifndef FMS_JSON_WRITER_INCLUDED
+#define FMS_JSON_WRITER_INCLUDED
+
+#include <bit>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "fms_char_view.h"
+#include "fms_cpu.h"
+
+namespace fms::json {
+
+	// first byte in [b, e) that must be escaped in a JSON string, or e
+	// checks 8 bytes at a time for control characters, '"' and '\\'
+	inline const char* find_escape_scalar(const char* b, const char* e)
+	{
+		constexpr std::uint64_t ones = 0x0101010101010101, highs = 0x8080808080808080;
+		auto zero = [](std::uint64_t x) { return (x - ones) & ~x & highs; };
+
+		for (; e - b >= 8; b += 8) {
+			std::uint64_t w;
+			std::memcpy(&w, b, 8);
+			if (((w - 0x20 * ones) & ~w & highs) | zero(w ^ ('"' * ones)) | zero(w ^ ('\\' * ones))) {
+				break;
+			}
+		}
+		while (b != e and static_cast<unsigned char>(*b) >= 0x20 and *b != '"' and *b != '\\') {
+			++b;
+		}
+
+		return b;
+	}
+#ifdef FMS_CPU_X86
+	inline const char* find_escape_sse2(const char* b, const char* e)
+	{
+		for (; e - b >= 16; b += 16) {
+			__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b));
+			__m128i m = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(0x1F)), x);
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('"')));
+			m = _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('\\')));
+			if (int bits = _mm_movemask_epi8(m)) {
+				return b + std::countr_zero(static_cast<unsigned>(bits));
+			}
+		}
+
+		return find_escape_scalar(b, e);
+	}
+	FMS_TARGET("avx2") inline const char* find_escape_avx2(const char* b, const char* e)
+	{
+		for (; e - b >= 32; b += 32) {
+			__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+			__m256i m = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(0x1F)), x);
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('"')));
+			m = _mm256_or_si256(m, _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\\')));
+			if (unsigned bits = static_cast<unsigned>(_mm256_movemask_epi8(m))) {
+				return b + std::countr_zero(bits);
+			}
+		}
+
+		return find_escape_sse2(b, e);
+	}
+#endif // FMS_CPU_X86
+	// kernel for cpu::level()
+	inline const char* find_escape(const char* b, const char* e)
+	{
+#ifdef FMS_CPU_X86
+		static constexpr const char* (*kernel[])(const char*, const char*) = {
+			find_escape_scalar, find_escape_sse2, find_escape_avx2, find_escape_avx2
+		};
+
+		return cpu::call(kernel, b, e);
+#else
+		return find_escape_scalar(b, e);
+#endif
+	}
+
+	/// <summary>
+	/// Streaming JSON writer appending to a buffer
+	/// </summary>
+	/// <remarks>
+	/// Buffer needs append(const char*, n), e.g. std::string or win::mem_view<char>.
+	/// Output is staged in a small chunk and appended to the buffer when a
+	/// top level value is complete, the chunk fills, or on flush().
+	/// Separators are written automatically. Numbers are written with
+	/// std::to_chars so they are the shortest text that round trips.
+	/// key() outside an object and unmatched end_object() or end_array()
+	/// set error and are ignored in every build. Debug builds also check
+	/// the calls form a single JSON value and set error on the first call
+	/// that does not, which is then ignored.
+	/// </remarks>
+	template<class Buffer = std::string>
+	class writer {
+		Buffer& out;
+		char chunk[4096];
+		std::size_t n = 0; // bytes staged in chunk
+		// per open container: 'o' or 'a' then count of members or elements
+		std::vector<std::pair<char, long>> stack;
+		bool after_key = false;
+#ifdef _DEBUG
+		bool done = false;
+#endif
+
+		void put(const char* s, std::size_t m)
+		{
+			if (n + m > sizeof(chunk)) {
+				flush();
+				if (m > sizeof(chunk)) {
+					out.append(s, m);
+
+					return;
+				}
+			}
+			std::memcpy(chunk + n, s, m);
+			n += m;
+		}
+		void put(char c)
+		{
+			if (n == sizeof(chunk)) {
+				flush();
+			}
+			chunk[n++] = c;
+		}
+		// flush after a top level value
+		writer& next()
+		{
+			if (stack.empty()) {
+				flush();
+			}
+
+			return *this;
+		}
+
+		// separator before a value, false if a value is not allowed here
+		bool separate()
+		{
+#ifdef _DEBUG
+			if (done or (!stack.empty() and stack.back().first == 'o' and !after_key)) {
+				error = "json::writer: value not allowed here";
+
+				return false;
+			}
+#endif
+			if (after_key) {
+				after_key = false;
+			}
+			else if (!stack.empty() and stack.back().second++) {
+				put(',');
+			}
+#ifdef _DEBUG
+			done = stack.empty();
+#endif
+
+			return true;
+		}
+
+		template<class I>
+		writer& integer(I i)
+		{
+			if (separate()) {
+				char buf[24];
+				put(buf, std::to_chars(buf, buf + sizeof(buf), i).ptr - buf);
+			}
+
+			return next();
+		}
+
+		void string(char_view<const char> s)
+		{
+			const char* b = s.buf;
+			const char* e = s.buf + s.len;
+
+			put('"');
+			while (b != e) {
+				const char* p = find_escape(b, e);
+				put(b, p - b);
+				if (p == e) {
+					break;
+				}
+				switch (*p) {
+				case '"': put("\\\"", 2); break;
+				case '\\': put("\\\\", 2); break;
+				case '\b': put("\\b", 2); break;
+				case '\f': put("\\f", 2); break;
+				case '\n': put("\\n", 2); break;
+				case '\r': put("\\r", 2); break;
+				case '\t': put("\\t", 2); break;
+				default:
+					char u[] = "\\u0000";
+					u[4] = "0123456789abcdef"[(*p >> 4) & 0xF];
+					u[5] = "0123456789abcdef"[*p & 0xF];
+					put(u, 6);
+				}
+				b = p + 1;
+			}
+			put('"');
+		}
+
+	public:
+		const char* error = nullptr;
+
+		writer(Buffer& out)
+			: out(out)
+		{ }
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+		~writer()
+		{
+			flush();
+		}
+
+		// append staged output to the buffer
+		void flush()
+		{
+			if (n) {
+				out.append(chunk, n);
+				n = 0;
+			}
+		}
+
+		// start another value, e.g. the next line of NDJSON
+		void reset()
+		{
+			flush();
+			stack.clear();
+			after_key = false;
+			error = nullptr;
+#ifdef _DEBUG
+			done = false;
+#endif
+		}
+		// open objects and arrays
+		std::size_t depth() const
+		{
+			return stack.size();
+		}
+
+		writer& begin_object()
+		{
+			if (separate()) {
+				put('{');
+				stack.emplace_back('o', 0);
+#ifdef _DEBUG
+				done = false;
+#endif
+			}
+
+			return next();
+		}
+		writer& end_object()
+		{
+			if (stack.empty() or stack.back().first != 'o' or after_key) {
+				error = "json::writer: end_object without begin_object";
+
+				return *this;
+			}
+			put('}');
+			stack.pop_back();
+#ifdef _DEBUG
+			done = stack.empty();
+#endif
+
+			return next();
+		}
+		writer& begin_array()
+		{
+			if (separate()) {
+				put('[');
+				stack.emplace_back('a', 0);
+#ifdef _DEBUG
+				done = false;
+#endif
+			}
+
+			return next();
+		}
+		writer& end_array()
+		{
+			if (stack.empty() or stack.back().first != 'a') {
+				error = "json::writer: end_array without begin_array";
+
+				return *this;
+			}
+			put(']');
+			stack.pop_back();
+#ifdef _DEBUG
+			done = stack.empty();
+#endif
+
+			return next();
+		}
+
+		// member name, escaped as needed
+		writer& key(char_view<const char> k)
+		{
+			if (stack.empty() or stack.back().first != 'o' or after_key) {
+				error = "json::writer: key not in object";
+
+				return *this;
+			}
+			if (stack.back().second++) {
+				put(',');
+			}
+			string(k);
+			put(':');
+			after_key = true;
+
+			return *this;
+		}
+		writer& key(const char* k)
+		{
+			return key(char_view<const char>(k, static_cast<long>(std::strlen(k))));
+		}
+
+		writer& value(std::nullptr_t)
+		{
+			if (separate()) {
+				put("null", 4);
+			}
+
+			return next();
+		}
+		writer& value(bool b)
+		{
+			if (separate()) {
+				b ? put("true", 4) : put("false", 5);
+			}
+
+			return next();
+		}
+		// shortest text that round trips, null if not finite
+		writer& value(double x)
+		{
+			if (separate()) {
+				if (x - x != 0) {
+					put("null", 4);
+				}
+				else {
+					char buf[32];
+					put(buf, std::to_chars(buf, buf + sizeof(buf), x).ptr - buf);
+				}
+			}
+
+			return next();
+		}
+		// every standard integer type so counts need no cast, e.g. std::size_t
+		writer& value(int i)
+		{
+			return integer(i);
+		}
+		writer& value(long i)
+		{
+			return integer(i);
+		}
+		writer& value(long long i)
+		{
+			return integer(i);
+		}
+		writer& value(unsigned i)
+		{
+			return integer(i);
+		}
+		writer& value(unsigned long i)
+		{
+			return integer(i);
+		}
+		writer& value(unsigned long long i)
+		{
+			return integer(i);
+		}
+		// string, escaped as needed
+		writer& value(char_view<const char> s)
+		{
+			if (separate()) {
+				string(s);
+			}
+
+			return next();
+		}
+		writer& value(const char* s)
+		{
+			return value(char_view<const char>(s, static_cast<long>(std::strlen(s))));
+		}
+		// JSON text written as is, e.g. a number or subdocument from parsed text
+		writer& raw(char_view<const char> json)
+		{
+			if (separate()) {
+				put(json.buf, json.len);
+			}
+
+			return next();
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			cpu::isa l = cpu::level();
+			for (int i = cpu::scalar; i < cpu::levels; ++i) {
+				if (cpu::use(static_cast<cpu::isa>(i)) != i) {
+					continue;
+				}
+				const char s[] = "plain text no escapes";
+				assert(find_escape(s, s + sizeof(s) - 1) == s + sizeof(s) - 1);
+				const char t[] = "0123456789\"abc";
+				assert(find_escape(t, t + sizeof(t) - 1) == t + 10);
+				const char u[] = "01234\x01";
+				assert(find_escape(u, u + sizeof(u) - 1) == u + 5);
+				const char v[] = "\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\\";
+				assert(find_escape(v, v + sizeof(v) - 1) == v + 8);
+				const char w[] = "\xc3\xa9 0123456789abcdef0123456789abcdef0123456789\x7f\x1f";
+				assert(find_escape(w, w + sizeof(w) - 1) == w + sizeof(w) - 2);
+				assert(find_escape(w, w + sizeof(w) - 2) == w + sizeof(w) - 2);
+			}
+			cpu::use(l);
+			{
+				std::string buf;
+				writer w(buf);
+				w.begin_object()
+					.key("id").value(42)
+					.key("px").value(101.25)
+					.key("ok").value(true)
+					.key("none").value(nullptr)
+					.key("tags").begin_array().value("a\"b").value("c\\d\n\x01").end_array()
+					.key("empty").begin_object().end_object()
+					.key("raw").raw(char_view<const char>("[1,2]"))
+					.key("x").value(0.1)
+					.key("inf").value(std::numeric_limits<double>::infinity())
+					.end_object();
+				assert(!w.error);
+				assert(w.depth() == 0);
+				assert(buf == R"({"id":42,"px":101.25,"ok":true,"none":null,"tags":["a\"b","c\\d\n\u0001"],"empty":{},"raw":[1,2],"x":0.1,"inf":null})");
+
+				// reuse the buffer
+				buf.clear();
+				w.reset();
+				w.begin_array().value(-0.).value(1e300).value(std::int64_t(-9007199254740993)).end_array();
+				assert(buf == "[-0,1e+300,-9007199254740993]");
+			}
+			{
+				std::string buf;
+				writer w(buf);
+				w.begin_object().value(1);
+				assert(w.error);
+				w.reset();
+				buf.clear();
+				w.begin_array().end_object();
+				assert(w.error);
+				w.reset();
+				buf.clear();
+				w.key("a");
+				assert(w.error);
+				w.reset();
+				buf.clear();
+				w.value(1).value(2);
+				assert(w.error);
+				assert(buf == "1");
+			}
+			{
+				std::string buf;
+				writer w(buf);
+				w.begin_array().value(std::size_t(18446744073709551615u)).value(7u).value(-3L).value(-4LL).value(std::uint64_t(5)).end_array();
+				assert(!w.error);
+				assert(buf == "[18446744073709551615,7,-3,-4,5]");
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::json
+
+#endif // FMS_JSON_WRITER_INCLUDED
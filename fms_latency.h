@@ -0,0 +1,525 @@
+// fms_latency.h - latency histograms per pipeline stage
+#ifndef FMS_LATENCY_INCLUDED
+#define FMS_LATENCY_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#include <thread>
+#endif
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) or defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+#include "fms_json_writer.h"
+
+// Define FMS_LATENCY to record stages, otherwise the macros compile to nothing.
+#ifdef FMS_LATENCY
+#define FMS_LATENCY_CAT_(a, b) a##b
+#define FMS_LATENCY_CAT(a, b) FMS_LATENCY_CAT_(a, b)
+// time from here to the end of the enclosing scope as stage name
+#define FMS_LATENCY_SCOPE(name) \
+	static const int FMS_LATENCY_CAT(fms_latency_stage_, __LINE__) = ::fms::latency::stage(name); \
+	::fms::latency::scope FMS_LATENCY_CAT(fms_latency_scope_, __LINE__)(FMS_LATENCY_CAT(fms_latency_stage_, __LINE__))
+#else
+#define FMS_LATENCY_SCOPE(name) static_cast<void>(0)
+#endif
+
+namespace fms {
+
+	/// <summary>
+	/// Counts of values in buckets at most 1/32 wide relative to the value
+	/// </summary>
+	/// <remarks>
+	/// Values below 32 have their own bucket, above that each power of two is
+	/// split into 32 buckets, as in HDR histograms, so quantiles are within
+	/// about 3% for any value up to 2^64.
+	/// One thread records and any thread can read or merge it at the same time.
+	/// </remarks>
+	class histogram {
+	public:
+		static constexpr int sub = 32; // buckets per power of 2
+		static constexpr int buckets = sub + 59 * sub;
+
+		// bucket of value v
+		static constexpr int index(std::uint64_t v)
+		{
+			if (v < sub) {
+				return static_cast<int>(v);
+			}
+			int shift = std::bit_width(v) - 6;
+
+			return sub + shift * sub + static_cast<int>((v >> shift) - sub);
+		}
+		// smallest value in bucket i
+		static constexpr std::uint64_t lowest(int i)
+		{
+			if (i < sub) {
+				return static_cast<std::uint64_t>(i);
+			}
+			int shift = (i - sub) / sub;
+
+			return static_cast<std::uint64_t>(sub + (i - sub) % sub) << shift;
+		}
+		// largest value in bucket i
+		static constexpr std::uint64_t highest(int i)
+		{
+			return i + 1 < buckets ? lowest(i + 1) - 1 : ~std::uint64_t(0);
+		}
+
+	private:
+		std::atomic<std::uint64_t> n[buckets] = {};
+		std::atomic<std::uint64_t> max_{ 0 };
+
+		// single writer so no read-modify-write instruction is needed
+		static void add(std::atomic<std::uint64_t>& a, std::uint64_t x)
+		{
+			a.store(a.load(std::memory_order_relaxed) + x, std::memory_order_relaxed);
+		}
+
+	public:
+		histogram() = default;
+		histogram(const histogram&) = delete;
+		histogram& operator=(const histogram&) = delete;
+
+		void record(std::uint64_t v)
+		{
+			add(n[index(v)], 1);
+			if (v > max_.load(std::memory_order_relaxed)) {
+				max_.store(v, std::memory_order_relaxed);
+			}
+		}
+		// add the counts of h, only one thread may merge into this at a time
+		void merge(const histogram& h)
+		{
+			for (int i = 0; i < buckets; ++i) {
+				if (std::uint64_t x = h.n[i].load(std::memory_order_relaxed)) {
+					add(n[i], x);
+				}
+			}
+			std::uint64_t m = h.max_.load(std::memory_order_relaxed);
+			if (m > max_.load(std::memory_order_relaxed)) {
+				max_.store(m, std::memory_order_relaxed);
+			}
+		}
+		void clear()
+		{
+			for (auto& x : n) {
+				x.store(0, std::memory_order_relaxed);
+			}
+			max_.store(0, std::memory_order_relaxed);
+		}
+
+		std::uint64_t count() const
+		{
+			std::uint64_t c = 0;
+			for (const auto& x : n) {
+				c += x.load(std::memory_order_relaxed);
+			}
+
+			return c;
+		}
+		std::uint64_t max() const
+		{
+			return max_.load(std::memory_order_relaxed);
+		}
+		// value at quantile q in [0, 1], the middle of its bucket, 0 if empty
+		std::uint64_t quantile(double q) const
+		{
+			std::uint64_t c = count();
+			if (c == 0) {
+				return 0;
+			}
+			// rank of the value, 1 based
+			std::uint64_t r = static_cast<std::uint64_t>(q * static_cast<double>(c) + 0.5);
+			r = r < 1 ? 1 : r > c ? c : r;
+			if (r == c) {
+				return max();
+			}
+			std::uint64_t s = 0;
+			for (int i = 0; i < buckets; ++i) {
+				s += n[i].load(std::memory_order_relaxed);
+				if (s >= r) {
+					std::uint64_t v = lowest(i) + (highest(i) - lowest(i)) / 2;
+
+					return v < max() ? v : max();
+				}
+			}
+
+			return max();
+		}
+	};
+
+	/// <summary>
+	/// Latency of named stages recorded per thread and merged on demand
+	/// </summary>
+	/// <remarks>
+	/// Each thread records into its own histogram per stage without locks.
+	/// snapshot() merges the histograms of all threads, including ones that
+	/// have exited, and can be called from any thread, e.g. periodically from
+	/// a reporting thread. Times are CPU time stamp counter ticks on x86-64,
+	/// which are constant rate on current CPUs, and steady_clock elsewhere,
+	/// and are reported in nanoseconds.
+	/// reset() can also be called from any thread. It starts a new epoch and
+	/// each thread clears its own histograms when it next records, since only
+	/// the owner may write them. Until then snapshot() leaves that thread out.
+	/// Use FMS_LATENCY_SCOPE("name") to time a scope so builds without
+	/// FMS_LATENCY defined pay nothing.
+	/// </remarks>
+	class latency {
+	public:
+		static constexpr int max_stages = 64;
+
+		static std::uint64_t now()
+		{
+#if defined(__x86_64__) or defined(_M_X64)
+			return __rdtsc();
+#else
+			return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+		}
+		// nanoseconds per tick of now(), measured once
+		static double ns_per_tick()
+		{
+#if defined(__x86_64__) or defined(_M_X64)
+			static const double r = [] {
+				auto t0 = std::chrono::steady_clock::now();
+				std::uint64_t c0 = now();
+				while (std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(10))
+				{ }
+				auto t1 = std::chrono::steady_clock::now();
+				std::uint64_t c1 = now();
+
+				return std::chrono::duration<double, std::nano>(t1 - t0).count() / static_cast<double>(c1 - c0);
+			}();
+#else
+			static const double r = 1e9 * std::chrono::steady_clock::period::num / std::chrono::steady_clock::period::den;
+#endif
+			return r;
+		}
+
+	private:
+		// histograms of one thread
+		struct recorder {
+			std::atomic<histogram*> h[max_stages] = {};
+			std::atomic<std::uint64_t> epoch; // of the last reset this thread cleared for
+
+			recorder();
+			~recorder();
+		};
+
+		struct registry {
+			std::mutex m;
+			const char* names[max_stages] = {};
+			int stages = 0;
+			std::vector<recorder*> threads;
+			std::unique_ptr<histogram> retired[max_stages]; // from threads that exited
+			std::atomic<std::uint64_t> epoch{ 0 }; // number of resets
+		};
+		static registry& global()
+		{
+			static registry r;
+
+			return r;
+		}
+		static recorder& local()
+		{
+			static thread_local recorder r;
+
+			return r;
+		}
+
+	public:
+		// index of stage name, which must outlive the process, -1 if too many
+		static int stage(const char* name)
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+			for (int i = 0; i < r.stages; ++i) {
+				if (0 == std::strcmp(r.names[i], name)) {
+					return i;
+				}
+			}
+			if (r.stages == max_stages) {
+				return -1;
+			}
+			r.names[r.stages] = name;
+
+			return r.stages++;
+		}
+		static const char* name(int stage)
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+
+			return stage >= 0 and stage < r.stages ? r.names[stage] : "";
+		}
+
+		// record ticks for stage on this thread
+		static void record(int stage, std::uint64_t ticks)
+		{
+			if (stage < 0 or stage >= max_stages) {
+				return;
+			}
+			recorder& r = local();
+			if (std::uint64_t e = global().epoch.load(std::memory_order_acquire); r.epoch.load(std::memory_order_relaxed) != e) {
+				for (auto& x : r.h) {
+					if (histogram* y = x.load(std::memory_order_relaxed)) {
+						y->clear();
+					}
+				}
+				r.epoch.store(e, std::memory_order_release);
+			}
+			histogram* h = r.h[stage].load(std::memory_order_relaxed);
+			if (!h) {
+				h = new histogram;
+				r.h[stage].store(h, std::memory_order_release);
+			}
+			h->record(ticks);
+		}
+
+		// record the ticks from construction to destruction
+		class scope {
+			int stage;
+			std::uint64_t t0;
+		public:
+			explicit scope(int stage)
+				: stage(stage), t0(now())
+			{ }
+			scope(const scope&) = delete;
+			scope& operator=(const scope&) = delete;
+			~scope()
+			{
+				record(stage, now() - t0);
+			}
+		};
+
+		// merged histogram of each stage in ticks
+		struct stage_histogram {
+			const char* name;
+			std::unique_ptr<histogram> h;
+		};
+		static std::vector<stage_histogram> snapshot()
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+			std::vector<stage_histogram> s;
+			const std::uint64_t e = r.epoch.load(std::memory_order_relaxed);
+			for (int i = 0; i < r.stages; ++i) {
+				auto h = std::make_unique<histogram>();
+				if (r.retired[i]) {
+					h->merge(*r.retired[i]);
+				}
+				for (recorder* t : r.threads) {
+					if (t->epoch.load(std::memory_order_acquire) != e) {
+						continue; // not cleared since the last reset
+					}
+					if (histogram* x = t->h[i].load(std::memory_order_acquire)) {
+						h->merge(*x);
+					}
+				}
+				s.push_back({ r.names[i], std::move(h) });
+			}
+
+			return s;
+		}
+		// forget everything recorded, stages stay registered
+		// records racing with a reset may be dropped
+		static void reset()
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+			for (auto& x : r.retired) {
+				if (x) {
+					x->clear();
+				}
+			}
+			r.epoch.fetch_add(1, std::memory_order_release);
+		}
+
+		// one line per stage: name count p50 p99 p99.9 max in nanoseconds
+		template<class Buffer>
+		static void text(Buffer& out)
+		{
+			const double k = ns_per_tick();
+			char buf[256];
+			int m = std::snprintf(buf, sizeof(buf), "%-24s %12s %10s %10s %10s %10s\n", "stage", "count", "p50", "p99", "p99.9", "max");
+			out.append(buf, m);
+			for (const auto& [name, h] : snapshot()) {
+				m = std::snprintf(buf, sizeof(buf), "%-24s %12llu %10.0f %10.0f %10.0f %10.0f\n", name,
+					static_cast<unsigned long long>(h->count()), k * h->quantile(.5), k * h->quantile(.99), k * h->quantile(.999), k * h->max());
+				out.append(buf, m);
+			}
+		}
+		// JSON array of {"stage", "count", "p50", "p90", "p99", "p99.9", "max"} in nanoseconds
+		template<class Buffer>
+		static void json(Buffer& out)
+		{
+			const double k = ns_per_tick();
+			fms::json::writer<Buffer> w(out);
+			w.begin_array();
+			for (const auto& [name, h] : snapshot()) {
+				w.begin_object()
+					.key("stage").value(name)
+					.key("count").value(h->count())
+					.key("p50").value(k * h->quantile(.5))
+					.key("p90").value(k * h->quantile(.9))
+					.key("p99").value(k * h->quantile(.99))
+					.key("p99.9").value(k * h->quantile(.999))
+					.key("max").value(k * h->max())
+					.end_object();
+			}
+			w.end_array();
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				static_assert(histogram::index(31) == 31);
+				static_assert(histogram::index(32) == 32);
+				static_assert(histogram::index(63) == 63);
+				static_assert(histogram::index(64) == 64);
+				static_assert(histogram::index(65) == 64);
+				static_assert(histogram::lowest(histogram::index(1000)) <= 1000 and 1000 <= histogram::highest(histogram::index(1000)));
+				static_assert(histogram::index(~std::uint64_t(0)) == histogram::buckets - 1);
+				for (int i = 1; i < histogram::buckets; ++i) {
+					assert(histogram::lowest(i) == histogram::highest(i - 1) + 1);
+					assert(histogram::index(histogram::lowest(i)) == i);
+				}
+
+				histogram h;
+				assert(h.quantile(.5) == 0);
+				for (std::uint64_t v = 1; v <= 100000; ++v) {
+					h.record(v);
+				}
+				assert(h.count() == 100000);
+				assert(h.max() == 100000);
+				auto near = [](std::uint64_t x, double y) { return x > .97 * y and x < 1.03 * y; };
+				assert(near(h.quantile(.5), 50000));
+				assert(near(h.quantile(.99), 99000));
+				assert(near(h.quantile(.999), 99900));
+				assert(h.quantile(1) == 100000);
+			}
+			{
+				int a = stage("test.a");
+				int b = stage("test.b");
+				assert(a >= 0 and b == a + 1);
+				assert(stage("test.a") == a);
+				assert(0 == std::strcmp(name(b), "test.b"));
+
+				reset();
+				record(a, 10);
+				// a thread that exits and one still running
+				std::thread([a, b] {
+					record(a, 20);
+					record(b, 1000);
+				}).join();
+				std::atomic<bool> done = false, recorded = false;
+				std::thread t([&] {
+					record(b, 3000);
+					recorded = true;
+					while (!done)
+					{ }
+				});
+				while (!recorded)
+				{ }
+
+				auto s = snapshot();
+				assert(s[a].h->count() == 2 and s[a].h->max() == 20);
+				assert(s[b].h->count() == 2 and s[b].h->max() == 3000);
+
+				std::string j;
+				json(j);
+				assert(j.find("{\"stage\":\"test.b\",\"count\":2,") != std::string::npos);
+				std::string x;
+				text(x);
+				assert(x.find("test.a") != std::string::npos);
+
+				done = true;
+				t.join();
+				s = snapshot();
+				assert(s[b].h->count() == 2);
+				reset();
+				assert(snapshot()[b].h->count() == 0);
+
+				// reset while a thread is recording, it clears its own counts
+				std::atomic<int> step = 0;
+				std::thread u([&] {
+					record(a, 5);
+					step = 1;
+					while (step != 2)
+					{ }
+					record(a, 7);
+					step = 3;
+					while (step != 4)
+					{ }
+				});
+				while (step != 1)
+				{ }
+				assert(snapshot()[a].h->count() == 1);
+				reset();
+				assert(snapshot()[a].h->count() == 0);
+				step = 2;
+				while (step != 3)
+				{ }
+				s = snapshot();
+				assert(s[a].h->count() == 1 and s[a].h->max() == 7);
+				step = 4;
+				u.join();
+			}
+			{
+				std::uint64_t t0 = now();
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				double ns = ns_per_tick() * static_cast<double>(now() - t0);
+				assert(ns > 1.5e6 and ns < 1e9);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	inline latency::recorder::recorder()
+	{
+		registry& r = global();
+		std::lock_guard<std::mutex> lock(r.m);
+		epoch.store(r.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		r.threads.push_back(this);
+	}
+	// keep the counts of exiting threads
+	inline latency::recorder::~recorder()
+	{
+		registry& r = global();
+		std::lock_guard<std::mutex> lock(r.m);
+		const bool current = epoch.load(std::memory_order_relaxed) == r.epoch.load(std::memory_order_relaxed);
+		for (int i = 0; i < max_stages; ++i) {
+			if (histogram* x = h[i].load(std::memory_order_relaxed)) {
+				if (!current) {
+					delete x;
+					continue;
+				}
+				if (!r.retired[i]) {
+					r.retired[i] = std::make_unique<histogram>();
+				}
+				r.retired[i]->merge(*x);
+				delete x;
+			}
+		}
+		std::erase(r.threads, this);
+	}
+
+} // namespace fms
+
+#endif // FMS_LATENCY_INCLUDED
@@ -0,0 +1,280 @@
+// fms_memfd.h - sealed shared memory for passing read only data between processes
+#ifndef FMS_MEMFD_INCLUDED
+#define FMS_MEMFD_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <cstring>
+#include <string>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fms_huge.h"
+#include "fms_view.h"
+
+namespace fms {
+
+	/// <summary>
+	/// Read only memory backed by a sealed Linux memfd
+	/// </summary>
+	/// <remarks>
+	/// The creator writes the bytes and seals the file against writes and
+	/// resizing, so receivers can map it and read it in place without copying
+	/// or worrying that it changes underneath them. Pass the descriptor to
+	/// other processes with send() and receive() over a Unix domain socket,
+	/// or give them path() to open.
+	/// Every process maps the same pages so the data is in memory once per host.
+	/// </remarks>
+	class memfd {
+		static constexpr int seals = F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+		int fd = -1;
+		void* buf = MAP_FAILED;
+		std::size_t len = 0;
+
+		void fail(const char* msg)
+		{
+			error = msg;
+			close();
+		}
+
+		void close()
+		{
+			if (buf != MAP_FAILED) {
+				::munmap(buf, len ? len : 1);
+				buf = MAP_FAILED;
+			}
+			if (fd >= 0) {
+				::close(fd);
+				fd = -1;
+			}
+			len = 0;
+		}
+
+		// map fd read only
+		void map()
+		{
+			struct stat st;
+			if (::fstat(fd, &st) != 0) {
+				return fail("fms::memfd: fstat failed");
+			}
+			len = static_cast<std::size_t>(st.st_size);
+			// mmap of zero bytes fails so map a page that is never read
+			buf = ::mmap(nullptr, len ? len : 1, PROT_READ, MAP_SHARED, fd, 0);
+			if (buf == MAP_FAILED) {
+				return fail("fms::memfd: mmap failed");
+			}
+		}
+
+	public:
+		const char* error = nullptr;
+
+		memfd()
+		{ }
+		// sealed copy of [p, p + n), name is only for debugging
+		memfd(const void* p, std::size_t n, const char* name = "fms::memfd")
+			: fd(::memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING))
+		{
+			if (fd < 0) {
+				fail("fms::memfd: memfd_create failed");
+				return;
+			}
+			if (::ftruncate(fd, static_cast<off_t>(n)) != 0) {
+				fail("fms::memfd: ftruncate failed");
+				return;
+			}
+			for (std::size_t off = 0; off < n; ) {
+				ssize_t w = ::pwrite(fd, static_cast<const char*>(p) + off, n - off, static_cast<off_t>(off));
+				if (w <= 0) {
+					fail("fms::memfd: write failed");
+					return;
+				}
+				off += w;
+			}
+			if (::fcntl(fd, F_ADD_SEALS, seals) != 0) {
+				fail("fms::memfd: seal failed");
+				return;
+			}
+			map();
+		}
+		// take ownership of a received descriptor, which must be sealed
+		explicit memfd(int fd_)
+			: fd(fd_)
+		{
+			if (fd < 0) {
+				fail("fms::memfd: invalid descriptor");
+				return;
+			}
+			int s = ::fcntl(fd, F_GET_SEALS);
+			if (s < 0 or (s & seals) != seals) {
+				fail("fms::memfd: not sealed");
+				return;
+			}
+			map();
+		}
+		memfd(const memfd&) = delete;
+		memfd& operator=(const memfd&) = delete;
+		memfd(memfd&& m) noexcept
+			: fd(m.fd), buf(m.buf), len(m.len), error(m.error)
+		{
+			m.fd = -1;
+			m.buf = MAP_FAILED;
+			m.len = 0;
+		}
+		memfd& operator=(memfd&& m) noexcept
+		{
+			if (this != &m) {
+				close();
+				std::swap(fd, m.fd);
+				std::swap(buf, m.buf);
+				std::swap(len, m.len);
+				error = m.error;
+			}
+
+			return *this;
+		}
+		~memfd()
+		{
+			close();
+		}
+
+		explicit operator bool() const
+		{
+			return buf != MAP_FAILED;
+		}
+		int handle() const
+		{
+			return fd;
+		}
+		const void* data() const
+		{
+			return buf == MAP_FAILED ? nullptr : buf;
+		}
+		std::size_t size() const
+		{
+			return len;
+		}
+		view<const char> chars() const
+		{
+			return view<const char>(static_cast<const char*>(data()), static_cast<long>(len));
+		}
+		// ask for transparent huge pages for the mapping, true if the kernel accepted
+		// shared memory also needs /sys/kernel/mm/transparent_hugepage/shmem_enabled
+		bool huge() const
+		{
+			return *this and huge_advise(buf, len);
+		}
+
+		// path other processes of the same user can open read only
+		std::string path() const
+		{
+			return "/proc/" + std::to_string(::getpid()) + "/fd/" + std::to_string(fd);
+		}
+		// open a path from path() and map it
+		static memfd open(const char* path)
+		{
+			return memfd(::open(path, O_RDONLY | O_CLOEXEC));
+		}
+
+		// send the descriptor over a Unix domain socket
+		bool send(int socket) const
+		{
+			char c = 0;
+			iovec iov{ &c, 1 };
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+			msghdr msg{};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+			cm->cmsg_level = SOL_SOCKET;
+			cm->cmsg_type = SCM_RIGHTS;
+			cm->cmsg_len = CMSG_LEN(sizeof(int));
+			std::memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+			return *this and ::sendmsg(socket, &msg, MSG_NOSIGNAL) == 1;
+		}
+		// receive a descriptor sent with send() and map it
+		static memfd receive(int socket)
+		{
+			char c;
+			iovec iov{ &c, 1 };
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+			msghdr msg{};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+
+			int fd = -1;
+			if (::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC) == 1) {
+				cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+				if (cm and cm->cmsg_level == SOL_SOCKET and cm->cmsg_type == SCM_RIGHTS and cm->cmsg_len == CMSG_LEN(sizeof(int))) {
+					std::memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+				}
+			}
+
+			return memfd(fd);
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			const char text[] = "shared bytes";
+			{
+				memfd m(text, sizeof(text));
+				assert(m);
+				assert(m.size() == sizeof(text));
+				assert(0 == std::memcmp(m.data(), text, sizeof(text)));
+				// sealed
+				assert(::pwrite(m.handle(), "x", 1, 0) < 0);
+				assert(::ftruncate(m.handle(), 1) != 0);
+				assert(::mmap(nullptr, m.size(), PROT_READ | PROT_WRITE, MAP_SHARED, m.handle(), 0) == MAP_FAILED);
+
+				int sv[2];
+				assert(0 == ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv));
+				assert(m.send(sv[0]));
+				memfd r = memfd::receive(sv[1]);
+				assert(r);
+				assert(r.handle() != m.handle());
+				assert(r.size() == m.size());
+				assert(0 == std::memcmp(r.data(), text, sizeof(text)));
+				::close(sv[0]);
+				::close(sv[1]);
+
+				m.huge(); // advice only, small mappings are refused
+
+				memfd o = memfd::open(m.path().c_str());
+				assert(o);
+				assert(o.chars().equal(m.chars()));
+
+				memfd n(std::move(o));
+				assert(n and !o);
+				o = std::move(n);
+				assert(o and !n);
+			}
+			{
+				memfd e(nullptr, 0);
+				assert(e);
+				assert(e.size() == 0);
+			}
+			{
+				// unsealed descriptors are refused
+				int fd = ::memfd_create("unsealed", MFD_CLOEXEC);
+				assert(fd >= 0);
+				memfd m(fd);
+				assert(!m);
+				assert(m.error);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_MEMFD_INCLUDED
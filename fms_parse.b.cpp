@@ -0,0 +1,564 @@
+// fms_parse.b.cpp - benchmarks, run with the names to run or none for all
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include "fms_parse.h"
+
+using namespace fms;
+
+// seconds to call f
+template<class F>
+double seconds(F f)
+{
+	auto t0 = std::chrono::steady_clock::now();
+	f();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// user space data TLB read misses while alive, if the CPU exposes them
+class tlb_misses {
+	int fd = -1;
+public:
+	tlb_misses()
+	{
+#ifdef __linux__
+		perf_event_attr a;
+		std::memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.type = PERF_TYPE_HW_CACHE;
+		a.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		a.exclude_kernel = 1;
+		fd = static_cast<int>(::syscall(SYS_perf_event_open, &a, 0, -1, -1, 0));
+#endif
+	}
+	tlb_misses(const tlb_misses&) = delete;
+	tlb_misses& operator=(const tlb_misses&) = delete;
+	~tlb_misses()
+	{
+#ifdef __linux__
+		if (fd >= 0) {
+			::close(fd);
+		}
+#endif
+	}
+	// -1 if not available
+	long long count() const
+	{
+		long long n = -1;
+#ifdef __linux__
+		if (fd < 0 or ::read(fd, &n, sizeof(n)) != sizeof(n)) {
+			n = -1;
+		}
+#endif
+		return n;
+	}
+};
+
+// random reads and a minify pass over 4KB pages and huge pages
+void huge()
+{
+	const std::size_t n = std::size_t(1) << 30; // 1GB
+	const std::size_t reads = 1 << 24;
+
+	auto walk = [&](const char* p, const char* name) {
+		std::mt19937_64 r(1);
+		std::size_t sum = 0;
+		tlb_misses t;
+		double s = seconds([&] {
+			for (std::size_t i = 0; i < reads; ++i) {
+				sum += p[r() & (n - 1)];
+			}
+		});
+		long long m = t.count();
+		std::printf("huge: %-4s pages random read %5.1f ns", name, s * 1e9 / reads);
+		m < 0 ? std::printf("  TLB misses n/a") : std::printf("  TLB misses/read %4.2f", double(m) / reads);
+		std::printf("  (%zu)\n", sum);
+	};
+
+	{
+		char* p = new char[n];
+		std::memset(p, 1, n);
+		walk(p, "4KB");
+		delete[] p;
+	}
+	{
+		char* p = static_cast<char*>(huge_alloc(n));
+		std::memset(p, 1, n);
+		walk(p, "huge");
+		huge_free(p, n);
+	}
+
+	// minify 256MB of NDJSON into each kind of buffer
+	std::string text;
+	while (text.size() < (std::size_t(1) << 28)) {
+		text += R"({"id": 12345, "sym": "IBM", "px": [101.25, 101.5], "q": {"bid": 101.2, "ask": 101.3}})" "\n";
+	}
+	char_view<const char> v(text.data(), static_cast<long>(text.size()));
+	auto minify = [&](auto& out, const char* name) {
+		double s = seconds([&] {
+			json::formatter f(out);
+			f(v);
+		});
+		std::printf("huge: %-11s minify %5.2f GB/s\n", name, text.size() / s / 1e9);
+	};
+	std::string s;
+	minify(s, "std::string");
+	huge_buffer h;
+	minify(h, "huge_buffer");
+}
+
+// converters and profile with and without live progress counters
+void progress()
+{
+	std::string ndjson, csv = "id,sym,bid,ask\n";
+	while (ndjson.size() < (std::size_t(1) << 26)) {
+		ndjson += R"({"id": 12345, "sym": "IBM", "px": [101.25, 101.5], "q": {"bid": 101.2, "ask": 101.3}})" "\n";
+		csv += "12345,IBM,101.2,\"101.3\"\n";
+	}
+	auto view = [](const std::string& s) { return char_view<const char>(s.data(), static_cast<long>(s.size())); };
+	// best of interleaved runs without and with counters and a reporter
+	auto compare = [](const char* name, std::size_t bytes, auto run) {
+		double s0 = 1e9, s1 = 1e9;
+		for (int i = 0; i < 11; ++i) {
+			s0 = std::min(s0, seconds([&] { run(nullptr); }));
+			fms::progress p(bytes);
+			fms::progress::reporter r(p, std::chrono::milliseconds(100), [](const auto&) { });
+			s1 = std::min(s1, seconds([&] { run(&p); }));
+		}
+		std::printf("progress: %-14s %5.0f MB/s without counters %5.0f MB/s with, overhead %+.1f%%\n",
+			name, bytes / s0 / 1e6, bytes / s1 / 1e6, 100 * (s1 - s0) / s0);
+	};
+	compare("ndjson_to_csv", ndjson.size(), [&](fms::progress* p) {
+		json::ndjson_to_csv c({ "id", "sym", "q.bid", "q.ask" });
+		c.counters = p;
+		huge_buffer out;
+		parse::delimited_writer w(out);
+		c(view(ndjson), w);
+	});
+	compare("csv_to_json", csv.size(), [&](fms::progress* p) {
+		json::csv_to_json c;
+		c.counters = p;
+		auto v = view(csv);
+		c.header(v);
+		huge_buffer out;
+		c.ndjson(v, out);
+	});
+	compare("parse::profile", csv.size(), [&](fms::progress* p) {
+		parse::profile c(',', '"', '"', 0, 0);
+		c.counters = p;
+		auto v = view(csv);
+		c.header(v);
+		c(v);
+	});
+}
+
+// JSON parse without tracing and into the ring of this thread
+void trace()
+{
+	std::string text;
+	while (text.size() < (std::size_t(1) << 24)) {
+		text += R"({"id": 12345, "sym": "IBM", "px": [101.25, 101.5], "q": {"bid": 101.2, "ask": 101.3}})" "\n";
+	}
+	auto run = [&](auto parse) {
+		return seconds([&] {
+			char_view<const char> v(text.data(), static_cast<long>(text.size()));
+			while (v.wstrim()) {
+				parse(v);
+			}
+		});
+	};
+	auto& r = trace::ring::local();
+	double s0 = 1e9, s1 = 1e9;
+	for (int i = 0; i < 3; ++i) {
+		s0 = std::min(s0, run([](auto& v) { return json::parse<json::value>(v); }));
+		r.clear();
+		trace::local::start(text.data());
+		s1 = std::min(s1, run([](auto& v) { return json::parse<json::value, trace::local>(v); }));
+	}
+	const double n = static_cast<double>(r.size() + r.dropped());
+	std::printf("trace: parse %5.0f MB/s trace::none %5.0f MB/s trace::local, %.0f events %.1f ns each\n",
+		text.size() / s0 / 1e6, text.size() / s1 / 1e6, n, (s1 - s0) * 1e9 / n);
+}
+
+// JSON and FIX-like messages of 200 bytes to 4KB
+std::vector<std::string> messages(bool fix, std::size_t n)
+{
+	std::mt19937_64 r(2);
+	std::vector<std::string> ms;
+	char buf[256];
+	auto u = [&r](unsigned long long m) { return static_cast<unsigned long long>(r() % m); }; // for %llu
+	for (std::size_t i = 0; i < n; ++i) {
+		const std::size_t size = 200 + r() % (4096 - 200);
+		std::string m;
+		if (fix) {
+			std::snprintf(buf, sizeof(buf), "8=FIX.4.4\x01" "35=D\x01" "49=SENDER\x01" "56=TARGET\x01" "34=%zu\x01" "52=20240102-09:30:00.123\x01", i);
+			m = buf;
+			while (m.size() < size) {
+				std::snprintf(buf, sizeof(buf), "55=SYM%llu\x01" "54=%d\x01" "38=%llu\x01" "44=%llu.%02llu\x01" "40=2\x01",
+					u(1000), int(1 + r() % 2), u(10000), u(1000), u(100));
+				m += buf;
+			}
+			m += "10=123\x01";
+		}
+		else {
+			std::snprintf(buf, sizeof(buf), R"({"type": "order", "seq": %zu, "time": "2024-01-02T09:30:00.123Z", "legs": [)", i);
+			m = buf;
+			for (int j = 0; m.size() < size - 2; ++j) {
+				std::snprintf(buf, sizeof(buf), R"(%s{"sym": "SYM%llu", "side": "%s", "qty": %llu, "px": %llu.%02llu, "tif": null, "ok": true})",
+					j ? ", " : "", u(1000), r() % 2 ? "buy" : "sell", u(10000), u(1000), u(100));
+				m += buf;
+			}
+			m += "]}";
+		}
+		ms.push_back(std::move(m));
+	}
+
+	return ms;
+}
+
+// Replay ms at rate messages per second through f and print the latency
+// distribution. Latency is measured from when each message was due, not
+// when f started, so a stall also counts against the messages queued behind
+// it instead of being hidden by the generator waiting (coordinated omission).
+template<class F>
+void replay(const char* name, const std::vector<std::string>& ms, double rate, std::size_t n, F f)
+{
+	const double ns = latency::ns_per_tick();
+	const double interval = 1e9 / rate / ns;
+	histogram corrected, service;
+	volatile std::size_t sink = 0;
+	const std::uint64_t t0 = latency::now();
+	for (std::size_t i = 0; i < n; ++i) {
+		const std::uint64_t due = t0 + static_cast<std::uint64_t>(i * interval);
+		std::uint64_t t = latency::now();
+		while (t < due) {
+			t = latency::now();
+		}
+		const auto& m = ms[i % ms.size()];
+		sink = sink + f(char_view<const char>(m.data(), static_cast<long>(m.size())));
+		const std::uint64_t e = latency::now();
+		corrected.record(e - due);
+		service.record(e - t);
+	}
+	auto q = [&](const histogram& h, double p) { return h.quantile(p) * ns; };
+	std::printf("latency: %-16s p50 %6.0f p90 %6.0f p99 %6.0f p99.9 %6.0f p99.99 %6.0f max %7.0f ns (service time p99.9 %6.0f)\n",
+		name, q(corrected, .5), q(corrected, .9), q(corrected, .99), q(corrected, .999), q(corrected, .9999), corrected.max() * ns,
+		q(service, .999));
+}
+
+// small message parse latency at a fixed rate for each parser
+void latency_()
+{
+	const double rate = 10000; // messages per second, below what json::value sustains
+	const std::size_t n = 20000;
+	const auto json = messages(false, 1000);
+	const auto fix = messages(true, 1000);
+
+	replay("json::value", json, rate, n, [](char_view<const char> v) {
+		return json::parse<json::value>(v).type() == json::type::JSON_OBJECT;
+	});
+	replay("json::lazy_value", json, rate, n, [](char_view<const char> v) {
+		return json::parse<json::lazy_value>(v).type() == json::type::JSON_OBJECT;
+	});
+	static json::tape<1024> t;
+	replay("json::tape", json, rate, n, [](char_view<const char> v) {
+		return t.parse(v) ? t.n : 0;
+	});
+	replay("json::skip_value", json, rate, n, [](char_view<const char> v) {
+		return json::skip_value(v) ? 1 : 0;
+	});
+	replay("fix splitable", fix, rate, n, [](char_view<const char> v) {
+		std::size_t tags = 0;
+		for (auto f : parse::splitable<const char>(v, '\x01')) {
+			auto tag = parse::split<const char>(f, '=', 0, 0);
+			tags += tag.len + f.len;
+		}
+		return tags;
+	});
+}
+
+// seconds to call f(i) on threads i = 0, ..., n - 1
+template<class F>
+double parallel(unsigned n, F f)
+{
+	return seconds([&] {
+		std::vector<std::thread> ts;
+		for (unsigned i = 0; i < n; ++i) {
+			ts.emplace_back(f, i);
+		}
+		for (auto& t : ts) {
+			t.join();
+		}
+	});
+}
+
+// Throughput of the parallel paths at 1, 2, 4, ... threads up to the number
+// of cores, or FMS_THREADS, with speedup and efficiency against one thread
+// and the fraction of parallel memcpy at the same number of threads.
+void scaling()
+{
+	unsigned m = std::thread::hardware_concurrency();
+	if (const char* e = std::getenv("FMS_THREADS")) {
+		m = static_cast<unsigned>(std::atoi(e));
+	}
+	m = m ? m : 1;
+	std::vector<unsigned> ns;
+	for (unsigned n = 1; n < m; n *= 2) {
+		ns.push_back(n);
+	}
+	ns.push_back(m);
+
+	std::string ndjson, csv;
+	while (ndjson.size() < (std::size_t(1) << 26)) {
+		ndjson += R"({"id": 12345, "sym": "IBM", "px": [101.25, 101.5], "q": {"bid": 101.2, "ask": 101.3}})" "\n";
+		csv += "12345,IBM,101.25,101.5,\"bid, ask\",101.2,101.3\n";
+	}
+	const char_view<const char> nv(ndjson.data(), static_cast<long>(ndjson.size()));
+	const char_view<const char> cv(csv.data(), static_cast<long>(csv.size()));
+	std::vector<char> dst(ndjson.size());
+	std::vector<double> roof; // memcpy GB/s at each n
+
+	// run f(n) returning seconds for each n and print the curve
+	auto curve = [&](const char* name, std::size_t bytes, auto f) {
+		double s1 = 0;
+		for (std::size_t j = 0; j < ns.size(); ++j) {
+			unsigned n = ns[j];
+			double s = std::min(f(n), f(n));
+			s1 = j ? s1 : s;
+			double gbs = bytes / s / 1e9;
+			if (roof.size() < ns.size()) {
+				roof.push_back(gbs);
+			}
+			std::printf("scaling: %-14s threads %3u %6.2f GB/s speedup %5.2f efficiency %4.0f%% of memcpy %4.0f%%\n",
+				name, n, gbs, s1 / s, 100 * s1 / s / n, 100 * gbs / roof[j]);
+		}
+	};
+	auto chunks = [](char_view<const char> v, unsigned n) {
+		return json::blocks(v, n);
+	};
+
+	curve("memcpy", ndjson.size(), [&](unsigned n) {
+		auto bs = chunks(nv, n);
+		return parallel(static_cast<unsigned>(bs.size()), [&](unsigned i) {
+			std::memcpy(dst.data() + (bs[i].buf - nv.buf), bs[i].buf, bs[i].len);
+		});
+	});
+	std::size_t lines = 0;
+	curve("memchr", ndjson.size(), [&](unsigned n) {
+		auto bs = chunks(nv, n);
+		std::vector<std::size_t> k(bs.size());
+		double s = parallel(static_cast<unsigned>(bs.size()), [&](unsigned i) {
+			const char* p = bs[i].buf;
+			const char* e = bs[i].buf + bs[i].len;
+			while ((p = static_cast<const char*>(std::memchr(p, '\n', e - p)))) {
+				++p;
+				++k[i];
+			}
+		});
+		lines = 0;
+		for (auto x : k) {
+			lines += x;
+		}
+		return s;
+	});
+	curve("split", csv.size(), [&](unsigned n) {
+		auto bs = json::blocks(cv, n, '"');
+		std::vector<std::size_t> k(bs.size());
+		double s = parallel(static_cast<unsigned>(bs.size()), [&](unsigned i) {
+			for (auto r : parse::splitable<const char>(bs[i], '\n', '"', '"')) {
+				for (auto f : parse::splitable<const char>(r, ',', '"', '"')) {
+					k[i] += f.len != 0;
+				}
+			}
+		});
+		std::size_t fields = 0;
+		for (auto x : k) {
+			fields += x;
+		}
+		if (fields != 7 * lines) {
+			std::printf("scaling: split found %zu fields, expected %zu\n", fields, 7 * lines);
+		}
+		return s;
+	});
+	curve("parse_value", ndjson.size(), [&](unsigned n) {
+		auto bs = chunks(nv, n);
+		return parallel(static_cast<unsigned>(bs.size()), [&](unsigned i) {
+			char_view<const char> v(bs[i]);
+			while (v.wstrim()) {
+				json::parse<json::lazy_value>(v);
+			}
+		});
+	});
+	curve("ndjson_to_csv", ndjson.size(), [&](unsigned n) {
+		json::ndjson_to_csv c({ "id", "sym", "q.bid", "q.ask" });
+		huge_buffer out;
+		parse::delimited_writer w(out);
+		return seconds([&] { c(nv, w, n); });
+	});
+	curve("csv_to_json", csv.size(), [&](unsigned n) {
+		json::csv_to_json c;
+		char_view<const char> h("id,sym,bid,ask,note,b,a\n");
+		c.header(h);
+		huge_buffer out;
+		return seconds([&] { c.ndjson(cv, out, n); });
+	});
+}
+
+// cycles in each parse phase for inputs heavy in numbers, strings, and fields
+void phases()
+{
+#ifndef FMS_PROFILE
+	std::printf("phases: build with FMS_PROFILE defined, e.g. fms_parse.p phases\n");
+#else
+	std::string numbers, strings, csv;
+	std::mt19937_64 r(3);
+	while (numbers.size() < (std::size_t(1) << 24)) {
+		numbers += "[" + std::to_string(r() % 100000) + ".25, -" + std::to_string(r()) + "e-3, " + std::to_string(r() % 7) + "]\n";
+		strings += R"({"name": "a somewhat longer string value", "city": "New York", "note": "escaped \"quote\" here"})" "\n";
+		csv += "12345, IBM , 101.25,\"bid, ask\", 101.3 \n";
+	}
+	auto run = [](const char* name, const std::string& in, auto f) {
+		phase::reset();
+		f(char_view<const char>(in.data(), static_cast<long>(in.size())));
+		std::string t;
+		phase::text(t);
+		std::printf("phases: %s\n%s", name, t.c_str());
+	};
+	auto parse = [](char_view<const char> v) {
+		while (v.wstrim()) {
+			json::parse<json::value>(v);
+		}
+	};
+	run("json::value numbers", numbers, parse);
+	run("json::value strings", strings, parse);
+	run("splitable csv", csv, [](char_view<const char> v) {
+		for (auto rec : parse::splitable<const char>(v, '\n', '"', '"')) {
+			for (auto f : parse::splitable<const char>(rec, ',', '"', '"')) {
+				(void)f;
+			}
+		}
+	});
+#endif
+}
+
+// time to sample records from NDJSON and CSV of 1GB
+void sample()
+{
+	const std::size_t n = std::size_t(1) << 30;
+	char* p = static_cast<char*>(huge_alloc(n));
+	std::mt19937_64 r(4);
+	std::string line;
+	// NDJSON, CSV with quoted newlines, and CSV with nothing quoted
+	const char* names[] = { "ndjson", "csv", "plain" };
+	const char* heads[] = { R"({"id": 12345, "sym": "IBM", "note": ")", "12345,IBM,\"note, with\nnewline\",", "12345,IBM,101.25," };
+	const char* tails[] = { "\"}\n", "\n", "\n" };
+	for (int f = 0; f < 3; ++f) {
+		std::size_t i = 0;
+		while (i < n) {
+			line = heads[f];
+			line.append(r() % 200, 'x');
+			line += tails[f];
+			std::size_t m = std::min(line.size(), n - i);
+			std::memcpy(p + i, line.data(), m);
+			i += m;
+		}
+		char_view<const char> v(p, static_cast<long>(n));
+		// records are at least 18 bytes, the default assumes 2
+		for (long shortest : { 2, 18 }) {
+			parse::sampler s(v, f ? '"' : 0, ',', 1, shortest);
+			for (std::size_t k : { 10, 1000, 10000 }) {
+				std::size_t got = 0;
+				double t = seconds([&] { got = s(k).size(); });
+				std::printf("sample: %-6s 1GB shortest %2ld %5zu records %7.2f ms\n", names[f], shortest, got, t * 1e3);
+			}
+		}
+	}
+	huge_free(p, n);
+}
+
+// split only against profiling every column in the same pass
+void profile()
+{
+	std::string text = "id,sym,px,qty,note\n";
+	std::mt19937_64 r(5);
+	const char* syms[] = { "IBM", "MSFT", "AAPL", "GOOG", "AMZN", "ORCL", "INTC", "CSCO" };
+	while (text.size() < (std::size_t(1) << 26)) {
+		text += std::to_string(r() % 1000000) + "," + syms[r() % 8] + "," + std::to_string(r() % 20000 / 100.) + ","
+			+ std::to_string(r() % 500 * 100) + (r() % 4 ? ",\"a, b\"\n" : ",null\n");
+	}
+	char_view<const char> v(text.data(), static_cast<long>(text.size()));
+	auto best = [](auto f) {
+		double s = 1e9;
+		for (int i = 0; i < 3; ++i) {
+			s = std::min(s, seconds(f));
+		}
+		return s;
+	};
+	auto report = [&](const char* name, double s) {
+		std::printf("profile: %-26s %6.0f MB/s\n", name, text.size() / s / 1e6);
+	};
+	volatile std::size_t sink = 0;
+	report("split only", best([&] {
+		for (auto rec : parse::splitable<const char>(v, '\n', '"', '"')) {
+			for (auto f : parse::splitable<const char>(rec, ',', '"', '"')) {
+				sink = sink + f.len;
+			}
+		}
+	}));
+	using sketch = parse::profile::sketch;
+	for (auto [name, sketches] : { std::pair{ "counts, min, max", 0u }, { "distinct", unsigned(sketch::distinct) },
+		{ "distinct, quantile", unsigned(sketch::distinct | sketch::quantile) }, { "all", unsigned(sketch::all) } }) {
+		report(name, best([&, sketches] {
+			parse::profile p(',', '"', '"', 0, sketches);
+			auto w = v;
+			p.header(w);
+			p(w);
+		}));
+	}
+	const unsigned n = std::max(2u, std::thread::hardware_concurrency());
+	report("all threaded", best([&] {
+		parse::profile p;
+		auto w = v;
+		p.header(w);
+		p(w, n);
+	}));
+}
+
+int main(int argc, char* argv[])
+{
+	std::pair<const char*, std::function<void()>> benchmarks[] = {
+		{ "huge", huge },
+		{ "progress", ::progress },
+		{ "trace", ::trace },
+		{ "latency", latency_ },
+		{ "scaling", scaling },
+		{ "phases", phases },
+		{ "sample", sample },
+		{ "profile", ::profile },
+	};
+
+	for (auto& [name, f] : benchmarks) {
+		bool run = argc == 1;
+		for (int i = 1; i < argc; ++i) {
+			run = run or 0 == std::strcmp(argv[i], name);
+		}
+		if (run) {
+			f();
+		}
+	}
+
+	return 0;
+}
@@ -7,10 +7,36 @@
 
 #include <cstdlib>
 #include "fms_char_view.h"
+#include "fms_cpu.h"
+#include "fms_huge.h"
+#include "fms_latency.h"
+#include "fms_phase.h"
+#include "fms_phase_scope.h"
+#include "fms_probe.h"
+#include "fms_progress.h"
+#include "fms_trace.h"
 #include "fms_parse_split.h"
+#include "fms_parse_sample.h"
+#include "fms_parse_write.h"
 #include "fms_json.h"
+#include "fms_json_tape.h"
+#include "fms_json_path.h"
+#include "fms_json_columns.h"
+#include "fms_json_intern.h"
+#include "fms_json_document.h"
+#include "fms_json_image.h"
+#include "fms_json_schema.h"
+#include "fms_json_writer.h"
+#include "fms_json_format.h"
+#include "fms_json_csv.h"
+#include "fms_sketch.h"
+#include "fms_parse_profile.h"
+#include "fms_reclaimer.h"
 #ifdef _MSC_VER
 #include "win_mem_view.h"
 #endif
+#ifdef __linux__
+#include "fms_memfd.h"
+#endif
 
 #endif // FMS_PARSE_INCLUDED
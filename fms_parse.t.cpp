@@ -12,10 +12,37 @@ int test_fms_eat = fms::eat_test<char>();
 int test_fms_char_view = fms::char_view<char>::test();
 int test_fms_wchar_view = fms::char_view<wchar_t>::test();
 
+int test_fms_cpu = fms::cpu::test();
+int test_fms_huge_buffer = fms::huge_buffer::test();
+int test_fms_latency = fms::latency::test();
+int test_fms_progress = fms::progress::test();
+int test_fms_trace_ring = fms::trace::ring::test();
+int test_fms_phase = fms::phase::test();
+
+int test_fms_cow_vector = fms::cow<std::vector<int>>::test();
 int test_fms_json_value = fms::json::value_test();
+int test_fms_json_parse = fms::json::parse_test();
+int test_fms_json_lazy_number = fms::json::lazy_number<const char>::test();
+int test_fms_reclaimer_vector = fms::reclaimer<std::vector<int>>::test();
+int test_fms_reclaimer_json_value = fms::reclaimer<fms::json::value>::test();
 int test_fms_json_eat_chars = fms::json::eat_chars_test();
 int test_fms_json_parse_number = fms::json::parse_number_test();
 int test_fms_json_parse_string = fms::json::parse_string_test();
+int test_fms_json_skip_value = fms::json::skip_value_test();
+int test_fms_json_tape = fms::json::tape<16>::test();
+int test_fms_json_query = fms::json::query::test();
+int test_fms_json_columns = fms::json::columns::test();
+int test_fms_json_interner = fms::json::interner::test();
+int test_fms_json_document = fms::json::document<>::test();
+int test_fms_json_image = fms::json::image::test();
+int test_fms_json_schema = fms::json::schema::test();
+int test_fms_json_writer = fms::json::writer<>::test();
+int test_fms_json_formatter = fms::json::formatter<>::test();
+int test_fms_json_ndjson_to_csv = fms::json::ndjson_to_csv::test();
+int test_fms_json_csv_to_json = fms::json::csv_to_json::test();
+#ifdef FMS_MEMFD_INCLUDED
+int test_fms_memfd = fms::memfd::test();
+#endif
 #ifdef WIN_MEM_VIEW_INCLUDED
 int test_win_mem_veiw_int = win::mem_view<int>::test();
 int test_win_mem_veiw_char = win::mem_view<char>::test();
@@ -24,6 +51,12 @@ int test_win_mem_veiw_double = win::mem_view<double>::test();
 #ifdef FMS_PARSE_SPLIT_INCLUDED
 int test_fms_parse_splitable = fms::parse::splitable<char>::test();
 #endif
+int test_fms_parse_sampler = fms::parse::sampler::test();
+int test_fms_hyperloglog = fms::hyperloglog<>::test();
+int test_fms_kll = fms::kll::test();
+int test_fms_heavy_hitters = fms::heavy_hitters::test();
+int test_fms_parse_profile = fms::parse::profile::test();
+int test_fms_parse_delimited_writer = fms::parse::delimited_writer<>::test();
 
 int main()
 {
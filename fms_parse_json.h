@@ -4,53 +4,69 @@
 
 #include <cstdlib>
 #include <cmath>
+#include <limits>
 //#include <concepts>
 #include <map>
 #include <string>
 #include <vector>
 #include <variant>
 #include "fms_char_view.h"
+#include "fms_trace.h"
 
 namespace fms::json {
 
-	// eat characters and ensure whitespace terminated
+	// JSON tokens end at whitespace, a separator, or the end of the view
 	template<class T>
-	inline bool eat_chars(char_view<T>& v, const char* s, int n)
+	constexpr bool is_terminator(const char_view<T>& v)
 	{
-		while (v and n--) {
-			if (*v++ != *s++) {
+		return !v or is_space(*v) or *v == ',' or *v == ']' or *v == '}' or *v == ':';
+	}
+
+	// eat characters and ensure terminated, or return false with view unchanged
+	template<class T>
+	constexpr bool eat_chars(char_view<T>& v, const char* s, int n)
+	{
+		char_view<T> v_(v);
+
+		while (v_ and n) {
+			if (*v_ != *s) {
 				return false;
 			}
+			++v_;
+			++s;
+			--n;
 		}
-		if (v and !::isspace(*v)) {
+		if (n or !is_terminator(v_)) {
 			return false;
 		}
+		v = v_;
 
 		return true;
 	}
 
 	template<class T>
-	inline bool is_null(char_view<T>& v)
+	constexpr bool is_null(char_view<T>& v)
 	{
 		return eat_chars(v, "null", 4);
 	}
 
 	template<class T>
-	inline bool is_true(char_view<T>& v)
+	constexpr bool is_true(char_view<T>& v)
 	{
 		return eat_chars(v, "true", 4);
 	}
 
 	template<class T>
-	inline bool is_false(char_view<T>& v)
+	constexpr bool is_false(char_view<T>& v)
 	{
 		return eat_chars(v, "false", 5);
 	}
 
 	// "str\\\"ing" -> str\\\"ing
 	template<class T, class String>
-	inline String parse_string(char_view<T>& v)
+	constexpr String parse_string(char_view<T>& v)
 	{
+		FMS_PHASE(string);
 		char_view<T> v_(v);
 
 		while (v_ and *v_ != '"') {
@@ -73,29 +89,126 @@ namespace fms::json {
 		return String(v_.buf, v_.len);
 	}
 
-	template<class T, class Number>
-	inline Number parse_number(char_view<T>& v)
+	// append string text from parse_string to s with escapes decoded
+	// \uXXXX is written as UTF-8, invalid escapes are copied as is
+	template<class T, class String>
+	inline String& unescape(char_view<T> v, String& s)
 	{
-		static constexpr double NaN = std::numeric_limits<double>::quiet_NaN();
-		double sgn = 1, x = NaN;
+		auto hex = [](char_view<T>& v, unsigned& u) {
+			if (v.len < 4) {
+				return false;
+			}
+			u = 0;
+			for (int i = 0; i < 4; ++i) {
+				T c = v.buf[i];
+				unsigned d = c >= '0' and c <= '9' ? c - '0' : c >= 'a' and c <= 'f' ? c - 'a' + 10 : c >= 'A' and c <= 'F' ? c - 'A' + 10 : 16;
+				if (d == 16) {
+					return false;
+				}
+				u = 16 * u + d;
+			}
+			v.drop(4);
 
-		auto fraction = [](char_view<T>& v) {
-			double x = 0, e = 0.1;
+			return true;
+		};
 
-			while (v and ::isdigit(*v)) {
-				x += (*v - '0') * e;
-				e /= 10;
+		while (v) {
+			const T* b = v.buf;
+			while (v and *v != '\\') {
 				++v;
 			}
+			s.append(b, v.buf);
+			if (!v) {
+				break;
+			}
+			++v; // backslash
+			if (!v) {
+				s.push_back('\\');
+				break;
+			}
+			T c = *v;
+			++v;
+			switch (c) {
+			case 'b': s.push_back('\b'); break;
+			case 'f': s.push_back('\f'); break;
+			case 'n': s.push_back('\n'); break;
+			case 'r': s.push_back('\r'); break;
+			case 't': s.push_back('\t'); break;
+			case 'u': {
+				unsigned u, w;
+				if (!hex(v, u)) {
+					s.push_back('\\');
+					s.push_back('u');
+					break;
+				}
+				// surrogate pair
+				if (u >= 0xD800 and u < 0xDC00 and v.len >= 6 and v.buf[0] == '\\' and v.buf[1] == 'u') {
+					char_view<T> v_(v.buf + 2, v.len - 2);
+					if (hex(v_, w) and w >= 0xDC00 and w < 0xE000) {
+						u = 0x10000 + ((u - 0xD800) << 10) + (w - 0xDC00);
+						v = v_;
+					}
+				}
+				if (u < 0x80) {
+					s.push_back(static_cast<char>(u));
+				}
+				else if (u < 0x800) {
+					s.push_back(static_cast<char>(0xC0 | (u >> 6)));
+					s.push_back(static_cast<char>(0x80 | (u & 0x3F)));
+				}
+				else if (u < 0x10000) {
+					s.push_back(static_cast<char>(0xE0 | (u >> 12)));
+					s.push_back(static_cast<char>(0x80 | ((u >> 6) & 0x3F)));
+					s.push_back(static_cast<char>(0x80 | (u & 0x3F)));
+				}
+				else {
+					s.push_back(static_cast<char>(0xF0 | (u >> 18)));
+					s.push_back(static_cast<char>(0x80 | ((u >> 12) & 0x3F)));
+					s.push_back(static_cast<char>(0x80 | ((u >> 6) & 0x3F)));
+					s.push_back(static_cast<char>(0x80 | (u & 0x3F)));
+				}
+				break;
+			}
+			default: // '"', '\\', '/' and invalid escapes
+				if (c != '"' and c != '\\' and c != '/') {
+					s.push_back('\\');
+				}
+				s.push_back(static_cast<char>(c));
+			}
+		}
 
-			return x;
-		};
-		auto integer = [](char_view<T>& v) {
-			double x = 0;
+		return s;
+	}
 
-			while (v and ::isdigit(*v)) {
+	// 10^n without std::pow so it can be used in constant expressions
+	constexpr double pow10(int n)
+	{
+		double x = 1, p = 10;
+
+		for (int m = n < 0 ? -n : n; m; m >>= 1) {
+			if (m & 1) {
+				x *= p;
+			}
+			p *= p;
+		}
+
+		return x;
+	}
+
+	template<class T, class Number>
+	constexpr Number parse_number(char_view<T>& v)
+	{
+		FMS_PHASE(number);
+		constexpr double NaN = std::numeric_limits<double>::quiet_NaN();
+		double sgn = 1, x = NaN;
+		int digits = 0; // fractional digits
+
+		// accumulate digits into x
+		auto integer = [](char_view<T>& v, double x, int& n) {
+			while (v and is_digit(*v)) {
 				x = 10 * x + (*v - '0');
 				++v;
+				++n;
 			}
 
 			return x;
@@ -108,23 +221,24 @@ namespace fms::json {
 			v.eat('-');
 		}
 
+		int n = 0;
 		if (v and *v == '0') { // fraction
 			v.drop(1);
-			x = sgn * 0; // so "-0" is -0
+			x = 0;
 			if (v.eat('.')) {
-				x = fraction(v);
+				x = integer(v, 0, digits);
 			}
 		}
 		else if (v and *v >= '1' and *v <= '9') {
-			x = integer(v);
+			x = integer(v, 0, n);
 			if (v and *v == '.') {
 				v.drop(1);
-				x += fraction(v);
+				x = integer(v, x, digits);
 			}
 		}
 		// exponent
-		double e = 1;
-		if (v and ::toupper(*v) == 'E') {
+		int e = 1;
+		if (v and (*v == 'e' or *v == 'E')) {
 			v.drop(1);
 			if (v and *v == '+') {
 				v.drop(1);
@@ -134,91 +248,175 @@ namespace fms::json {
 				v.drop(1);
 			}
 		}
-		e *= integer(v);
+		e = e * static_cast<int>(std::min(integer(v, 0, n), 9999.)) - digits;
+		// divide by exact powers of 10 so "1.25E-2" == 1.25E-2
+		// zero stays zero since 0 * inf is NaN
+		if (x != 0) {
+			x = e < 0 ? x / pow10(e) : x * pow10(e);
+		}
 
-		return Number(v and !::isspace(*v) ? NaN : sgn * x * std::pow(10, e));
+		return Number(!is_terminator(v) ? NaN : sgn * x); // "-0" is -0
 	}
 
-	template<class T, class String, class Value>
+	// advance v past one JSON value without building it or return false
+	// nested values are matched by brackets, not validated
+	template<class T>
+	constexpr bool skip_value(char_view<T>& v)
+	{
+		auto skip_string = [](char_view<T>& v) {
+			++v; // opening quote
+			while (v and *v != '"') {
+				if (*v == '\\') {
+					++v;
+				}
+				++v;
+			}
+
+			return v.eat('"');
+		};
+
+		if (!v.wstrim()) {
+			return false;
+		}
+		if (*v == '"') {
+			return skip_string(v);
+		}
+		if (*v == '{' or *v == '[') {
+			int level = 0;
+			do {
+				if (*v == '"') {
+					if (!skip_string(v)) {
+						return false;
+					}
+					continue;
+				}
+				if (*v == '{' or *v == '[') {
+					++level;
+				}
+				else if (*v == '}' or *v == ']') {
+					--level;
+				}
+				++v;
+			} while (v and level);
+
+			return level == 0;
+		}
+		if (is_terminator(v)) {
+			return false;
+		}
+		while (!is_terminator(v)) {
+			++v;
+		}
+
+		return true;
+	}
+
+	template<class T, class Value, class Trace = trace::none>
+	inline Value parse_value(char_view<T>& v);
+
+	template<class T, class String, class Value, class Trace = trace::none>
 	inline std::pair<String, Value> parse_member(char_view<T>& v)
 	{
 		String key;
 		Value val;
 
-		v.wstrim();
-		key = parse_string(v);
+		if (v.wstrim().eat('"')) {
+			key = parse_string<T, String>(v);
+			v.eat('"');
+		}
 		if (v.wstrim() and v.eat(':')) {
-			v.wstrim();
-			val = parse_value(v);
+			val = parse_value<T, Value, Trace>(v);
 		}
 
 		return { key, val };
 	}
 
-	template<class T, class Object>
+	// members after the opening brace
+	template<class T, class Object, class Trace = trace::none>
 	inline Object parse_object(char_view<T>& v)
 	{
+		using String = std::remove_const_t<typename Object::value_type::first_type>;
+		using Value = typename Object::value_type::second_type;
 		Object o;
 
-		o.insert(parse_member(v));
-		while (v.wstrim() and *v == ',') {
-			v.eat(',');
-			o.insert(parse_member(v));
+		if (v.wstrim() and *v != '}') {
+			o.insert(parse_member<T, String, Value, Trace>(v));
+			while (v.wstrim() and v.eat(',')) {
+				o.insert(parse_member<T, String, Value, Trace>(v));
+			}
 		}
 
 		return o;
 	}
-	template<class T, class Array>
+	// elements after the opening bracket
+	template<class T, class Array, class Trace = trace::none>
 	inline Array parse_array(char_view<T>& v)
 	{
+		using Value = typename Array::value_type;
 		Array a;
 
-		v.wstrim();
-		if (v) {
-			a.push_back(parse_value(v));
+		if (v.wstrim() and *v != ']') {
+			a.push_back(parse_value<T, Value, Trace>(v));
 			while (v.wstrim() and v.eat(',')) {
-				a.push_back(parse_value(v));
+				a.push_back(parse_value<T, Value, Trace>(v));
 			}
 		}
 
 		return a;
 	}
 
-	template<class T, class Value>
+	// Value provides object_type, array_type, string_type, and number_type.
+	// If number_type has a static parse(v) it is used instead of parse_number.
+	// Trace is a policy from fms_trace.h called with each value parsed.
+	template<class T, class Value, class Trace>
 	inline Value parse_value(char_view<T>& v)
 	{
+		FMS_PHASE(dom);
+		using Number = typename Value::number_type;
 		Value val;
 
 		v.wstrim();
 		if (v) {
 			if (*v == '{') {
+				Trace::emit(trace::object, v.buf);
 				v.eat('{');
-				val = parse_object(v);
+				val = Value(parse_object<T, typename Value::object_type, Trace>(v));
 				v.wstrim();
 				v.eat('}');
+				Trace::emit(trace::object_end, v.buf);
 			}
 			else if (*v == '[') {
+				Trace::emit(trace::array, v.buf);
 				v.eat('[');
-				val = parse_array(v);
+				val = Value(parse_array<T, typename Value::array_type, Trace>(v));
 				v.wstrim();
 				v.eat(']');
+				Trace::emit(trace::array_end, v.buf);
 			}
 			else if (*v == '"') {
 				v.eat('"');
-				val = parse_string(v);
+				val = Value(parse_string<T, typename Value::string_type>(v));
 				v.eat('"');
+				Trace::emit(trace::string, v.buf);
 			}
 			else if (is_null(v)) {
-				; // default object
+				Trace::emit(trace::literal, v.buf); // default object
 			}
 			else if (is_true(v)) {
-				val = true;
+				val = Value(true);
+				Trace::emit(trace::literal, v.buf);
 			}
 			else if (is_false(v)) {
-				val = false;
+				val = Value(false);
+				Trace::emit(trace::literal, v.buf);
+			}
+			else if constexpr (requires { Number::parse(v); }) {
+				val = Value(Number::parse(v));
+				Trace::emit(trace::number, v.buf);
 			}
 			else {
-				val = parse_number(v);
+				val = Value(parse_number<T, Number>(v));
+				Trace::emit(trace::number, v.buf);
 			}
 		}
 		// ensure(!v.wstrim());
@@ -239,7 +437,7 @@ namespace fms::json {
 			wchar_t null[] = L"Null";
 			auto v = char_view(null);
 			assert(!is_null(v));
-			//assert(v.equal(null));
+			assert(v.equal(null));
 		}
 		{
 			wchar_t null[] = L"null foo";
@@ -251,7 +449,17 @@ namespace fms::json {
 			wchar_t null[] = L"nullfoo";
 			auto v = char_view(null);
 			assert(!is_null(v));
-			//assert(v.equal(L"nullfoo"));
+			assert(v.equal(L"nullfoo"));
+		}
+		{
+			char_view v("true,false]");
+			assert(is_true(v));
+			assert(v.eat(','));
+			assert(is_false(v));
+			assert(v.equal("]"));
+		}
+		{
+			static_assert(is_null(char_view("null").wstrim()));
 		}
 
 		return 0;
@@ -289,6 +497,22 @@ namespace fms::json {
 			assert(1 == x);
 			assert(v.equal(" x"));
 		}
+		{
+			char_view v("-1.5e1,");
+			assert(-15 == (parse_number<const char, double>(v)));
+			assert(v.equal(","));
+		}
+		{
+			static_assert(-0.125 == parse_number<const char, double>(char_view("-125e-3").wstrim()));
+			static_assert(1.25E-2 == parse_number<const char, double>(char_view("1.25E-2").wstrim()));
+		}
+		{
+			char_view v("0e400");
+			assert(0 == (parse_number<const char, double>(v)));
+			char_view w("-0.0e999");
+			double x = parse_number<const char, double>(w);
+			assert(x == 0 and std::signbit(x));
+		}
 
 		return 0;
 	}
@@ -296,6 +520,35 @@ namespace fms::json {
 #undef PARSE_NUMBER_TEST
 #endif // _DEBUG
 
+#ifdef _DEBUG
+	inline int skip_value_test()
+	{
+		{
+			char_view v(" {\"a\": [1, \"]}\\\"\"], \"b\": {}} , 2");
+			assert(skip_value(v));
+			assert(v.equal(" , 2"));
+			assert(v.eat(" , "));
+			assert(skip_value(v));
+			assert(!v);
+		}
+		{
+			char_view v("[1, [2]");
+			assert(!skip_value(v));
+		}
+		{
+			char_view v("\"a\\\\\",");
+			assert(skip_value(v));
+			assert(v.equal(","));
+		}
+		{
+			char_view v(", 1");
+			assert(!skip_value(v));
+		}
+
+		return 0;
+	}
+#endif // _DEBUG
+
 #ifdef _DEBUG
 	inline int parse_string_test()
 	{
@@ -324,6 +577,11 @@ namespace fms::json {
 			assert(v.equal("\"\to\""));
 			assert(s==("f"));
 		}
+		{
+			std::string s;
+			unescape(char_view<const char>("a\\\"b\\\\c\\/\\n\\u00e9\\ud83d\\ude00\\x"), s);
+			assert(s == "a\"b\\c/\n\xc3\xa9\xf0\x9f\x98\x80\\x");
+		}
 		/*
 		{
 			value o;
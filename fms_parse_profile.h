@@ -0,0 +1,382 @@
+// fms_parse_profile.h - one pass column statistics of delimited text
+#ifndef FMS_PARSE_PROFILE_INCLUDED
+#define FMS_PARSE_PROFILE_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <charconv>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "fms_json_csv.h"
+#include "fms_parse_split.h"
+#include "fms_progress.h"
+#include "fms_sketch.h"
+
+namespace fms::parse {
+
+	// statistics of the fields of one column
+	struct column_profile {
+		std::string name;
+		std::uint64_t count = 0; // fields, missing ones are empty
+		std::uint64_t empty = 0;
+		std::uint64_t nulls = 0; // unquoted null, NULL, or \N
+		std::uint64_t numbers = 0; // unquoted decimal numbers
+		double min = std::numeric_limits<double>::infinity();
+		double max = -std::numeric_limits<double>::infinity();
+		hyperloglog<> distinct; // of non-empty non-null values
+		kll quantiles; // of numbers
+		heavy_hitters top;
+
+		column_profile(const std::string& name, std::size_t k = 64)
+			: name(name), top(k)
+		{ }
+
+		void merge(const column_profile& c)
+		{
+			count += c.count;
+			empty += c.empty;
+			nulls += c.nulls;
+			numbers += c.numbers;
+			min = std::min(min, c.min);
+			max = std::max(max, c.max);
+			distinct.merge(c.distinct);
+			quantiles.merge(c.quantiles);
+			top.merge(c.top);
+		}
+	};
+
+	/// <summary>
+	/// Profile every column of delimited text while splitting it
+	/// </summary>
+	/// <remarks>
+	/// Records are split with parse::split and fields with parse::splitable as in
+	/// json::csv_to_json, and each field updates its column as it is found, so a
+	/// profile takes one pass. Each column counts empty, null, and numeric
+	/// fields with the numeric min and max, and optionally keeps a HyperLogLog
+	/// distinct count, KLL quantiles of numbers, and Misra-Gries heavy hitters.
+	/// Quoted fields have their outer quotes removed and are never numbers.
+	/// Profiles of blocks on different threads are merged in order.
+	/// </remarks>
+	class profile {
+		char c, l, r, e;
+		unsigned sketches;
+		std::size_t k;
+		std::vector<column_profile> cols;
+
+		void field(column_profile& col, char_view<const char> f) const
+		{
+			++col.count;
+			const bool quoted = l and f.len >= 2 and f.buf[0] == l and f.buf[f.len - 1] == r;
+			if (quoted) {
+				f = char_view<const char>(f.buf + 1, f.len - 2);
+			}
+			if (!f) {
+				++col.empty;
+
+				return;
+			}
+			if (!quoted and (f.equal("null") or f.equal("NULL") or f.equal("\\N"))) {
+				++col.nulls;
+
+				return;
+			}
+			if (sketches & (distinct | heavy)) {
+				const std::string_view s(f.buf, f.len);
+				const std::uint64_t h = sketch_hash(s); // once for both
+				if (sketches & distinct) {
+					col.distinct.add(h);
+				}
+				if (sketches & heavy) {
+					col.top.add(h, s);
+				}
+			}
+			// a digit after any sign and point, so not nan or inf
+			const char* x = f.buf;
+			x += x < f.buf + f.len and *x == '-';
+			x += x < f.buf + f.len and *x == '.';
+			if (!quoted and x < f.buf + f.len and *x >= '0' and *x <= '9') {
+				double d;
+				auto [p, ec] = std::from_chars(f.buf, f.buf + f.len, d);
+				if (ec == std::errc() and p == f.buf + f.len) {
+					++col.numbers;
+					col.min = std::min(col.min, d);
+					col.max = std::max(col.max, d);
+					if (sketches & quantile) {
+						col.quantiles.add(d);
+					}
+				}
+			}
+		}
+
+		// records of v counted in b
+		void lines(char_view<const char> v, progress::batch& b)
+		{
+			const char* p = v.buf;
+			while (v) {
+				auto rec = split<const char>(v, '\n', l, r, e);
+				if (rec.is_error()) {
+					error = "parse::profile: unbalanced quotes";
+					b.error(v.buf + v.len - p, v.buf + v.len);
+
+					return;
+				}
+				if (rec.trimws()) {
+					record(rec);
+					b.record(v.buf - p, cols.size(), v.buf);
+					p = v.buf;
+				}
+			}
+			b.skip(v.buf - p);
+		}
+
+	public:
+		enum sketch : unsigned {
+			distinct = 1,
+			quantile = 2,
+			heavy = 4,
+			all = 7,
+		};
+		std::size_t records = 0;
+		const char* error = nullptr;
+		progress* counters = nullptr; // live counts for other threads
+
+		// k is the number of heavy hitter counters per column
+		profile(char c = ',', char l = '"', char r = '"', char e = 0, unsigned sketches = all, std::size_t k = 64)
+			: c(c), l(l), r(r), e(e), sketches(sketches), k(k)
+		{ }
+
+		int size() const
+		{
+			return static_cast<int>(cols.size());
+		}
+		const column_profile& operator[](int i) const
+		{
+			return cols[i];
+		}
+		// same columns and options with nothing counted
+		profile schema() const
+		{
+			profile p(c, l, r, e, sketches, k);
+			for (const auto& col : cols) {
+				p.cols.emplace_back(col.name, k);
+			}
+
+			return p;
+		}
+
+		// column names from the first record, advance v
+		bool header(char_view<const char>& v)
+		{
+			cols.clear();
+			auto h = split<const char>(v, '\n', l, r, e);
+			if (h.is_error()) {
+				error = "parse::profile: unbalanced quotes in header";
+
+				return false;
+			}
+			for (auto f : splitable<const char>(h.trimws(), c, l, r, e)) {
+				if (l and f.len >= 2 and f.buf[0] == l and f.buf[f.len - 1] == r) {
+					f = char_view<const char>(f.buf + 1, f.len - 2);
+				}
+				cols.emplace_back(std::string(f.buf, f.len), k);
+			}
+
+			return !cols.empty();
+		}
+
+		// add one record, columns past the header are named by index
+		void record(char_view<const char> rec)
+		{
+			std::size_t i = 0;
+			for (auto f : splitable<const char>(rec, c, l, r, e)) {
+				if (i == cols.size()) {
+					cols.emplace_back(std::to_string(i), k);
+					cols.back().count = cols.back().empty = records; // missing before
+				}
+				field(cols[i++], f);
+			}
+			for (; i < cols.size(); ++i) {
+				field(cols[i], char_view<const char>());
+			}
+			++records;
+		}
+
+		// add the records of v after the header
+		profile& operator()(char_view<const char> v)
+		{
+			progress::batch b(counters, v.buf);
+			lines(v, b);
+
+			return *this;
+		}
+
+		// add the counts of p for the same columns in order
+		profile& merge(const profile& p)
+		{
+			for (std::size_t i = 0; i < p.cols.size(); ++i) {
+				if (i == cols.size()) {
+					cols.emplace_back(p.cols[i].name, k);
+					cols.back().count = cols.back().empty = records;
+				}
+				cols[i].merge(p.cols[i]);
+			}
+			for (std::size_t i = p.cols.size(); i < cols.size(); ++i) {
+				cols[i].count += p.records;
+				cols[i].empty += p.records;
+			}
+			records += p.records;
+			if (p.error and !error) {
+				error = p.error;
+			}
+
+			return *this;
+		}
+
+		// profile blocks of records on n threads and merge them
+		// quotes must be the same character for blocks to be found
+		profile& operator()(char_view<const char> v, unsigned n)
+		{
+			if (n <= 1 or l != r) {
+				return operator()(v);
+			}
+
+			auto bs = json::blocks(v, n, l);
+			std::vector<profile> ps(bs.size(), schema());
+			std::vector<std::thread> ts;
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts.emplace_back([&, i]() {
+					progress::batch b(counters);
+					ps[i].lines(bs[i], b);
+				});
+			}
+			for (std::size_t i = 0; i < bs.size(); ++i) {
+				ts[i].join();
+				merge(ps[i]);
+				if (counters) {
+					counters->offset(bs[i].buf + bs[i].len - v.buf);
+				}
+			}
+
+			return *this;
+		}
+
+		// array of one object per column
+		template<class Buffer>
+		void json(Buffer& out, std::size_t top = 5) const
+		{
+			auto sv = [](const std::string& s) { return char_view<const char>(s.data(), static_cast<long>(s.size())); };
+			fms::json::writer<Buffer> w(out);
+			w.begin_array();
+			for (const auto& col : cols) {
+				w.begin_object()
+					.key("column").value(sv(col.name))
+					.key("count").value(col.count)
+					.key("empty").value(col.empty)
+					.key("null").value(col.nulls)
+					.key("number").value(col.numbers);
+				if (col.numbers) {
+					w.key("min").value(col.min).key("max").value(col.max);
+				}
+				if (sketches & distinct) {
+					w.key("distinct").value(std::round(col.distinct.estimate()));
+				}
+				if ((sketches & quantile) and col.numbers) {
+					static const std::pair<const char*, double> qs[] = { { "p01", .01 }, { "p25", .25 }, { "p50", .5 }, { "p75", .75 }, { "p99", .99 } };
+					w.key("quantiles").begin_object();
+					for (auto [name, q] : qs) {
+						w.key(name).value(col.quantiles.quantile(q));
+					}
+					w.end_object();
+				}
+				if (sketches & heavy) {
+					w.key("top").begin_array();
+					for (const auto& [s, m] : col.top.top(top)) {
+						w.begin_array().value(sv(s)).value(m).end_array();
+					}
+					w.end_array();
+				}
+				w.end_object();
+			}
+			w.end_array();
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			static constexpr char csv[] = "id,sym,px,note\n"
+				"1,IBM,10.5,\"a, b\"\n"
+				"2,IBM,,null\n"
+				"3,\"MSFT\",-2e1\n"
+				"\n"
+				"4,AAPL,x,\"\",extra\n";
+			{
+				profile p;
+				char_view<const char> v(csv);
+				assert(p.header(v));
+				p(v);
+				assert(!p.error and p.records == 4 and p.size() == 5);
+				const auto& id = p[0];
+				assert(id.name == "id" and id.count == 4 and id.numbers == 4 and id.min == 1 and id.max == 4);
+				assert(std::round(id.distinct.estimate()) == 4);
+				assert(id.quantiles.quantile(.5) == 2);
+				const auto& sym = p[1];
+				assert(sym.numbers == 0 and std::round(sym.distinct.estimate()) == 3);
+				assert(sym.top.top(1)[0].first == "IBM" and sym.top.top(1)[0].second == 2);
+				const auto& px = p[2];
+				assert(px.empty == 1 and px.numbers == 2 and px.min == -20 and px.max == 10.5);
+				const auto& note = p[3];
+				assert(note.name == "note" and note.empty == 2 and note.nulls == 1);
+				assert(note.top.top(1)[0].first == "a, b");
+				assert(p[4].name == "4" and p[4].count == 4 and p[4].empty == 3);
+
+				std::string s;
+				p.json(s, 1);
+				assert(s.starts_with(R"([{"column":"id","count":4,"empty":0,"null":0,"number":4,"min":1,"max":4,"distinct":4,"quantiles":{"p01":1,)"));
+				assert(s.find(R"("top":[["IBM",2]])") != std::string::npos);
+			}
+			{
+				// not numbers though from_chars takes them
+				profile p;
+				char_view<const char> v("x\n-nan\n-inf\nnan\ninf\n-\n-.5\n1\n");
+				assert(p.header(v));
+				p(v);
+				assert(p.records == 7 and p[0].numbers == 2 and p[0].min == -.5 and p[0].max == 1);
+				assert(p[0].quantiles.count() == 2);
+			}
+			{
+				std::string text = "a,b\n";
+				for (int i = 0; i < 10000; ++i) {
+					text += std::to_string(i % 100) + ",\"" + std::to_string(i) + "\"\n";
+				}
+				char_view<const char> v(text.data(), static_cast<long>(text.size()));
+				profile p, q;
+				assert(p.header(v));
+				q = p.schema();
+				p(v);
+				progress c;
+				q.counters = &c;
+				q(v, 4);
+				assert(q.records == 10000 and q.records == p.records);
+				auto k = c.read();
+				assert(k.records == 10000 and k.fields == 20000 and k.errors == 0);
+				assert(k.bytes == static_cast<std::size_t>(v.len) and k.offset == k.bytes);
+				for (int i = 0; i < 2; ++i) {
+					assert(q[i].count == p[i].count and q[i].numbers == p[i].numbers);
+					assert(q[i].distinct.estimate() == p[i].distinct.estimate());
+				}
+				assert(std::fabs(q[0].distinct.estimate() - 100) < 2);
+				assert(q[1].numbers == 0);
+				assert(std::fabs(q[0].quantiles.quantile(.5) - 50) <= 2);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::parse
+
+#endif // FMS_PARSE_PROFILE_INCLUDED
@@ -0,0 +1,261 @@
+// fms_parse_sample.h - uniform random sample of records without reading all of them
+#ifndef FMS_PARSE_SAMPLE_INCLUDED
+#define FMS_PARSE_SAMPLE_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#include <string>
+#include <string_view>
+#endif
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "fms_char_view.h"
+
+namespace fms::parse {
+
+	/// <summary>
+	/// Uniform random sample of the newline terminated records of a view
+	/// </summary>
+	/// <remarks>
+	/// Each draw picks a random byte offset and returns the record containing it,
+	/// so only the pages around the offsets are read and a sample of a mapped
+	/// file of any size takes milliseconds.
+	/// Long records are more likely to contain a random offset, so a record of
+	/// length L with its newline is kept with probability m/L, making every
+	/// record at least m long equally likely. The default m = 2 is the shortest
+	/// non-empty record, so the sample is uniform, and about mean L/m draws are
+	/// made per record kept. Pass a larger m when records are known to be at
+	/// least that long to take fewer draws. Shorter records are under-sampled.
+	/// With quote q = 0, e.g. NDJSON, every newline ends a record. Otherwise
+	/// newlines between quotes do not, and the quote state at the offset is
+	/// found by scanning forward to the first quote next to a delimiter or
+	/// newline, which shows whether it opens or closes a field. After quiet
+	/// newlines without a quote, e.g. CSV with nothing quoted, the scan is taken
+	/// to be outside quotes, and if nothing is known within window bytes the
+	/// offset is taken to be outside quotes.
+	/// The view should not include a header.
+	/// </remarks>
+	class sampler {
+		char_view<const char> v;
+		char q, c;
+		std::mt19937_64 r;
+		long shortest; // acceptance length
+		double draws = 0; // expected draws per record kept from the pilot
+
+		bool end(long i) const
+		{
+			return i < 0 or i >= v.len or v.buf[i] == c or v.buf[i] == '\n' or v.buf[i] == '\r';
+		}
+
+		// start of the first record after the one containing offset i
+		long next(long i) const
+		{
+			const long e = std::min(v.len, i + window);
+			int parity = 0; // quotes since i
+			long nl[2] = { -1, -1 }; // first newline outside quotes if i is outside or inside
+			int inside = q ? -1 : 0; // quote state at i when known
+			int lines = 0; // newlines since the last quote
+			for (long p = i; p < e; ++p) {
+				const char x = v.buf[p];
+				if (x == '\n') {
+					if (inside >= 0 and (inside ^ parity) == 0) {
+						return p + 1;
+					}
+					if (nl[parity] < 0) {
+						nl[parity] = p + 1;
+					}
+					if (inside < 0 and ++lines == quiet) {
+						inside = parity; // outside here
+
+						return nl[inside];
+					}
+				}
+				else if (q and x == q) {
+					lines = 0;
+					if (inside < 0 and p + 1 < v.len and v.buf[p + 1] == q) {
+						++p; // escaped quote or empty field, no information
+						continue;
+					}
+					if (inside < 0 and end(p - 1) and !end(p + 1)) {
+						inside = parity; // opens a field so was outside
+						if (nl[inside] >= 0) {
+							return nl[inside];
+						}
+					}
+					else if (inside < 0 and end(p + 1) and !end(p - 1)) {
+						inside = parity ^ 1; // closes a field so was inside
+						if (nl[inside] >= 0) {
+							return nl[inside];
+						}
+					}
+					parity ^= 1;
+				}
+			}
+			return nl[0] >= 0 ? nl[0] : e;
+		}
+		// start of the record ending just before start b
+		long previous(long b) const
+		{
+			int parity = 0; // b is outside quotes
+			for (long p = b - 2; p >= 0; --p) {
+				if (v.buf[p] == '\n' and parity == 0) {
+					return p + 1;
+				}
+				if (q and v.buf[p] == q) {
+					parity ^= 1;
+				}
+			}
+
+			return 0;
+		}
+
+	public:
+		static constexpr long window = 1 << 16; // most bytes to look for quotes
+		static constexpr int quiet = 8; // newlines without a quote to be outside quotes
+		static constexpr int pilot = 64; // draws to estimate the mean record length
+
+		// records are at least shortest bytes long including the newline
+		sampler(char_view<const char> v, char q = 0, char c = ',', std::uint64_t seed = std::random_device{}(), long shortest = 2)
+			: v(v), q(q), c(c), r(seed), shortest(std::max(shortest, 1L))
+		{ }
+
+		// record containing offset i and its length with the newline
+		char_view<const char> record(long i, long* len = nullptr) const
+		{
+			long e = v.len ? next(i) : 0;
+			long b = previous(e);
+			if (len) {
+				*len = e - b;
+			}
+			while (e > b and (v.buf[e - 1] == '\n' or v.buf[e - 1] == '\r')) {
+				--e;
+			}
+
+			return char_view<const char>(v.buf + b, e - b);
+		}
+
+		// k distinct non-empty records in view order, fewer if there are not that many
+		std::vector<char_view<const char>> operator()(std::size_t k)
+		{
+			std::vector<char_view<const char>> s;
+			if (v.len <= 0 or k == 0) {
+				return s;
+			}
+			std::uniform_int_distribution<long> offset(0, v.len - 1);
+			if (!draws) {
+				// draws are length biased so the mean of 1/L estimates 1/mean L
+				double inverse = 0;
+				for (int i = 0; i < pilot; ++i) {
+					long len;
+					record(offset(r), &len);
+					inverse += 1. / std::max(len, 1L);
+				}
+				draws = std::max(1., pilot / inverse / shortest);
+			}
+			std::vector<const char*> seen;
+			const double limit = (64. * k + 1024) * draws; // in case there are fewer than k records
+			for (double n = 0; s.size() < k and n < limit; ++n) {
+				long len;
+				auto x = record(offset(r), &len);
+				if (!x or (len > shortest and static_cast<long>(r() % static_cast<std::uint64_t>(len)) >= shortest)) {
+					continue;
+				}
+				auto i = std::lower_bound(seen.begin(), seen.end(), x.buf);
+				if (i != seen.end() and *i == x.buf) {
+					continue;
+				}
+				seen.insert(i, x.buf);
+				s.push_back(x);
+			}
+			std::sort(s.begin(), s.end(), [](const auto& a, const auto& b) { return a.buf < b.buf; });
+
+			return s;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				char_view<const char> v("{\"a\": 1}\n{\"a\": 22}\n\n{\"a\": 333}");
+				sampler s(v, 0, ',', 1);
+				assert(s.record(0).equal("{\"a\": 1}"));
+				assert(s.record(8).equal("{\"a\": 1}"));
+				assert(s.record(9).equal("{\"a\": 22}"));
+				assert(s.record(19).len == 0);
+				assert(s.record(v.len - 1).equal("{\"a\": 333}"));
+				auto x = s(10);
+				assert(x.size() == 3);
+				assert(x[0].equal("{\"a\": 1}") and x[2].equal("{\"a\": 333}"));
+			}
+			{
+				char_view<const char> v("a,\"b\nc\",d\r\ne,\"f,\"\"g\nh\"\"\",h\n");
+				sampler s(v, '"', ',', 1);
+				for (long i = 0; i < 11; ++i) {
+					assert(s.record(i).equal("a,\"b\nc\",d"));
+				}
+				for (long i = 11; i < v.len; ++i) {
+					assert(s.record(i).equal("e,\"f,\"\"g\nh\"\"\",h"));
+				}
+			}
+			{
+				// nothing quoted
+				std::string text;
+				for (int i = 0; i < 100000; ++i) {
+					text += std::to_string(i) + ",IBM,101.25\n";
+				}
+				char_view<const char> v(text.data(), static_cast<long>(text.size()));
+				sampler s(v, '"', ',', 1);
+				assert(s.record(0).equal("0,IBM,101.25"));
+				for (auto x : s(1000)) {
+					assert((x.buf == v.buf or x.buf[-1] == '\n') and x.buf[x.len] == '\n');
+					assert(std::string_view(x.buf, x.len).ends_with(",IBM,101.25"));
+				}
+			}
+			{
+				// short and long records alternate, a uniform sample is half long
+				std::string text;
+				for (int i = 0; i < 1000; ++i) {
+					text += i % 2 ? "\"x\nyz\",\"long long long long long long long long long long long long\"\n" : "1,2\n";
+				}
+				char_view<const char> v(text.data(), static_cast<long>(text.size()));
+				std::size_t n = 0, longs = 0;
+				for (std::uint64_t seed = 0; seed < 20; ++seed) {
+					sampler s(v, '"', ',', seed);
+					for (auto x : s(100)) {
+						assert(x.equal("1,2") or x.len > 60);
+						assert(x.buf == text.data() or x.buf[-1] == '\n');
+						++n;
+						longs += x.len > 60;
+					}
+				}
+				assert(n == 2000);
+				assert(longs > 900 and longs < 1100);
+			}
+			{
+				// one record in ten is short, so never seen in a small pilot
+				std::string text;
+				for (int i = 0; i < 10000; ++i) {
+					text += i % 10 ? std::string(199, 'x') + "\n" : "abc\n";
+				}
+				char_view<const char> v(text.data(), static_cast<long>(text.size()));
+				std::size_t n = 0, shorts = 0;
+				for (std::uint64_t seed = 0; seed < 20; ++seed) {
+					sampler s(v, 0, ',', seed);
+					for (auto x : s(100)) {
+						++n;
+						shorts += x.len == 3;
+					}
+				}
+				assert(n == 2000);
+				assert(shorts > 140 and shorts < 260);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::parse
+
+#endif // FMS_PARSE_SAMPLE_INCLUDED
@@ -1,8 +1,10 @@
 // fms_parse_split.h - split iterator
-#pragma once
+#ifndef FMS_PARSE_SPLIT_INCLUDED
+#define FMS_PARSE_SPLIT_INCLUDED
 #include <compare>
 #include <iterator>
 #include "fms_char_view.h"
+#include "fms_trace.h"
 
 namespace fms::parse {
 
@@ -10,15 +12,17 @@ namespace fms::parse {
 	// l, r, e are left, right, and escape characters
 	// if l is encountered then parse until r is encountered
 	// ignoring c and keeping track of nesting level
-	template<class T>
-	inline char_view<T> split(char_view<T> v, T c, T l, T r, T e = 0)
+	// Trace is a policy from fms_trace.h called at the end of each piece
+	template<class T, class Trace = trace::none>
+	inline char_view<T> split(char_view<T>& v, T c, T l, T r, T e = 0)
 	{
+		FMS_PHASE(scan);
 		char_view<T> v_{ v };
 
 		while (v_ and *v_ and *v_ != c) {
 			if (*v_ == l) {
 				int level = 1;
-				while (++v_ and *v_ and level) {
+				while (level and ++v_ and *v_) {
 					if (*v_ == r) {
 						--level;
 					}
@@ -38,6 +42,9 @@ namespace fms::parse {
 		}
 
 		if (!v_.is_error()) {
+			if (v) {
+				Trace::emit(trace::split, v_.buf);
+			}
 			int n = static_cast<int>(v_.buf - v.buf);
 			std::swap(v.len, v_.len);
 			std::swap(v.buf, v_.buf);
@@ -49,7 +56,7 @@ namespace fms::parse {
 	}
 
 	// split iterator
-	template<class T>
+	template<class T, class Trace = trace::none>
 	class splitable {
 		char_view<T> v, v_;
 		T c, l, r, e;
@@ -58,7 +65,7 @@ namespace fms::parse {
 			if (!std::isspace(l)) {
 				v_.wstrim();
 			}
-			v = split<T>(v_, c, l, r, e);
+			v = split<T, Trace>(v_, c, l, r, e);
 			if (!std::isspace(r)) {
 				v.trimws();
 			}
@@ -86,6 +93,11 @@ namespace fms::parse {
 		{
 			return !!v;
 		}
+		// same field of the same view
+		bool operator==(const splitable& s) const
+		{
+			return v == s.v;
+		}
 
 		auto begin() const
 		{
@@ -100,11 +112,10 @@ namespace fms::parse {
 		{
 			return v;
 		}
+		// empty fields advance too, at the end this is end()
 		splitable& operator++()
 		{
-			if (v) {
-				incr();
-			}
+			incr();
 
 			return *this;
 		}
@@ -173,6 +184,16 @@ namespace fms::parse {
 				++ss;
 				assert(!ss);
 			}
+			{
+				char buf[] = "\"a,b\",\"\",c";
+				char_view v(buf);
+				splitable ss(v, ',', '"', '"');
+				assert((*ss).equal("\"a,b\""));
+				++ss;
+				assert((*ss).equal("\"\""));
+				++ss;
+				assert((*ss).equal("c"));
+			}
 			{
 				// csv parsing
 				char buf[] = "a,b;c,d";
@@ -187,6 +208,21 @@ namespace fms::parse {
 				}
 				assert(s == "a\tb\t\nc\td\t\n");
 			}
+			{
+				char buf[] = "a,bc,d";
+				auto& r = trace::ring::local();
+				r.clear();
+				trace::local::start(buf);
+				int n = 0;
+				for (const auto& f : splitable<char, trace::local>(char_view(buf), ',')) {
+					++n;
+					assert(f.len);
+				}
+				assert(n == 3 and r.size() == 3);
+				assert(r[0].type() == trace::split and r[0].offset() == 1);
+				assert(r[1].offset() == 4 and r[2].offset() == 6);
+				r.clear();
+			}
 
 			return 0;
 		}
@@ -276,11 +312,11 @@ namespace fms::parse {
 			}
 		};
 		// Return finite_iterable of v split by c, l, r, and e.
-		template<class I, class T>
+		template<class I, class U>
 		class spliterable {
 			I buf;
 			int len;
-			T c, l, r, e;
+			U c, l, r, e;
 			
 			I escape(I i)
 			{
@@ -323,7 +359,7 @@ namespace fms::parse {
 		public:
 			using value_type = finite_iterable<I>;
 
-			spliterable(I i, T c, T l, T r, T e)
+			spliterable(I i, U c, U l, U r, U e)
 				: buf(i), len(0), c(c), l(l), r(r), e(e)
 			{ }
 			spliterable(const spliterable&) = default;
@@ -336,3 +372,5 @@ namespace fms::parse {
 	};
 
 } // namespace fms::parse
+
+#endif // FMS_PARSE_SPLIT_INCLUDED
@@ -0,0 +1,384 @@
+// fms_parse_write.h - write delimited text
+#ifndef FMS_PARSE_WRITE_INCLUDED
+#define FMS_PARSE_WRITE_INCLUDED
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
+#include "fms_parse_split.h"
+
+namespace fms::parse {
+
+	// "00" to "99" for formatting two digits at a time
+	inline constexpr char digits2[] =
+		"0001020304050607080910111213141516171819"
+		"2021222324252627282930313233343536373839"
+		"4041424344454647484950515253545556575859"
+		"6061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+
+#if __has_include(<unistd.h>)
+	// buffer that writes to a file descriptor
+	struct fd_buffer {
+		int fd;
+		const char* error = nullptr;
+
+		void append(const char* s, std::size_t n)
+		{
+			while (n and !error) {
+				ssize_t w = ::write(fd, s, n);
+				if (w < 0 and errno == EINTR) {
+					continue; // interrupted by a signal before writing
+				}
+				if (w <= 0) {
+					error = "fms::parse::fd_buffer: write failed";
+				}
+				else {
+					s += w;
+					n -= w;
+				}
+			}
+		}
+	};
+#endif
+
+	/// <summary>
+	/// Write records of delimited text in the dialect read by splitable
+	/// </summary>
+	/// <remarks>
+	/// c is the delimiter, l and r the quotes, and e the escape character.
+	/// Fields containing a delimiter, quote, escape, line break, or leading or
+	/// trailing whitespace are quoted. Inside quotes r and e are preceded by e,
+	/// or r is doubled if there is no escape character as in RFC 4180.
+	/// Buffer needs append(const char*, n), e.g. std::string, win::mem_view<char>
+	/// or fd_buffer. Output is staged in a 64KB chunk and appended when it
+	/// fills, on flush(), or when the writer is destroyed.
+	/// </remarks>
+	template<class Buffer = std::string>
+	class delimited_writer {
+		Buffer& out;
+		std::vector<char> chunk;
+		std::size_t n = 0; // bytes staged in chunk
+		char c, l, r, e;
+		std::string eol;
+		std::uint64_t special[6]; // bytes needing quotes repeated 8 times
+		int nspecial = 0;
+		bool first = true; // no field yet in this record
+
+		template<class Other>
+		friend class delimited_writer;
+
+		void put(const char* s, std::size_t m)
+		{
+			if (n + m > chunk.size()) {
+				flush();
+				if (m > chunk.size()) {
+					out.append(s, m);
+
+					return;
+				}
+			}
+			std::memcpy(chunk.data() + n, s, m);
+			n += m;
+		}
+		void put(char x)
+		{
+			if (n == chunk.size()) {
+				flush();
+			}
+			chunk[n++] = x;
+		}
+		void separate()
+		{
+			if (!first) {
+				put(c);
+			}
+			first = false;
+		}
+
+		// first byte in [b, e_) that is special, checked 8 bytes at a time
+		const char* find_special(const char* b, const char* e_) const
+		{
+			constexpr std::uint64_t ones = 0x0101010101010101, highs = 0x8080808080808080;
+
+			for (; e_ - b >= 8; b += 8) {
+				std::uint64_t w, z = 0;
+				std::memcpy(&w, b, 8);
+				for (int i = 0; i < nspecial; ++i) {
+					std::uint64_t x = w ^ special[i];
+					z |= (x - ones) & ~x & highs;
+				}
+				if (z) {
+					break;
+				}
+			}
+			while (b != e_ and !is_special(*b)) {
+				++b;
+			}
+
+			return b;
+		}
+		bool is_special(char x) const
+		{
+			return x == c or x == '\n' or x == '\r' or (x and (x == l or x == r or x == e));
+		}
+
+	public:
+		std::size_t records = 0; // records ended
+
+		delimited_writer(Buffer& out, char c = ',', char l = '"', char r = '"', char e = 0, const char* eol = "\n")
+			: out(out), chunk(1 << 16), c(c), l(l), r(r), e(e), eol(eol)
+		{
+			for (char x : { c, '\n', '\r', l, r, e }) {
+				if (x and (nspecial == 0 or std::find(special, special + nspecial, 0x0101010101010101 * static_cast<unsigned char>(x)) == special + nspecial)) {
+					special[nspecial++] = 0x0101010101010101 * static_cast<unsigned char>(x);
+				}
+			}
+		}
+		// writer to out with the same dialect as w
+		template<class Other>
+		delimited_writer(Buffer& out, const delimited_writer<Other>& w)
+			: delimited_writer(out, w.c, w.l, w.r, w.e, w.eol.c_str())
+		{ }
+		delimited_writer(const delimited_writer&) = delete;
+		delimited_writer& operator=(const delimited_writer&) = delete;
+		~delimited_writer()
+		{
+			flush();
+		}
+
+		// append staged output to the buffer
+		void flush()
+		{
+			if (n) {
+				out.append(chunk.data(), n);
+				n = 0;
+			}
+		}
+
+		// text field, quoted as needed
+		delimited_writer& field(char_view<const char> s)
+		{
+			const char* b = s.buf;
+			const char* end = s.buf + s.len;
+			const char* p = find_special(b, end);
+
+			separate();
+			if (p == end and !(s.len and (is_space(*b) or is_space(end[-1])))) {
+				put(b, s.len);
+
+				return *this;
+			}
+			if (!l) {
+				// no quotes so escape special characters if possible
+				for (; p != end; p = find_special(b, end)) {
+					put(b, p - b);
+					if (e) {
+						put(e);
+					}
+					put(*p);
+					b = p + 1;
+				}
+				put(b, end - b);
+
+				return *this;
+			}
+
+			put(l);
+			for (; p != end; p = find_special(b, end)) {
+				put(b, p - b);
+				if (*p == r or (e and *p == e)) {
+					put(e ? e : r);
+				}
+				put(*p);
+				b = p + 1;
+			}
+			put(b, end - b);
+			put(r);
+
+			return *this;
+		}
+		delimited_writer& field(const char* s)
+		{
+			return field(char_view<const char>(s, static_cast<long>(std::strlen(s))));
+		}
+		// empty field
+		delimited_writer& field()
+		{
+			separate();
+
+			return *this;
+		}
+		// shortest text that round trips
+		delimited_writer& field(double x)
+		{
+			char buf[32];
+			separate();
+			put(buf, std::to_chars(buf, buf + sizeof(buf), x).ptr - buf);
+
+			return *this;
+		}
+		delimited_writer& field(std::int64_t i)
+		{
+			char buf[24];
+			separate();
+			put(buf, std::to_chars(buf, buf + sizeof(buf), i).ptr - buf);
+
+			return *this;
+		}
+		delimited_writer& field(int i)
+		{
+			return field(static_cast<std::int64_t>(i));
+		}
+
+		// UTC ISO 8601 time yyyy-mm-ddThh:mm:ss[.f]Z with digits fractional digits
+		// nanoseconds outside [0, 1e9) carry into seconds like timespec normalization
+		delimited_writer& timestamp(std::int64_t seconds, long nanoseconds = 0, int digits = 0)
+		{
+			seconds += nanoseconds / 1000000000;
+			nanoseconds %= 1000000000;
+			if (nanoseconds < 0) {
+				nanoseconds += 1000000000;
+				--seconds;
+			}
+			std::int64_t days = seconds / 86400, s = seconds % 86400;
+			if (s < 0) {
+				s += 86400;
+				--days;
+			}
+			// civil from days, http://howardhinnant.github.io/date_algorithms.html
+			days += 719468;
+			const std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+			const unsigned doe = static_cast<unsigned>(days - era * 146097);
+			const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+			const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+			const unsigned mp = (5 * doy + 2) / 153;
+			const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+			const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+			const std::int64_t y = static_cast<std::int64_t>(yoe) + era * 400 + (m <= 2);
+
+			char buf[40];
+			char* p = buf;
+			if (y < 0 or y > 9999) {
+				p = std::to_chars(p, buf + 16, y).ptr;
+			}
+			else {
+				std::memcpy(p, digits2 + 2 * (y / 100), 2);
+				std::memcpy(p + 2, digits2 + 2 * (y % 100), 2);
+				p += 4;
+			}
+			auto two = [&p](char sep, unsigned x) {
+				*p++ = sep;
+				std::memcpy(p, digits2 + 2 * x, 2);
+				p += 2;
+			};
+			two('-', m);
+			two('-', d);
+			two('T', static_cast<unsigned>(s / 3600));
+			two(':', static_cast<unsigned>(s / 60 % 60));
+			two(':', static_cast<unsigned>(s % 60));
+			if (digits > 0) {
+				*p++ = '.';
+				char f[9];
+				long x = nanoseconds;
+				for (int i = 8; i >= 0; --i) {
+					f[i] = static_cast<char>('0' + x % 10);
+					x /= 10;
+				}
+				std::memcpy(p, f, digits > 9 ? 9 : digits);
+				p += digits > 9 ? 9 : digits;
+			}
+			*p++ = 'Z';
+
+			separate();
+			put(buf, p - buf);
+
+			return *this;
+		}
+
+		// text already in this dialect, e.g. records written by another writer
+		delimited_writer& raw(const char* s, std::size_t m)
+		{
+			put(s, m);
+
+			return *this;
+		}
+
+		delimited_writer& end_record()
+		{
+			put(eol.data(), eol.size());
+			first = true;
+			++records;
+
+			return *this;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				std::string buf;
+				{
+					delimited_writer w(buf);
+					w.field("a").field("b,c").field("say \"hi\"").field(1.5).field(-42).end_record();
+					w.field(" pad").field().field("line\nbreak").field("0123456789abcdef,").end_record();
+					assert(w.records == 2);
+					assert(buf.empty()); // staged
+				}
+				assert(buf == "a,\"b,c\",\"say \"\"hi\"\"\",1.5,-42\n\" pad\",,\"line\nbreak\",\"0123456789abcdef,\"\n");
+
+				// read back with split
+				char_view<const char> v(buf.data(), static_cast<long>(buf.size()));
+				auto rec = split<const char>(v, '\n', '"', '"');
+				std::vector<std::string> fs;
+				for (splitable<const char> f(rec, ',', '"', '"'); f; ++f) {
+					fs.emplace_back((*f).buf, (*f).len);
+				}
+				assert(fs.size() == 5);
+				assert(fs[1] == "\"b,c\"");
+				assert(fs[2] == "\"say \"\"hi\"\"\"");
+			}
+			{
+				std::string buf;
+				delimited_writer w(buf, '\t', '"', '"', '\\', "\r\n");
+				w.field("a\tb").field("q\"\\").field("plain").end_record();
+				w.flush();
+				assert(buf == "\"a\tb\"\t\"q\\\"\\\\\"\tplain\r\n");
+			}
+			{
+				std::string buf;
+				delimited_writer w(buf, '|', 0, 0, '\\');
+				w.field("a|b").field("c").end_record();
+				w.flush();
+				assert(buf == "a\\|b|c\n");
+			}
+			{
+				std::string buf;
+				delimited_writer w(buf);
+				w.timestamp(0).timestamp(951782400 + 3723, 123456789, 3).timestamp(-1, 0, 0).timestamp(253402300799).end_record();
+				w.flush();
+				assert(buf == "1970-01-01T00:00:00Z,2000-02-29T01:02:03.123Z,1969-12-31T23:59:59Z,9999-12-31T23:59:59Z\n");
+			}
+			{
+				std::string buf;
+				delimited_writer w(buf);
+				w.timestamp(0, 1500000000, 9).timestamp(0, -1, 9).timestamp(1, -2000000001, 3).end_record();
+				w.flush();
+				assert(buf == "1970-01-01T00:00:01.500000000Z,1969-12-31T23:59:59.999999999Z,1969-12-31T23:59:58.999Z\n");
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms::parse
+
+#endif // FMS_PARSE_WRITE_INCLUDED
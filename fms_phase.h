@@ -0,0 +1,319 @@
+// fms_phase.h - attribute parse cycles to phases
+#ifndef FMS_PHASE_INCLUDED
+#define FMS_PHASE_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#include <string>
+#include <thread>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#if defined(__x86_64__) or defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+// FMS_PHASE(p) is in fms_phase_scope.h so parsers need not include this file.
+
+namespace fms {
+
+	/// <summary>
+	/// Cycles spent in each parse phase excluding the phases it calls
+	/// </summary>
+	/// <remarks>
+	/// Each thread keeps the phase it is in and charges the time stamp counter
+	/// ticks since the last change to it when a phase is entered or left, so
+	/// a phase is not charged for nested phases. Time outside every phase is
+	/// not counted. Counters have one writer and can be read from any thread.
+	/// reset() starts a new epoch and each thread zeroes its own counters when
+	/// it next enters or leaves a phase. Until then snapshot() leaves it out.
+	/// Scopes are constexpr so they can be used in functions the compiler
+	/// evaluates, where they do nothing.
+	/// </remarks>
+	class phase {
+	public:
+		enum id : int {
+			scan, // parse::split
+			trim, // char_view::wstrim and trimws
+			number, // json::parse_number
+			string, // json::parse_string
+			dom, // building json values, mostly allocation
+			phases,
+		};
+
+		static const char* name(int p)
+		{
+			static const char* names[] = { "scan", "trim", "number", "string", "dom" };
+
+			return p >= 0 and p < phases ? names[p] : "";
+		}
+
+		static std::uint64_t now()
+		{
+#if defined(__x86_64__) or defined(_M_X64)
+			return __rdtsc();
+#else
+			return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+		}
+
+	private:
+		struct counters {
+			std::atomic<std::uint64_t> ticks[phases] = {};
+			std::atomic<std::uint64_t> calls[phases] = {};
+			std::atomic<std::uint64_t> epoch; // of the last reset this thread zeroed for
+			int cur = -1; // phase this thread is in
+			std::uint64_t last = 0; // when cur was last charged
+
+			counters();
+			~counters();
+		};
+		struct registry {
+			std::mutex m;
+			std::vector<counters*> threads;
+			std::uint64_t ticks[phases] = {}; // from threads that exited
+			std::uint64_t calls[phases] = {};
+			std::atomic<std::uint64_t> epoch{ 0 }; // number of resets
+		};
+		static registry& global()
+		{
+			static registry r;
+
+			return r;
+		}
+		static counters& local()
+		{
+			static thread_local counters c;
+
+			return c;
+		}
+		// counters of this thread, zeroed if there was a reset
+		static counters& current()
+		{
+			counters& c = local();
+			if (std::uint64_t e = global().epoch.load(std::memory_order_acquire); c.epoch.load(std::memory_order_relaxed) != e) {
+				for (int p = 0; p < phases; ++p) {
+					c.ticks[p].store(0, std::memory_order_relaxed);
+					c.calls[p].store(0, std::memory_order_relaxed);
+				}
+				c.epoch.store(e, std::memory_order_release);
+			}
+
+			return c;
+		}
+		// only this thread writes so no read-modify-write is needed
+		static void add(std::atomic<std::uint64_t>& a, std::uint64_t n)
+		{
+			a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+	public:
+		// charge this thread's current phase and switch to p, return the previous phase
+		static int enter(int p)
+		{
+			counters& c = current();
+			const std::uint64_t t = now();
+			if (c.cur >= 0) {
+				add(c.ticks[c.cur], t - c.last);
+			}
+			add(c.calls[p], 1);
+			const int prev = c.cur;
+			c.cur = p;
+			c.last = t;
+
+			return prev;
+		}
+		// charge the current phase and go back to prev
+		static void leave(int prev)
+		{
+			counters& c = current();
+			const std::uint64_t t = now();
+			if (c.cur >= 0) {
+				add(c.ticks[c.cur], t - c.last);
+			}
+			c.cur = prev;
+			c.last = t;
+		}
+
+		class scope {
+			int prev = -1;
+		public:
+			constexpr explicit scope(id p)
+			{
+				if (!std::is_constant_evaluated()) {
+					prev = enter(p);
+				}
+			}
+			scope(const scope&) = delete;
+			scope& operator=(const scope&) = delete;
+			constexpr ~scope()
+			{
+				if (!std::is_constant_evaluated()) {
+					leave(prev);
+				}
+			}
+		};
+
+		struct totals {
+			std::uint64_t ticks[phases] = {};
+			std::uint64_t calls[phases] = {};
+		};
+		// sum over all threads, live and exited
+		static totals snapshot()
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+			const std::uint64_t e = r.epoch.load(std::memory_order_relaxed);
+			totals s;
+			for (int p = 0; p < phases; ++p) {
+				s.ticks[p] = r.ticks[p];
+				s.calls[p] = r.calls[p];
+				for (counters* c : r.threads) {
+					if (c->epoch.load(std::memory_order_acquire) != e) {
+						continue; // not zeroed since the last reset
+					}
+					s.ticks[p] += c->ticks[p].load(std::memory_order_relaxed);
+					s.calls[p] += c->calls[p].load(std::memory_order_relaxed);
+				}
+			}
+
+			return s;
+		}
+		// zero the counts, e.g. before each input
+		// counts racing with a reset may be dropped
+		static void reset()
+		{
+			registry& r = global();
+			std::lock_guard<std::mutex> lock(r.m);
+			for (int p = 0; p < phases; ++p) {
+				r.ticks[p] = r.calls[p] = 0;
+			}
+			r.epoch.fetch_add(1, std::memory_order_release);
+		}
+
+		// one line per phase: name calls cycles percent of cycles, largest first
+		template<class Buffer>
+		static void text(Buffer& out)
+		{
+			const totals s = snapshot();
+			std::uint64_t total = 0;
+			int order[phases];
+			for (int p = 0; p < phases; ++p) {
+				total += s.ticks[p];
+				order[p] = p;
+			}
+			std::sort(order, order + phases, [&s](int a, int b) { return s.ticks[a] > s.ticks[b]; });
+			char buf[128];
+			int m = std::snprintf(buf, sizeof(buf), "%-8s %12s %14s %6s\n", "phase", "calls", "cycles", "%");
+			out.append(buf, m);
+			for (int p : order) {
+				m = std::snprintf(buf, sizeof(buf), "%-8s %12llu %14llu %6.1f\n", name(p), static_cast<unsigned long long>(s.calls[p]),
+					static_cast<unsigned long long>(s.ticks[p]), total ? 100. * s.ticks[p] / total : 0.);
+				out.append(buf, m);
+			}
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				static_assert([] { scope s(dom); return true; }()); // nothing at compile time
+				reset();
+				{
+					scope a(dom);
+					{
+						scope b(string);
+						scope c(trim);
+					}
+					scope d(number);
+				}
+				auto s = snapshot();
+				assert(s.calls[dom] == 1 and s.calls[string] == 1 and s.calls[trim] == 1 and s.calls[number] == 1);
+				assert(s.calls[scan] == 0 and s.ticks[scan] == 0);
+				assert(local().cur == -1);
+			}
+			{
+				reset();
+				std::thread([] {
+					scope s(scan);
+					volatile int x = 0;
+					for (int i = 0; i < 1000; ++i) {
+						x = x + i;
+					}
+				}).join();
+				auto s = snapshot();
+				assert(s.calls[scan] == 1 and s.ticks[scan] > 0);
+				std::string t;
+				text(t);
+				assert(t.find("scan") != std::string::npos);
+				assert(t.find("100.0") != std::string::npos);
+				reset();
+				assert(snapshot().calls[scan] == 0);
+			}
+			{
+				// reset while a thread is in a phase, it zeroes its own counts
+				std::atomic<int> step = 0;
+				std::thread u([&] {
+					{
+						scope s(number);
+					}
+					step = 1;
+					while (step != 2)
+					{ }
+					scope s(string);
+					step = 3;
+					while (step != 4)
+					{ }
+				});
+				while (step != 1)
+				{ }
+				assert(snapshot().calls[number] == 1);
+				reset();
+				assert(snapshot().calls[number] == 0);
+				step = 2;
+				while (step != 3)
+				{ }
+				auto s = snapshot();
+				assert(s.calls[number] == 0 and s.calls[string] == 1);
+				step = 4;
+				u.join();
+				reset();
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	inline phase::counters::counters()
+	{
+		registry& r = global();
+		std::lock_guard<std::mutex> lock(r.m);
+		epoch.store(r.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		r.threads.push_back(this);
+	}
+	inline phase::counters::~counters()
+	{
+		registry& r = global();
+		std::lock_guard<std::mutex> lock(r.m);
+		if (epoch.load(std::memory_order_relaxed) == r.epoch.load(std::memory_order_relaxed)) {
+			for (int p = 0; p < phases; ++p) {
+				r.ticks[p] += ticks[p].load(std::memory_order_relaxed);
+				r.calls[p] += calls[p].load(std::memory_order_relaxed);
+			}
+		}
+		r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this));
+	}
+
+} // namespace fms
+
+#endif // FMS_PHASE_INCLUDED
@@ -0,0 +1,17 @@
+// fms_phase_scope.h - FMS_PHASE without the profiler unless it is used
+#ifndef FMS_PHASE_SCOPE_INCLUDED
+#define FMS_PHASE_SCOPE_INCLUDED
+
+// Define FMS_PROFILE to attribute time to phases, otherwise FMS_PHASE compiles
+// to nothing and fms_phase.h is not included.
+#ifdef FMS_PROFILE
+#include "fms_phase.h"
+#define FMS_PHASE_CAT_(a, b) a##b
+#define FMS_PHASE_CAT(a, b) FMS_PHASE_CAT_(a, b)
+// charge time from here to the end of the scope to phase p, less nested phases
+#define FMS_PHASE(p) ::fms::phase::scope FMS_PHASE_CAT(fms_phase_, __LINE__)(::fms::phase::p)
+#else
+#define FMS_PHASE(p) static_cast<void>(0)
+#endif
+
+#endif // FMS_PHASE_SCOPE_INCLUDED
@@ -0,0 +1,25 @@
+// fms_probe.h - static tracepoints for bpftrace, perf, and systemtap
+#ifndef FMS_PROBE_INCLUDED
+#define FMS_PROBE_INCLUDED
+
+// FMS_PROBE(name, args...) is a USDT probe in provider fms if <sys/sdt.h> is
+// available. It is a nop instruction until a tracer attaches and needs no
+// library at run time. Define FMS_NO_PROBES to leave them out.
+//
+// fms:block(offset, size, address)      block of input a thread converts
+// fms:record(address, size)             record about to be converted
+// fms:document_start(address, size)     json::parse of at most size characters
+// fms:document_end(address, size)       size characters were parsed
+// fms:huge_alloc(size, hugetlb)         mapping of size bytes, hugetlb is 1 if from the pool
+// fms:buffer_grow(capacity, size)       huge_buffer copying to a larger block
+//
+// e.g. bpftrace -e 'usdt:./a.out:fms:record { @bytes = hist(arg1); }'
+#if defined(__linux__) and !defined(FMS_NO_PROBES) and __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FMS_PROBES
+#define FMS_PROBE(name, ...) STAP_PROBEV(fms, name, __VA_ARGS__)
+#else
+#define FMS_PROBE(name, ...) static_cast<void>(0)
+#endif
+
+#endif // FMS_PROBE_INCLUDED
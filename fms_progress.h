@@ -0,0 +1,317 @@
+// fms_progress.h - live progress and throughput of long running parses
+#ifndef FMS_PROGRESS_INCLUDED
+#define FMS_PROGRESS_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace fms {
+
+	/// <summary>
+	/// Counters parsers add to in batches and any thread can read without locks
+	/// </summary>
+	/// <remarks>
+	/// Parsers keep a progress::batch on the stack and count into it, the batch
+	/// adds to the shared counters every batch::size records and when it goes
+	/// out of scope, so the hot path only touches locals.
+	/// Input before offset() has been completely processed.
+	/// Set total() to the input size to get an ETA from a reporter.
+	/// </remarks>
+	class progress {
+		std::atomic<std::uint64_t> bytes_{ 0 }, records_{ 0 }, fields_{ 0 }, documents_{ 0 }, errors_{ 0 }, offset_{ 0 }, total_{ 0 };
+	public:
+		struct counts {
+			std::uint64_t bytes = 0; // input consumed
+			std::uint64_t records = 0;
+			std::uint64_t fields = 0;
+			std::uint64_t documents = 0; // JSON documents read or written
+			std::uint64_t errors = 0;
+			std::uint64_t offset = 0; // input before this is done
+			std::uint64_t total = 0; // input size if known
+		};
+
+		progress(std::uint64_t total = 0)
+			: total_(total)
+		{ }
+		progress(const progress&) = delete;
+		progress& operator=(const progress&) = delete;
+
+		void total(std::uint64_t n)
+		{
+			total_.store(n, std::memory_order_relaxed);
+		}
+		void offset(std::uint64_t n)
+		{
+			offset_.store(n, std::memory_order_relaxed);
+		}
+		// add counts from one batch, offset and total are not added
+		void add(const counts& c)
+		{
+			bytes_.fetch_add(c.bytes, std::memory_order_relaxed);
+			records_.fetch_add(c.records, std::memory_order_relaxed);
+			fields_.fetch_add(c.fields, std::memory_order_relaxed);
+			documents_.fetch_add(c.documents, std::memory_order_relaxed);
+			errors_.fetch_add(c.errors, std::memory_order_relaxed);
+		}
+		// current counts, each is up to date as of its last batch
+		counts read() const
+		{
+			counts c;
+			c.bytes = bytes_.load(std::memory_order_relaxed);
+			c.records = records_.load(std::memory_order_relaxed);
+			c.fields = fields_.load(std::memory_order_relaxed);
+			c.documents = documents_.load(std::memory_order_relaxed);
+			c.errors = errors_.load(std::memory_order_relaxed);
+			c.offset = offset_.load(std::memory_order_relaxed);
+			c.total = total_.load(std::memory_order_relaxed);
+
+			return c;
+		}
+		void clear()
+		{
+			bytes_ = records_ = fields_ = documents_ = errors_ = offset_ = 0;
+		}
+
+		// counts kept by one thread and added to p, which may be null
+		class batch {
+			progress* p;
+			counts c;
+			std::uint64_t base = 0; // offset of the start of the input
+			bool at = false; // keep offset
+			unsigned n = 0; // records since the last flush
+		public:
+			static constexpr unsigned size = 1024;
+
+			batch(progress* p)
+				: p(p)
+			{ }
+			// also keep the offset of ends relative to buf
+			batch(progress* p, const char* buf)
+				: p(p), base(reinterpret_cast<std::uintptr_t>(buf)), at(true)
+			{ }
+			batch(const batch&) = delete;
+			batch& operator=(const batch&) = delete;
+			~batch()
+			{
+				flush();
+			}
+
+			// a record of b bytes ending at e
+			void record(std::size_t b, std::size_t fields = 0, const char* e = nullptr)
+			{
+				if (p) {
+					c.bytes += b;
+					++c.records;
+					c.fields += fields;
+					if (e) {
+						c.offset = reinterpret_cast<std::uintptr_t>(e) - base;
+					}
+					if (++n == size) {
+						flush();
+					}
+				}
+			}
+			// b bytes between records, e.g. blank lines
+			void skip(std::size_t b)
+			{
+				c.bytes += b;
+			}
+			void document()
+			{
+				++c.documents;
+			}
+			// b bytes that could not be parsed ending at e
+			void error(std::size_t b = 0, const char* e = nullptr)
+			{
+				if (p) {
+					c.bytes += b;
+					++c.errors;
+					if (e) {
+						c.offset = reinterpret_cast<std::uintptr_t>(e) - base;
+					}
+					if (++n == size) {
+						flush();
+					}
+				}
+			}
+			void flush()
+			{
+				if (p) {
+					p->add(c);
+					if (at) {
+						p->offset(c.offset);
+					}
+					std::uint64_t o = c.offset;
+					c = counts{};
+					c.offset = o;
+				}
+				n = 0;
+			}
+		};
+
+		// counts at a time with the rate since the previous report
+		struct report {
+			counts now;
+			double seconds = 0; // since the reporter started
+			double rate = 0; // input bytes per second since the previous report
+			double eta = -1; // seconds to finish total, -1 if not known
+
+			// e.g. "12.5 MB/s 1024 records 0 errors 40.0% ETA 12s"
+			std::string text() const
+			{
+				char buf[160];
+				int n = std::snprintf(buf, sizeof(buf), "%.1f MB/s %llu records %llu errors",
+					rate / 1e6, static_cast<unsigned long long>(now.records), static_cast<unsigned long long>(now.errors));
+				if (now.total and n > 0) {
+					std::snprintf(buf + n, sizeof(buf) - n, " %.1f%%", 100. * now.bytes / now.total);
+				}
+				std::string s(buf);
+				if (eta >= 0) {
+					std::snprintf(buf, sizeof(buf), " ETA %.0fs", eta);
+					s += buf;
+				}
+
+				return s;
+			}
+		};
+
+		/// <summary>
+		/// Calls f with a report of p every interval on its own thread
+		/// </summary>
+		/// <remarks>
+		/// The default f writes report::text lines to stderr.
+		/// A final report is made when the reporter is destroyed.
+		/// </remarks>
+		class reporter {
+			using clock = std::chrono::steady_clock;
+			const progress& p;
+			std::function<void(const report&)> f;
+			clock::duration every;
+			clock::time_point t0, t;
+			counts last;
+			std::mutex m;
+			std::condition_variable cv;
+			bool done = false;
+			std::thread thread;
+
+			void tick()
+			{
+				auto now = clock::now();
+				report r;
+				r.now = p.read();
+				r.seconds = std::chrono::duration<double>(now - t0).count();
+				double dt = std::chrono::duration<double>(now - t).count();
+				if (dt > 0) {
+					r.rate = (r.now.bytes - last.bytes) / dt;
+				}
+				if (r.now.total and r.rate > 0) {
+					r.eta = r.now.bytes < r.now.total ? (r.now.total - r.now.bytes) / r.rate : 0;
+				}
+				last = r.now;
+				t = now;
+				f(r);
+			}
+		public:
+			reporter(const progress& p, std::chrono::milliseconds every = std::chrono::seconds(1),
+				std::function<void(const report&)> f = [](const report& r) { std::fprintf(stderr, "%s\n", r.text().c_str()); })
+				: p(p), f(std::move(f)), every(every), t0(clock::now()), t(t0), last(p.read())
+			{
+				thread = std::thread([this] {
+					std::unique_lock<std::mutex> l(m);
+					while (!cv.wait_for(l, this->every, [this] { return done; })) {
+						tick();
+					}
+				});
+			}
+			reporter(const reporter&) = delete;
+			reporter& operator=(const reporter&) = delete;
+			~reporter()
+			{
+				{
+					std::lock_guard<std::mutex> l(m);
+					done = true;
+				}
+				cv.notify_one();
+				thread.join();
+				tick();
+			}
+		};
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				progress p(1000);
+				const char buf[] = "0123456789";
+				{
+					batch b(&p, buf);
+					b.record(4, 2, buf + 4);
+					b.document();
+					b.skip(1);
+					b.error(2, buf + 7);
+					// nothing is visible until a flush
+					assert(p.read().records == 0);
+				}
+				auto c = p.read();
+				assert(c.bytes == 7 and c.records == 1 and c.fields == 2);
+				assert(c.documents == 1 and c.errors == 1);
+				assert(c.offset == 7 and c.total == 1000);
+				{
+					batch b(&p);
+					for (unsigned i = 0; i < batch::size; ++i) {
+						b.record(1);
+					}
+					// flushed after size records
+					assert(p.read().records == 1 + batch::size);
+				}
+				assert(p.read().offset == 7);
+				p.clear();
+				assert(p.read().bytes == 0 and p.read().total == 1000);
+			}
+			{
+				batch b(nullptr);
+				b.record(1);
+				b.error();
+			}
+			{
+				progress p(100);
+				int n = 0;
+				report last;
+				{
+					reporter r(p, std::chrono::milliseconds(1), [&](const report& r_) { ++n; last = r_; });
+					progress::batch b(&p);
+					b.record(50);
+					b.flush();
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				}
+				assert(n >= 2);
+				assert(last.now.bytes == 50);
+				assert(last.seconds > 0);
+			}
+			{
+				report r;
+				r.now.records = 3;
+				r.now.bytes = 40;
+				r.now.total = 100;
+				r.rate = 2e6;
+				r.eta = 5;
+				assert(r.text() == "2.0 MB/s 3 records 0 errors 40.0% ETA 5s");
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_PROGRESS_INCLUDED
@@ -0,0 +1,155 @@
+// fms_reclaimer.h - destroy objects on a background thread
+#ifndef FMS_RECLAIMER_INCLUDED
+#define FMS_RECLAIMER_INCLUDED
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace fms {
+
+	/// <summary>
+	/// Move objects here to have them destroyed on a background thread
+	/// </summary>
+	/// <remarks>
+	/// Freeing a large json::value walks every node. retire() only moves
+	/// the object into a queue so destruction is off the calling thread.
+	/// The caller supplies a size hint, e.g. the length of the parsed text,
+	/// since measuring a document would cost as much as freeing it.
+	/// Counters are atomic and can be read from any thread.
+	/// </remarks>
+	template<class T>
+	class reclaimer {
+		std::deque<std::pair<T, std::size_t>> q;
+		std::mutex m;
+		std::condition_variable cv, idle;
+		bool stop = false, busy = false;
+		std::atomic<std::size_t> queued_{ 0 }, queued_bytes_{ 0 }, peak_bytes_{ 0 };
+		std::atomic<std::size_t> reclaimed_{ 0 }, reclaimed_bytes_{ 0 };
+		std::thread t; // last so it starts after the members it uses
+
+		void run()
+		{
+			std::unique_lock lock(m);
+
+			while (true) {
+				cv.wait(lock, [this] { return stop or !q.empty(); });
+				if (q.empty()) {
+					return; // stop
+				}
+				std::deque<std::pair<T, std::size_t>> q_;
+				std::swap(q, q_);
+				busy = true;
+				lock.unlock();
+
+				std::size_t n = q_.size(), bytes = 0;
+				for (const auto& i : q_) {
+					bytes += i.second;
+				}
+				q_.clear(); // the work
+				queued_ -= n;
+				queued_bytes_ -= bytes;
+				reclaimed_ += n;
+				reclaimed_bytes_ += bytes;
+
+				lock.lock();
+				busy = false;
+				idle.notify_all();
+			}
+		}
+
+	public:
+		reclaimer()
+			: t(&reclaimer::run, this)
+		{ }
+		reclaimer(const reclaimer&) = delete;
+		reclaimer& operator=(const reclaimer&) = delete;
+		// destroy anything still queued
+		~reclaimer()
+		{
+			{
+				std::lock_guard lock(m);
+				stop = true;
+			}
+			cv.notify_one();
+			t.join();
+		}
+
+		// take ownership of x and destroy it later, bytes is a size hint
+		void retire(T&& x, std::size_t bytes = 0)
+		{
+			{
+				std::lock_guard lock(m);
+				q.emplace_back(std::move(x), bytes);
+				++queued_;
+				std::size_t b = queued_bytes_ += bytes;
+				if (b > peak_bytes_) {
+					peak_bytes_ = b;
+				}
+			}
+			cv.notify_one();
+		}
+
+		// wait until everything retired so far is destroyed
+		void flush()
+		{
+			std::unique_lock lock(m);
+			idle.wait(lock, [this] { return q.empty() and !busy; });
+		}
+
+		// objects waiting to be destroyed
+		std::size_t queued() const
+		{
+			return queued_;
+		}
+		std::size_t queued_bytes() const
+		{
+			return queued_bytes_;
+		}
+		// largest value of queued_bytes()
+		std::size_t peak_bytes() const
+		{
+			return peak_bytes_;
+		}
+		std::size_t reclaimed() const
+		{
+			return reclaimed_;
+		}
+		std::size_t reclaimed_bytes() const
+		{
+			return reclaimed_bytes_;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				reclaimer<T> r;
+				assert(r.queued() == 0);
+				r.flush();
+				for (int i = 0; i < 100; ++i) {
+					T x{};
+					r.retire(std::move(x), 10);
+				}
+				assert(r.peak_bytes() >= 10);
+				r.flush();
+				assert(r.queued() == 0 and r.queued_bytes() == 0);
+				assert(r.reclaimed() == 100 and r.reclaimed_bytes() == 1000);
+			}
+			{
+				reclaimer<T> r;
+				r.retire(T{}, 1);
+				// destructor drains the queue
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_RECLAIMER_INCLUDED
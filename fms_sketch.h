@@ -0,0 +1,444 @@
+// fms_sketch.h - mergeable approximate counts, quantiles, and heavy hitters
+#ifndef FMS_SKETCH_INCLUDED
+#define FMS_SKETCH_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#endif
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace fms {
+
+	// 64 bit hash of s with well mixed bits
+	inline std::uint64_t sketch_hash(std::string_view s)
+	{
+		std::uint64_t h = std::hash<std::string_view>{}(s);
+		// splitmix64 finalizer
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+
+		return h ^ (h >> 31);
+	}
+
+	/// <summary>
+	/// HyperLogLog estimate of the number of distinct values
+	/// </summary>
+	/// <remarks>
+	/// 2^P one byte registers give a standard error of about 1.04/2^(P/2),
+	/// 1.6% for the default P = 12. Small counts use linear counting.
+	/// Sketches with the same P merge by taking the maximum of each register.
+	/// </remarks>
+	template<int P = 12>
+	class hyperloglog {
+		static constexpr std::size_t m = std::size_t(1) << P;
+		std::vector<std::uint8_t> reg;
+	public:
+		hyperloglog()
+			: reg(m)
+		{ }
+
+		// add a value by its hash
+		void add(std::uint64_t h)
+		{
+			std::uint8_t& r = reg[h >> (64 - P)];
+			std::uint8_t rho = static_cast<std::uint8_t>(std::countl_zero((h << P) | (std::uint64_t(1) << (P - 1))) + 1);
+			r = std::max(r, rho);
+		}
+		void add(std::string_view s)
+		{
+			add(sketch_hash(s));
+		}
+		void merge(const hyperloglog& h)
+		{
+			for (std::size_t i = 0; i < m; ++i) {
+				reg[i] = std::max(reg[i], h.reg[i]);
+			}
+		}
+		double estimate() const
+		{
+			double sum = 0;
+			std::size_t zeros = 0;
+			for (auto r : reg) {
+				sum += std::ldexp(1., -r);
+				zeros += r == 0;
+			}
+			const double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+			if (e <= 2.5 * m and zeros) {
+				return m * std::log(static_cast<double>(m) / zeros);
+			}
+
+			return e;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				hyperloglog h;
+				assert(h.estimate() == 0);
+				for (int i = 0; i < 10; ++i) {
+					h.add(std::to_string(i % 5));
+				}
+				assert(std::round(h.estimate()) == 5);
+			}
+			{
+				hyperloglog a, b;
+				for (int i = 0; i < 200000; ++i) {
+					(i % 2 ? a : b).add(std::to_string(i));
+					a.add(std::to_string(i % 1000));
+				}
+				a.merge(b);
+				double e = a.estimate();
+				assert(e > 200000 * .95 and e < 200000 * 1.05);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	/// <summary>
+	/// KLL sketch of a stream of numbers for approximate quantiles
+	/// </summary>
+	/// <remarks>
+	/// Level h holds items of weight 2^h. When a level fills it is sorted and
+	/// every other item, starting at a random one of the first two, moves up a
+	/// level. Capacities shrink by 2/3 per level below the top to no less than 8,
+	/// so the sketch keeps O(k) items plus 8 per level and ranks are within about
+	/// 1.7/k of n for k = 200.
+	/// Merging appends level by level and compacts.
+	/// </remarks>
+	class kll {
+		std::size_t k;
+		std::vector<std::vector<double>> levels;
+		std::vector<std::size_t> caps; // capacity of each level
+		std::uint64_t n = 0;
+		std::uint64_t bits = 0x9e3779b97f4a7c15; // coin flips
+		double min_ = std::numeric_limits<double>::infinity();
+		double max_ = -std::numeric_limits<double>::infinity();
+
+		// add a level and recompute capacities
+		void grow()
+		{
+			levels.emplace_back();
+			caps.resize(levels.size());
+			double c = static_cast<double>(k);
+			for (std::size_t h = levels.size(); h-- > 0; c *= 2. / 3) {
+				caps[h] = std::max<std::size_t>(8, static_cast<std::size_t>(c));
+			}
+		}
+		bool coin()
+		{
+			bits ^= bits << 13;
+			bits ^= bits >> 7;
+			bits ^= bits << 17;
+
+			return bits & 1;
+		}
+		// move every other item of level h up a level
+		void compact(std::size_t h)
+		{
+			if (h + 1 == levels.size()) {
+				grow();
+			}
+			auto& x = levels[h];
+			std::sort(x.begin(), x.end());
+			double odd = 0;
+			const bool keep = x.size() % 2;
+			if (keep) {
+				odd = x.back();
+				x.pop_back();
+			}
+			for (std::size_t i = coin(); i < x.size(); i += 2) {
+				levels[h + 1].push_back(x[i]);
+			}
+			x.clear();
+			if (keep) {
+				x.push_back(odd);
+			}
+		}
+		// compact full levels from h up, stopping at the first that is not full unless all
+		void compact(std::size_t h, bool all)
+		{
+			for (; h < levels.size(); ++h) {
+				if (levels[h].size() >= caps[h]) {
+					compact(h);
+				}
+				else if (!all) {
+					break;
+				}
+			}
+		}
+	public:
+		kll(std::size_t k = 200)
+			: k(k)
+		{
+			grow();
+		}
+
+		std::uint64_t count() const
+		{
+			return n;
+		}
+		double min() const
+		{
+			return min_;
+		}
+		double max() const
+		{
+			return max_;
+		}
+		// items kept
+		std::size_t size() const
+		{
+			std::size_t s = 0;
+			for (const auto& l : levels) {
+				s += l.size();
+			}
+
+			return s;
+		}
+
+		// NaN is ignored since it has no rank
+		void add(double x)
+		{
+			if (x != x) {
+				return;
+			}
+			levels[0].push_back(x);
+			++n;
+			min_ = std::min(min_, x);
+			max_ = std::max(max_, x);
+			if (levels[0].size() >= caps[0]) {
+				compact(0, false);
+			}
+		}
+		void merge(const kll& s)
+		{
+			while (levels.size() < s.levels.size()) {
+				grow();
+			}
+			for (std::size_t h = 0; h < s.levels.size(); ++h) {
+				levels[h].insert(levels[h].end(), s.levels[h].begin(), s.levels[h].end());
+			}
+			n += s.n;
+			min_ = std::min(min_, s.min_);
+			max_ = std::max(max_, s.max_);
+			compact(0, true);
+		}
+
+		// value with about q n items at or below it, NaN if empty
+		double quantile(double q) const
+		{
+			if (n == 0) {
+				return std::numeric_limits<double>::quiet_NaN();
+			}
+			if (q <= 0) {
+				return min_;
+			}
+			if (q >= 1) {
+				return max_;
+			}
+			std::vector<std::pair<double, std::uint64_t>> w;
+			std::uint64_t total = 0;
+			for (std::size_t h = 0; h < levels.size(); ++h) {
+				for (double x : levels[h]) {
+					w.emplace_back(x, std::uint64_t(1) << h);
+					total += std::uint64_t(1) << h;
+				}
+			}
+			std::sort(w.begin(), w.end());
+			const double rank = q * total;
+			std::uint64_t c = 0;
+			for (const auto& [x, wx] : w) {
+				c += wx;
+				if (c >= rank) {
+					return x;
+				}
+			}
+
+			return max_;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				kll s;
+				assert(std::isnan(s.quantile(.5)));
+				for (int i = 1; i <= 5; ++i) {
+					s.add(i);
+				}
+				s.add(std::numeric_limits<double>::quiet_NaN());
+				assert(s.count() == 5);
+				assert(s.quantile(.5) == 3 and s.quantile(0) == 1 and s.quantile(1) == 5);
+			}
+			{
+				kll a, b;
+				for (int i = 0; i < 1000000; ++i) {
+					(i % 3 ? a : b).add(static_cast<double>(i * 7919LL % 1000000));
+				}
+				a.merge(b);
+				assert(a.count() == 1000000 and a.min() == 0 and a.max() == 999999);
+				assert(a.size() < 1000);
+				for (double q : { .01, .1, .5, .9, .99 }) {
+					assert(std::fabs(a.quantile(q) - q * 1e6) < .02 * 1e6);
+				}
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	/// <summary>
+	/// Most frequent values using the Misra-Gries summary
+	/// </summary>
+	/// <remarks>
+	/// Keeps at most 2k counters and when there are more subtracts the
+	/// (k+1)-th largest count from all of them, dropping those at zero, so
+	/// the decrements are amortized. A count is at most n/(k+1) below the
+	/// true count and any value occurring more than n/(k+1) times is kept.
+	/// Merging adds counters and prunes the same way.
+	/// Values are identified by their 64 bit sketch_hash in an open addressing
+	/// table that is rebuilt when pruned, so a value is hashed once and a string
+	/// is only stored when a counter is created.
+	/// </remarks>
+	class heavy_hitters {
+		struct slot {
+			std::uint64_t h;
+			std::uint64_t m = 0; // count, 0 if empty
+			std::string s;
+		};
+		std::size_t k;
+		std::vector<slot> table; // power of 2 at least 4k
+		std::vector<slot> keep; // scratch for prune
+		std::vector<std::uint64_t> counts;
+		std::size_t used = 0;
+		std::uint64_t n = 0;
+
+		slot& find(std::uint64_t h)
+		{
+			std::size_t i = h & (table.size() - 1);
+			while (table[i].m and table[i].h != h) {
+				i = (i + 1) & (table.size() - 1);
+			}
+
+			return table[i];
+		}
+		void insert(std::uint64_t h, std::string_view s, std::uint64_t m)
+		{
+			slot& x = find(h);
+			if (!x.m) {
+				x.h = h;
+				x.s.assign(s.data(), s.size());
+				++used;
+			}
+			x.m += m;
+			if (used > 2 * k) {
+				prune();
+			}
+		}
+		// keep the k largest counts less the (k+1)-th
+		void prune()
+		{
+			counts.clear();
+			for (const auto& e : table) {
+				if (e.m) {
+					counts.push_back(e.m);
+				}
+			}
+			std::nth_element(counts.begin(), counts.begin() + k, counts.end(), std::greater<>());
+			const std::uint64_t d = counts[k];
+			keep.clear();
+			for (auto& e : table) {
+				if (e.m > d) {
+					e.m -= d;
+					keep.push_back(std::move(e));
+				}
+				e.m = 0;
+			}
+			used = 0;
+			for (auto& e : keep) {
+				slot& y = find(e.h);
+				y = std::move(e);
+				++used;
+			}
+		}
+	public:
+		heavy_hitters(std::size_t k = 64)
+			: k(k), table(std::bit_ceil(4 * k + 4))
+		{ }
+
+		std::uint64_t count() const
+		{
+			return n;
+		}
+		// add a value by its sketch_hash
+		void add(std::uint64_t h, std::string_view s)
+		{
+			++n;
+			insert(h, s, 1);
+		}
+		void add(std::string_view s)
+		{
+			add(sketch_hash(s), s);
+		}
+		void merge(const heavy_hitters& hh)
+		{
+			for (const auto& e : hh.table) {
+				if (e.m) {
+					insert(e.h, e.s, e.m);
+				}
+			}
+			n += hh.n;
+		}
+		// at most t values with their lower bound counts, largest first
+		std::vector<std::pair<std::string, std::uint64_t>> top(std::size_t t) const
+		{
+			std::vector<std::pair<std::string, std::uint64_t>> v;
+			for (const auto& e : table) {
+				if (e.m) {
+					v.emplace_back(e.s, e.m);
+				}
+			}
+			std::sort(v.begin(), v.end(), [](const auto& a, const auto& b) { return a.second > b.second or (a.second == b.second and a.first < b.first); });
+			if (v.size() > t) {
+				v.resize(t);
+			}
+
+			return v;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				heavy_hitters a(4), b(4);
+				for (int i = 0; i < 10000; ++i) {
+					(i % 2 ? a : b).add(i % 10 < 5 ? "x" : i % 10 < 8 ? "y" : std::to_string(i));
+				}
+				a.merge(b);
+				assert(a.count() == 10000);
+				auto t = a.top(2);
+				assert(t.size() == 2);
+				assert(t[0].first == "x" and t[0].second <= 5000 and t[0].second >= 5000 - 10000 / 5);
+				assert(t[1].first == "y" and t[1].second >= 3000 - 10000 / 5);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+} // namespace fms
+
+#endif // FMS_SKETCH_INCLUDED
@@ -0,0 +1,231 @@
+// fms_trace.h - binary trace of parse events in a per-thread ring buffer
+#ifndef FMS_TRACE_INCLUDED
+#define FMS_TRACE_INCLUDED
+#ifdef _DEBUG
+#include <cassert>
+#include <string>
+#endif
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "fms_latency.h"
+
+namespace fms::trace {
+
+	enum kind : std::uint8_t {
+		document, // begin and end of json::parse
+		document_end,
+		object,
+		object_end,
+		array,
+		array_end,
+		string, // end of a scalar
+		number,
+		literal, // null, true, or false
+		split, // end of a piece from parse::split
+	};
+
+	// 16 byte event, offset is in bytes from ring::start
+	struct event {
+		std::uint64_t ticks; // latency::now()
+		std::uint64_t data; // offset << 16 | depth << 8 | kind
+
+		kind type() const
+		{
+			return static_cast<kind>(data & 0xFF);
+		}
+		unsigned depth() const
+		{
+			return static_cast<unsigned>((data >> 8) & 0xFF);
+		}
+		std::uint64_t offset() const
+		{
+			return data >> 16;
+		}
+	};
+
+	// file header followed by count events oldest first
+	struct header {
+		char magic[8] = { 'f', 'm', 's', 't', 'r', 'a', 'c', 'e' };
+		std::uint32_t version = 1;
+		std::uint32_t size = sizeof(event);
+		double ns_per_tick = 0;
+		std::uint64_t count = 0;
+		std::uint64_t dropped = 0; // older events overwritten
+	};
+
+	/// <summary>
+	/// Fixed size buffer keeping the last capacity events of one thread
+	/// </summary>
+	/// <remarks>
+	/// Nesting depth is kept by the ring from the begin and end events, so a
+	/// begin and its end have the same depth. Call start with the input before
+	/// parsing so offsets are from its first byte, otherwise they are addresses.
+	/// </remarks>
+	class ring {
+		std::vector<event> buf;
+		std::uint64_t n = 0; // events pushed
+		const char* base = nullptr;
+		unsigned depth = 0;
+	public:
+		static constexpr std::size_t default_capacity = std::size_t(1) << 16;
+
+		// capacity is rounded up to a power of 2
+		explicit ring(std::size_t capacity = default_capacity)
+			: buf(std::bit_ceil(capacity ? capacity : 1))
+		{ }
+
+		// ring of the calling thread
+		static ring& local()
+		{
+			thread_local ring r;
+
+			return r;
+		}
+
+		void start(const void* input)
+		{
+			base = static_cast<const char*>(input);
+			depth = 0;
+		}
+		void push(kind k, const void* at)
+		{
+			if (k == document_end or k == object_end or k == array_end) {
+				depth -= depth != 0;
+			}
+			std::uint64_t off = static_cast<std::uint64_t>(static_cast<const char*>(at) - base);
+			buf[n & (buf.size() - 1)] = event{ latency::now(), off << 16 | std::uint64_t(depth & 0xFF) << 8 | k };
+			++n;
+			if (k == document or k == object or k == array) {
+				++depth;
+			}
+		}
+
+		std::size_t capacity() const
+		{
+			return buf.size();
+		}
+		std::size_t size() const
+		{
+			return n < buf.size() ? static_cast<std::size_t>(n) : buf.size();
+		}
+		std::uint64_t dropped() const
+		{
+			return n - size();
+		}
+		// i-th oldest event kept
+		const event& operator[](std::size_t i) const
+		{
+			return buf[(dropped() + i) & (buf.size() - 1)];
+		}
+		void clear()
+		{
+			n = 0;
+			depth = 0;
+		}
+
+		// append the header and events
+		template<class Buffer>
+		void write(Buffer& out) const
+		{
+			header h;
+			h.ns_per_tick = latency::ns_per_tick();
+			h.count = size();
+			h.dropped = dropped();
+			out.append(reinterpret_cast<const char*>(&h), sizeof(h));
+			std::size_t b = static_cast<std::size_t>(dropped() & (buf.size() - 1));
+			std::size_t m = size() < buf.size() - b ? size() : buf.size() - b;
+			out.append(reinterpret_cast<const char*>(buf.data() + b), m * sizeof(event));
+			out.append(reinterpret_cast<const char*>(buf.data()), (size() - m) * sizeof(event));
+		}
+		// write to file path, false on failure
+		bool dump(const char* path) const
+		{
+			struct file {
+				std::FILE* f;
+				bool ok = true;
+				void append(const char* s, std::size_t len)
+				{
+					ok = ok and std::fwrite(s, 1, len, f) == len;
+				}
+			} out{ std::fopen(path, "wb") };
+			if (!out.f) {
+				return false;
+			}
+			write(out);
+
+			return std::fclose(out.f) == 0 and out.ok;
+		}
+
+#ifdef _DEBUG
+		static int test()
+		{
+			{
+				static_assert(sizeof(event) == 16);
+				ring r(3);
+				assert(r.capacity() == 4);
+				const char buf[] = "[1,{}]";
+				r.start(buf);
+				r.push(array, buf);
+				r.push(number, buf + 2);
+				r.push(object, buf + 3);
+				assert(r.size() == 3 and r.dropped() == 0);
+				r.push(object_end, buf + 5);
+				r.push(array_end, buf + 6);
+				assert(r.size() == 4 and r.dropped() == 1);
+				assert(r[0].type() == number and r[0].offset() == 2 and r[0].depth() == 1);
+				assert(r[1].type() == object and r[1].depth() == 1);
+				assert(r[2].type() == object_end and r[2].depth() == 1 and r[2].offset() == 5);
+				assert(r[3].type() == array_end and r[3].depth() == 0 and r[3].offset() == 6);
+				assert(r[0].ticks <= r[3].ticks);
+
+				std::string s;
+				r.write(s);
+				assert(s.size() == sizeof(header) + 4 * sizeof(event));
+				header h;
+				std::memcpy(&h, s.data(), sizeof(h));
+				assert(0 == std::memcmp(h.magic, "fmstrace", 8));
+				assert(h.count == 4 and h.dropped == 1 and h.ns_per_tick > 0);
+				for (std::size_t i = 0; i < 4; ++i) {
+					event e;
+					std::memcpy(&e, s.data() + sizeof(h) + i * sizeof(e), sizeof(e));
+					assert(e.ticks == r[i].ticks and e.data == r[i].data);
+				}
+				r.clear();
+				assert(r.size() == 0);
+			}
+
+			return 0;
+		}
+#endif // _DEBUG
+	};
+
+	// tracing policy that compiles to nothing
+	struct none {
+		static constexpr bool enabled = false;
+
+		static void start(const void*)
+		{ }
+		static void emit(kind, const void*)
+		{ }
+	};
+
+	// tracing policy recording into ring::local()
+	struct local {
+		static constexpr bool enabled = true;
+
+		static void start(const void* input)
+		{
+			ring::local().start(input);
+		}
+		static void emit(kind k, const void* at)
+		{
+			ring::local().push(k, at);
+		}
+	};
+
+} // namespace fms::trace
+
+#endif // FMS_TRACE_INCLUDED